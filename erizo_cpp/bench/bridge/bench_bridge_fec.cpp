@@ -0,0 +1,180 @@
+// Throughput of the bridge FEC path: the XOR kernel against a byte at a
+// time loop, BridgeFecEncoder per packet, and BridgeFecDecoder rebuilding
+// one lost packet per group.
+//
+//   bench_bridge_fec [-g group,..] [-s size] [-d seconds]
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include "bridge/bridge_xor.h"
+#include "bridge/bridge_fec.h"
+
+static uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// keeps the compiler from dropping work whose result is never read
+static volatile char g_sink;
+
+static double xorGbps(void (*kernel)(char *, const char *, int), int size, int seconds)
+{
+    std::vector<char> dst(size, 1), src(size, 3);
+    uint64_t bytes = 0;
+    uint64_t begin = nowNs();
+    uint64_t end = begin + seconds * 1000000000ULL;
+    uint64_t now = begin;
+    while (now < end)
+    {
+        for (int i = 0; i < 1024; i++)
+            kernel(dst.data(), src.data(), size);
+        bytes += 1024ULL * size;
+        now = nowNs();
+    }
+    g_sink = dst[size / 2];
+    return bytes * 8 / ((now - begin) / 1e9) / 1e9;
+}
+
+static void runGroup(int group, int size, int seconds)
+{
+    std::vector<std::vector<char>> packets(group, std::vector<char>(size));
+    for (int i = 0; i < group; i++)
+    {
+        for (int j = 0; j < size; j++)
+            packets[i][j] = (char)(rand() & 0xff);
+    }
+
+    // encode: packets/sec through the encoder, parity included
+    BridgeFecEncoder encoder(group);
+    uint64_t encoded = 0;
+    uint16_t seq = 0;
+    uint64_t begin = nowNs();
+    uint64_t end = begin + seconds * 1000000000ULL;
+    uint64_t now = begin;
+    while (now < end)
+    {
+        for (int i = 0; i < 1024; i++)
+        {
+            encoder.add(seq, 0x02, packets[seq % group].data(), size);
+            seq++;
+        }
+        encoded += 1024;
+        now = nowNs();
+    }
+    double encode_pps = encoded / ((now - begin) / 1e9);
+
+    // decode: every group loses its middle packet and gets it rebuilt
+    BridgeFecEncoder group_encoder(group);
+    std::vector<char> parity;
+    for (int i = 0; i < group; i++)
+    {
+        if (group_encoder.add(i, 0x02, packets[i].data(), size))
+            parity.assign(group_encoder.getParity(), group_encoder.getParity() + group_encoder.getParityLength());
+    }
+
+    BridgeFecDecoder decoder;
+    char rebuilt[BRIDGE_MUX_MAX_PAYLOAD];
+    uint64_t groups = 0, failed = 0;
+    begin = nowNs();
+    end = begin + seconds * 1000000000ULL;
+    now = begin;
+    while (now < end)
+    {
+        for (int n = 0; n < 64; n++)
+        {
+            uint16_t base = (uint16_t)(groups * group);
+            for (int i = 0; i < group; i++)
+            {
+                if (i != group / 2)
+                    decoder.addPacket(base + i, 0x02, packets[i].data(), size);
+            }
+            decoder.addParity(base, parity.data(), parity.size());
+
+            uint16_t rebuilt_seq;
+            uint8_t flags;
+            int len;
+            if (!decoder.recover(rebuilt_seq, flags, rebuilt, len) ||
+                rebuilt_seq != (uint16_t)(base + group / 2) ||
+                len != size || memcmp(rebuilt, packets[group / 2].data(), size))
+                failed++;
+            groups++;
+        }
+        now = nowNs();
+    }
+    double decode_gps = groups / ((now - begin) / 1e9);
+
+    printf("%6d %6d %14.0f %10.2f %14.0f %10.2f %8lu\n",
+           group,
+           size,
+           encode_pps,
+           encode_pps * size * 8 / 1e9,
+           decode_gps,
+           decode_gps * group * size * 8 / 1e9,
+           (unsigned long)failed);
+}
+
+static std::vector<int> parseList(const char *arg)
+{
+    std::vector<int> list;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if (atoi(item.c_str()) > 0)
+            list.push_back(atoi(item.c_str()));
+    }
+    return list;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> groups = {4, 10, 20, 48};
+    int size = 1200;
+    int seconds = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:s:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'g':
+            groups = parseList(optarg);
+            break;
+        case 's':
+            size = atoi(optarg);
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        default:
+            printf("Usage:%s [-g group,..] [-s size] [-d seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (size <= 0 || size > BRIDGE_MUX_MAX_PAYLOAD)
+    {
+        printf("packet size must be in [1, %d]\n", BRIDGE_MUX_MAX_PAYLOAD);
+        return 1;
+    }
+
+    printf("xor %d bytes: scalar %.2f Gbps, bridgeXor %.2f Gbps\n\n",
+           size, xorGbps(bridgeXorScalar, size, seconds), xorGbps(bridgeXor, size, seconds));
+
+    printf("%6s %6s %14s %10s %14s %10s %8s\n",
+           "group", "size", "encode pkt/s", "enc Gbps", "decode grp/s", "dec Gbps", "failed");
+    for (int group : groups)
+    {
+        if (group < 2 || group > BRIDGE_FEC_MAX_GROUP)
+            continue;
+        runGroup(group, size, seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,383 @@
+// Loopback benchmark of the multiplexed bridge transport. S cascaded
+// streams are sent through BridgeMuxSink -> one BridgeLink -> the node's
+// own mux socket -> BridgeMuxSource -> counting sink, which is the whole
+// sending and receiving path of two cascaded nodes on one host. Reports
+// packets/sec, loss, latency, CPU and how many streams one core carries.
+//
+//   bench_bridge_mux [-n streams,..] [-r pps per stream] [-s size] [-d seconds] [-w workers] [-p port] [-u] [-m max kbps] [-l loss%] [-f fec group] [-N]
+//                    [-L links] [-k hot%] [-R rebalance ms] [-b batch] [-S receive threads]
+//
+// -u turns the link pacer off, -m starts the link estimate at and caps it to
+// max kbps. -l drops that share of received media and parity datagrams,
+// -f adds a parity packet every N packets, -N turns NACK off; loss% is then
+// what neither recovered.
+//
+// -L spreads the streams over that many links to 127.0.0.1, 127.0.0.2, ..
+// and -k puts hot% of the streams on the links that start on worker 0, a
+// skewed load for the worker rebalancer; -R sets its pass interval, 0 off.
+// moves is how many links it migrated during the run. -b is the queue depth
+// at which the publishing thread flushes a link itself, above the queue
+// size every packet is left to the link's worker. -S binds the port with that
+// many SO_REUSEPORT sockets, the links' destinations spread over them.
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include <MediaDefinitions.h>
+
+#include "common/config.h"
+#include "bridge/bridge_mux.h"
+#include "bridge/bridge_link.h"
+#include "bridge/bridge_mux_stream.h"
+
+static const int RTP_HEADER_SIZE = 12;
+static const uint32_t HISTOGRAM_SIZE = 100000; // 1us buckets, last one is overflow
+
+static uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double cpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// only touched by the BridgeMux receive thread
+struct Histogram
+{
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+
+    Histogram() : buckets(HISTOGRAM_SIZE, 0), count(0) {}
+
+    void add(uint64_t sent_ns)
+    {
+        uint64_t us = (nowNs() - sent_ns) / 1000;
+        buckets[us < HISTOGRAM_SIZE - 1 ? us : HISTOGRAM_SIZE - 1]++;
+        count++;
+    }
+
+    uint32_t percentile(double p)
+    {
+        uint64_t target = count * p, seen = 0;
+        for (uint32_t i = 0; i < HISTOGRAM_SIZE; i++)
+        {
+            seen += buckets[i];
+            if (seen > target)
+                return i;
+        }
+        return HISTOGRAM_SIZE - 1;
+    }
+};
+
+class CountingSink : public erizo::MediaSink
+{
+public:
+    CountingSink(Histogram *histogram) : histogram_(histogram),
+                                         packets_(0)
+    {
+    }
+
+    void close() override {}
+
+    uint64_t getPackets() { return packets_; }
+
+private:
+    int deliverAudioData_(std::shared_ptr<erizo::DataPacket> packet) override
+    {
+        return deliver(packet);
+    }
+
+    int deliverVideoData_(std::shared_ptr<erizo::DataPacket> packet) override
+    {
+        return deliver(packet);
+    }
+
+    int deliverEvent_(erizo::MediaEventPtr event) override
+    {
+        return 0;
+    }
+
+    int deliver(const std::shared_ptr<erizo::DataPacket> &packet)
+    {
+        packets_++;
+        uint64_t sent;
+        memcpy(&sent, packet->data + RTP_HEADER_SIZE, sizeof(sent));
+        histogram_->add(sent);
+        return 0;
+    }
+
+private:
+    Histogram *histogram_;
+    std::atomic<uint64_t> packets_;
+};
+
+struct Stream
+{
+    std::shared_ptr<BridgeMuxSink> sink;
+    std::shared_ptr<BridgeMuxSource> source;
+    std::shared_ptr<CountingSink> counter;
+    uint16_t seq;
+};
+
+static void run(int streams, int pps, int size, int seconds, uint16_t port, int fec_group,
+                int link_num, int workers, int hot_percent)
+{
+    Histogram histogram;
+    uint64_t migrations = BridgeMux::getInstance()->getMigrations();
+
+    // links are placed on the workers in turn, so link i starts on worker i % workers
+    std::vector<std::shared_ptr<BridgeLink>> links;
+    std::vector<int> hot_links, cold_links;
+    for (int i = 0; i < link_num; i++)
+    {
+        links.push_back(BridgeMux::getInstance()->addLink("127.0.0." + std::to_string(i + 1), port));
+        if (i % workers == 0)
+            hot_links.push_back(i);
+        else
+            cold_links.push_back(i);
+    }
+    if (cold_links.empty())
+        cold_links = hot_links;
+
+    std::vector<Stream> list(streams);
+    int hot_streams = streams * hot_percent / 100;
+    for (int i = 0; i < streams; i++)
+    {
+        std::string bridge_stream_id = "bench_stream_" + std::to_string(i);
+        Stream &stream = list[i];
+        int link = link_num == 1 ? 0 : (i < hot_streams ? hot_links[i % hot_links.size()] : cold_links[i % cold_links.size()]);
+        stream.sink = std::make_shared<BridgeMuxSink>(bridge_stream_id, links[link], fec_group);
+        stream.source = std::make_shared<BridgeMuxSource>(bridge_stream_id, 10000 + i, 20000 + i);
+        stream.counter = std::make_shared<CountingSink>(&histogram);
+        stream.source->setVideoSink(stream.counter.get());
+        stream.source->setAudioSink(stream.counter.get());
+        stream.seq = 0;
+        if (BridgeMux::getInstance()->addSink(stream.sink) || BridgeMux::getInstance()->addSource(stream.source))
+        {
+            fprintf(stderr, "bridge stream id collision at %d\n", i);
+            exit(1);
+        }
+    }
+
+    // one sender thread pacing all streams round robin, like a publisher worker
+    char buf[1500] = {0};
+    buf[0] = (char)0x80;
+    buf[1] = 100;
+    uint64_t published = 0;
+    double cpu = cpuSeconds();
+    uint64_t begin = nowNs();
+    uint64_t end = begin + seconds * 1000000000ULL;
+    uint64_t interval = pps > 0 ? 1000000000ULL / ((uint64_t)pps * streams) : 0;
+    uint64_t now = begin;
+    while (now < end)
+    {
+        Stream &stream = list[published % streams];
+        uint16_t seq = htons(stream.seq++);
+        memcpy(buf + 2, &seq, 2);
+        uint64_t sent = nowNs();
+        memcpy(buf + RTP_HEADER_SIZE, &sent, sizeof(sent));
+        stream.sink->deliverVideoData(std::make_shared<erizo::DataPacket>(0, buf, size, erizo::VIDEO_PACKET));
+        published++;
+        now = nowNs();
+        if (interval > 0)
+        {
+            uint64_t next = begin + published * interval;
+            while (now < next)
+            {
+                if (next - now > 200000)
+                    usleep((next - now) / 1000 / 2);
+                now = nowNs();
+            }
+        }
+    }
+    uint64_t elapsed = now - begin;
+    usleep(200000);
+    cpu = cpuSeconds() - cpu;
+
+    BridgeLinkStats stats = links[0]->getStats();
+    uint64_t dropped = 0;
+    for (std::shared_ptr<BridgeLink> &link : links)
+        dropped += link->getDroppedPackets();
+    uint64_t received = 0, nack_recovered = 0, fec_recovered = 0;
+    for (Stream &stream : list)
+    {
+        received += stream.counter->getPackets();
+        fec_recovered += stream.source->getFecRecovered();
+        nack_recovered += stream.source->getRecovered();
+        BridgeMux::getInstance()->removeSink(stream.sink);
+        BridgeMux::getInstance()->removeSource(stream.source);
+        stream.source->close();
+        stream.sink->close();
+    }
+    for (std::shared_ptr<BridgeLink> &link : links)
+        BridgeMux::getInstance()->removeLink(link);
+    migrations = BridgeMux::getInstance()->getMigrations() - migrations;
+
+    double secs = elapsed / 1e9;
+    double cores = cpu / secs;
+    printf("%8d %8d %12.0f %12.0f %8.2f %8u %8u %9u %8.2f %12.0f %10.1f %10lu %10lu %10lu %6lu\n",
+           streams,
+           pps,
+           published / secs,
+           received / secs,
+           published ? 100.0 * (published - (received < published ? received : published)) / published : 0.0,
+           histogram.percentile(0.5),
+           histogram.percentile(0.99),
+           histogram.percentile(0.999),
+           cores,
+           cores > 0 ? streams / cores : 0.0,
+           stats.estimate_kbps / 1000.0,
+           (unsigned long)dropped,
+           (unsigned long)(nack_recovered > fec_recovered ? nack_recovered - fec_recovered : 0),
+           (unsigned long)fec_recovered,
+           (unsigned long)migrations);
+}
+
+static std::vector<int> parseList(const char *arg)
+{
+    std::vector<int> list;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if (atoi(item.c_str()) > 0)
+            list.push_back(atoi(item.c_str()));
+    }
+    return list;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> streams = {10, 100, 500, 1000};
+    int pps = 100;
+    int size = 1200;
+    int seconds = 3;
+    int workers = 1;
+    int port = 47000;
+    bool paced = true;
+    int max_kbps = 0;
+    double loss = 0;
+    int fec_group = 0;
+    bool nack = true;
+    int links = 1;
+    int hot_percent = 0;
+    int rebalance_ms = -1;
+    int batch = 0;
+    int recv_num = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:s:d:w:p:um:l:f:NL:k:R:b:S:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            streams = parseList(optarg);
+            break;
+        case 'r':
+            pps = atoi(optarg);
+            break;
+        case 's':
+            size = atoi(optarg);
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'u':
+            paced = false;
+            break;
+        case 'm':
+            max_kbps = atoi(optarg);
+            break;
+        case 'l':
+            loss = atof(optarg);
+            break;
+        case 'f':
+            fec_group = atoi(optarg);
+            break;
+        case 'N':
+            nack = false;
+            break;
+        case 'L':
+            links = atoi(optarg);
+            break;
+        case 'k':
+            hot_percent = atoi(optarg);
+            break;
+        case 'R':
+            rebalance_ms = atoi(optarg);
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            break;
+        case 'S':
+            recv_num = atoi(optarg);
+            break;
+        default:
+            printf("Usage:%s [-n streams,..] [-r pps per stream] [-s size] [-d seconds] [-w workers] [-p port] [-u] [-m max kbps] [-l loss%%] [-f fec group] [-N] [-L links] [-k hot%%] [-R rebalance ms] [-b batch] [-S receive threads]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (size < RTP_HEADER_SIZE + (int)sizeof(uint64_t) || size > BRIDGE_MUX_MAX_PAYLOAD)
+    {
+        printf("packet size must be in [%d, %d]\n", RTP_HEADER_SIZE + (int)sizeof(uint64_t), BRIDGE_MUX_MAX_PAYLOAD);
+        return 1;
+    }
+
+    if (workers < 1)
+        workers = 1;
+    if (links < 1 || links > 254)
+    {
+        printf("links must be in [1, 254]\n");
+        return 1;
+    }
+
+    Config::getInstance()->bridge_pacer = paced;
+    if (rebalance_ms >= 0)
+        Config::getInstance()->bridge_rebalance_ms = rebalance_ms;
+    if (batch > 0)
+        Config::getInstance()->bridge_mux_batch = batch;
+    Config::getInstance()->bridge_nack = nack;
+    if (max_kbps > 0)
+    {
+        Config::getInstance()->bridge_pacer_start_kbps = max_kbps;
+        Config::getInstance()->bridge_pacer_max_kbps = max_kbps;
+    }
+    // every 127.0.0.x reaches a socket bound to any address
+    std::string ip = links > 1 ? "0.0.0.0" : "127.0.0.1";
+    if (BridgeMux::getInstance()->init(ip, port, workers, recv_num))
+    {
+        printf("bind %s:%d failed\n", ip.c_str(), port);
+        return 1;
+    }
+    BridgeMux::getInstance()->setLossInjection(loss * 10);
+
+    printf("%8s %8s %12s %12s %8s %8s %8s %9s %8s %12s %10s %10s %10s %10s %6s\n",
+           "streams", "pps", "sent pkt/s", "recv pkt/s", "loss%", "p50(us)", "p99(us)", "p999(us)", "cores", "streams/core", "est Mbps", "link drop", "nack rec", "fec rec", "moves");
+    for (int n : streams)
+        run(n, pps, size, seconds, port, fec_group, links, workers, hot_percent);
+
+    BridgeMux::getInstance()->close();
+    return 0;
+}
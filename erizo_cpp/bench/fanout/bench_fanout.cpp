@@ -0,0 +1,356 @@
+// One synthetic publisher feeding RTP into a OneToManyProcessor wired the
+// way Connection::init wires a publishing MediaStream, fanned out to N
+// subscriber sinks. Reports forwarded packets/sec, per-packet latency,
+// CPU per forwarded Mbps and heap allocations per published packet.
+//
+//   bench_fanout [-n subscribers,..] [-s size] [-d seconds] [-r pps] [-u]
+//
+// -u makes every sink send the packet over its own loopback UDP socket and
+// measures latency at the receiving socket instead of inside the sink.
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include <MediaDefinitions.h>
+#include <OneToManyProcessor.h>
+
+static std::atomic<uint64_t> g_allocs(0);
+
+void *operator new(size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+static const int RTP_HEADER_SIZE = 12;
+static const uint32_t HISTOGRAM_SIZE = 100000; // 1us buckets, last one is overflow
+
+static uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double cpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+struct Histogram
+{
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+
+    Histogram() : buckets(HISTOGRAM_SIZE, 0), count(0) {}
+
+    void add(uint64_t sent_ns)
+    {
+        uint64_t us = (nowNs() - sent_ns) / 1000;
+        buckets[us < HISTOGRAM_SIZE - 1 ? us : HISTOGRAM_SIZE - 1]++;
+        count++;
+    }
+
+    uint32_t percentile(double p)
+    {
+        uint64_t target = count * p, seen = 0;
+        for (uint32_t i = 0; i < HISTOGRAM_SIZE; i++)
+        {
+            seen += buckets[i];
+            if (seen > target)
+                return i;
+        }
+        return HISTOGRAM_SIZE - 1;
+    }
+};
+
+class SyntheticPublisher : public erizo::MediaSource
+{
+public:
+    SyntheticPublisher(uint32_t video_ssrc, uint32_t audio_ssrc) : seq_(0)
+    {
+        setVideoSourceSSRC(video_ssrc);
+        setAudioSourceSSRC(audio_ssrc);
+    }
+
+    void sendVideo(int size)
+    {
+        char buf[1500] = {0};
+        buf[0] = (char)0x80;
+        buf[1] = 100;
+        uint16_t seq = htons(seq_++);
+        memcpy(buf + 2, &seq, 2);
+        uint32_t ts = htonl(seq_ * 3000);
+        memcpy(buf + 4, &ts, 4);
+        uint32_t ssrc = htonl(getVideoSourceSSRC());
+        memcpy(buf + 8, &ssrc, 4);
+        uint64_t sent = nowNs();
+        memcpy(buf + RTP_HEADER_SIZE, &sent, sizeof(sent));
+
+        if (video_sink_ != nullptr)
+            video_sink_->deliverVideoData(std::make_shared<erizo::DataPacket>(0, buf, size, erizo::VIDEO_PACKET));
+    }
+
+    int sendPLI() override { return 0; }
+    void close() override {}
+
+private:
+    uint16_t seq_;
+};
+
+class SubscriberSink : public erizo::MediaSink
+{
+public:
+    SubscriberSink(Histogram *histogram, const struct sockaddr_in *dest) : histogram_(histogram),
+                                                                           fd_(-1),
+                                                                           packets_(0),
+                                                                           bytes_(0)
+    {
+        if (dest != nullptr)
+        {
+            fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+            connect(fd_, (const struct sockaddr *)dest, sizeof(*dest));
+        }
+    }
+
+    ~SubscriberSink()
+    {
+        if (fd_ >= 0)
+            ::close(fd_);
+    }
+
+    void close() override {}
+
+    uint64_t getPackets() { return packets_; }
+    uint64_t getBytes() { return bytes_; }
+
+private:
+    int deliverAudioData_(std::shared_ptr<erizo::DataPacket> packet) override
+    {
+        return deliver(packet);
+    }
+
+    int deliverVideoData_(std::shared_ptr<erizo::DataPacket> packet) override
+    {
+        return deliver(packet);
+    }
+
+    int deliverEvent_(erizo::MediaEventPtr event) override
+    {
+        return 0;
+    }
+
+    int deliver(const std::shared_ptr<erizo::DataPacket> &packet)
+    {
+        packets_++;
+        bytes_ += packet->length;
+        if (fd_ >= 0)
+        {
+            send(fd_, packet->data, packet->length, MSG_DONTWAIT);
+        }
+        else
+        {
+            uint64_t sent;
+            memcpy(&sent, packet->data + RTP_HEADER_SIZE, sizeof(sent));
+            histogram_->add(sent);
+        }
+        return 0;
+    }
+
+private:
+    Histogram *histogram_;
+    int fd_;
+    uint64_t packets_;
+    uint64_t bytes_;
+};
+
+static void run(int subscribers, int size, int seconds, int pps, bool udp)
+{
+    Histogram histogram;
+    std::atomic<bool> receiving(true);
+    std::unique_ptr<std::thread> receiver;
+    struct sockaddr_in addr;
+    int recv_fd = -1;
+
+    if (udp)
+    {
+        recv_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        int rcvbuf = 64 * 1024 * 1024;
+        setsockopt(recv_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        struct timeval timeout = {0, 100000};
+        setsockopt(recv_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        bind(recv_fd, (struct sockaddr *)&addr, sizeof(addr));
+        getsockname(recv_fd, (struct sockaddr *)&addr, &len);
+
+        receiver = std::unique_ptr<std::thread>(new std::thread([&]() {
+            char buf[1500];
+            while (receiving)
+            {
+                ssize_t n = recv(recv_fd, buf, sizeof(buf), 0);
+                if (n < RTP_HEADER_SIZE + (ssize_t)sizeof(uint64_t))
+                    continue;
+                uint64_t sent;
+                memcpy(&sent, buf + RTP_HEADER_SIZE, sizeof(sent));
+                histogram.add(sent);
+            }
+        }));
+    }
+
+    std::shared_ptr<SyntheticPublisher> publisher = std::make_shared<SyntheticPublisher>(11111, 22222);
+    std::shared_ptr<erizo::OneToManyProcessor> otm_processor = std::make_shared<erizo::OneToManyProcessor>();
+    publisher->setAudioSink(otm_processor.get());
+    publisher->setVideoSink(otm_processor.get());
+    publisher->setEventSink(otm_processor.get());
+    otm_processor->setPublisher(publisher);
+
+    std::vector<std::shared_ptr<SubscriberSink>> sinks;
+    for (int i = 0; i < subscribers; i++)
+    {
+        sinks.push_back(std::make_shared<SubscriberSink>(&histogram, udp ? &addr : nullptr));
+        otm_processor->addSubscriber(sinks.back(), "subscriber_" + std::to_string(i));
+    }
+
+    uint64_t published = 0;
+    uint64_t allocs = g_allocs;
+    double cpu = cpuSeconds();
+    uint64_t begin = nowNs();
+    uint64_t end = begin + seconds * 1000000000ULL;
+    uint64_t interval = pps > 0 ? 1000000000ULL / pps : 0;
+    uint64_t now = begin;
+    while (now < end)
+    {
+        publisher->sendVideo(size);
+        published++;
+        now = nowNs();
+        if (interval > 0)
+        {
+            uint64_t next = begin + published * interval;
+            while (now < next)
+                now = nowNs();
+        }
+    }
+    uint64_t elapsed = now - begin;
+    cpu = cpuSeconds() - cpu;
+    allocs = g_allocs - allocs;
+
+    if (receiver != nullptr)
+    {
+        usleep(200000);
+        receiving = false;
+        receiver->join();
+        ::close(recv_fd);
+    }
+
+    uint64_t forwarded = 0, bytes = 0;
+    for (std::shared_ptr<SubscriberSink> sink : sinks)
+    {
+        forwarded += sink->getPackets();
+        bytes += sink->getBytes();
+    }
+
+    otm_processor->close();
+    publisher->setAudioSink(nullptr);
+    publisher->setVideoSink(nullptr);
+    publisher->setEventSink(nullptr);
+
+    double secs = elapsed / 1e9;
+    double mbps = bytes * 8 / 1e6 / secs;
+    printf("%8d %5s %12.0f %10.1f %8u %8u %8u %10.4f %10.2f %8.2f\n",
+           subscribers,
+           udp ? "udp" : "sink",
+           forwarded / secs,
+           mbps,
+           histogram.percentile(0.5),
+           histogram.percentile(0.99),
+           histogram.percentile(0.999),
+           mbps > 0 ? cpu / secs / mbps * 1000 : 0.0,
+           published ? (double)allocs / published : 0.0,
+           forwarded ? 100.0 * (forwarded - (histogram.count < forwarded ? histogram.count : forwarded)) / forwarded : 0.0);
+}
+
+static std::vector<int> parseList(const char *arg)
+{
+    std::vector<int> list;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if (atoi(item.c_str()) > 0)
+            list.push_back(atoi(item.c_str()));
+    }
+    return list;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> subscribers = {1, 10, 100, 500};
+    int size = 1200;
+    int seconds = 3;
+    int pps = 0;
+    bool udp = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:d:r:u")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            subscribers = parseList(optarg);
+            break;
+        case 's':
+            size = atoi(optarg);
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        case 'r':
+            pps = atoi(optarg);
+            break;
+        case 'u':
+            udp = true;
+            break;
+        default:
+            printf("Usage:%s [-n subscribers,..] [-s size] [-d seconds] [-r pps] [-u]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (size < RTP_HEADER_SIZE + (int)sizeof(uint64_t) || size > 1500)
+    {
+        printf("packet size must be in [%d, 1500]\n", RTP_HEADER_SIZE + (int)sizeof(uint64_t));
+        return 1;
+    }
+
+    printf("%8s %5s %12s %10s %8s %8s %8s %10s %10s %8s\n",
+           "subs", "mode", "fwd pkt/s", "fwd Mbps", "p50(us)", "p99(us)", "p999(us)", "mcore/Mbps", "alloc/pkt", "loss%");
+    for (int n : subscribers)
+        run(n, size, seconds, pps, udp);
+    return 0;
+}
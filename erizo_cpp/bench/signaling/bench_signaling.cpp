@@ -0,0 +1,394 @@
+// Replays addPublisher/addSubscriber/processSignaling/remove* through the
+// real Erizo dispatcher against an in-process broker and stub media, and
+// reports commands/sec and per-command latency.
+//
+//   bench_signaling [-c clients,..] [-r rooms,..] [-R] [-m] [-f replay.jsonl]
+//
+// Without -f a synthetic sequence is generated for every clients x rooms
+// pair: every client publishes one stream and subscribes to every other
+// stream of its room, then everything is removed again, one command per
+// participant or with a single removeRoom per room (-R). With -f every line
+// of the file is one recorded amqp message body, replayed as is.
+//
+// -m reports heap allocations per join (addSubscriber and its offer), and
+// resident and live heap memory per 1000 connections instead, once with plain heap
+// objects and once with slabs, each case in a forked process so neither
+// inherits the other's freed memory. Ids are always interned, the maps are
+// keyed by their handles.
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <sys/wait.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#include <json/json.h>
+
+#include "common/trace.h"
+#include "common/slab_pool.h"
+#include "common/interned_id.h"
+#include "core/erizo.h"
+#include "fake_broker.h"
+
+static std::atomic<uint64_t> g_allocs(0);
+static std::atomic<int64_t> g_live_bytes(0);
+
+void *operator new(size_t size)
+{
+    g_allocs++;
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    g_live_bytes += malloc_usable_size(ptr);
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    if (ptr != nullptr)
+        g_live_bytes -= malloc_usable_size(ptr);
+    free(ptr);
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    operator delete(ptr);
+}
+
+static long rssKb()
+{
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == nullptr)
+        return 0;
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static const char *OFFER_SDP = "v=0\r\no=- 0 0 IN IP4 127.0.0.1\r\ns=-\r\nt=0 0\r\n"
+                               "m=audio 9 UDP/TLS/RTP/SAVPF 111\r\nm=video 9 UDP/TLS/RTP/SAVPF 100\r\n";
+
+static std::string makeCommand(const std::string &method, const Json::Value &args)
+{
+    Json::Value root;
+    root["data"]["method"] = method;
+    root["data"]["args"] = args;
+    Json::FastWriter writer;
+    return writer.write(root);
+}
+
+static std::string makeOffer(const std::string &client_id, const std::string &stream_id)
+{
+    Json::Value args(Json::arrayValue);
+    args.append(client_id);
+    args.append(stream_id);
+    args.append(Json::objectValue);
+    args[2]["type"] = "offer";
+    args[2]["sdp"] = OFFER_SDP;
+    return makeCommand("processSignaling", args);
+}
+
+static void generate(int clients, int rooms, bool remove_room, std::vector<std::string> &cmds)
+{
+    int per_room = (clients + rooms - 1) / rooms;
+    for (int r = 0; r < rooms; r++)
+    {
+        std::vector<std::pair<std::string, std::string>> members;
+        for (int i = r * per_room; i < clients && i < (r + 1) * per_room; i++)
+            members.push_back({"client" + std::to_string(i), "stream" + std::to_string(i)});
+
+        for (auto &m : members)
+        {
+            Json::Value args(Json::arrayValue);
+            args.append("room" + std::to_string(r));
+            args.append(m.first);
+            args.append(m.second);
+            args.append("label");
+            args.append("agent");
+            args.append("CTL");
+            cmds.push_back(makeCommand("addPublisher", args));
+            cmds.push_back(makeOffer(m.first, m.second));
+        }
+
+        for (auto &sub : members)
+        {
+            for (auto &pub : members)
+            {
+                if (&sub == &pub)
+                    continue;
+                Json::Value args(Json::arrayValue);
+                args.append(sub.first);
+                args.append(pub.second);
+                args.append("label");
+                args.append("agent");
+                args.append("CTL");
+                cmds.push_back(makeCommand("addSubscriber", args));
+                cmds.push_back(makeOffer(sub.first, pub.second));
+            }
+        }
+
+        if (remove_room)
+        {
+            Json::Value args(Json::arrayValue);
+            args.append("room" + std::to_string(r));
+            cmds.push_back(makeCommand("removeRoom", args));
+            continue;
+        }
+
+        for (auto &sub : members)
+        {
+            for (auto &pub : members)
+            {
+                if (&sub == &pub)
+                    continue;
+                Json::Value args(Json::arrayValue);
+                args.append(sub.first);
+                args.append(pub.second);
+                cmds.push_back(makeCommand("removeSubscriber", args));
+            }
+        }
+
+        for (auto &m : members)
+        {
+            Json::Value args(Json::arrayValue);
+            args.append(m.first);
+            args.append(m.second);
+            cmds.push_back(makeCommand("removePublisher", args));
+        }
+    }
+}
+
+static int load(const std::string &file, std::vector<std::string> &cmds)
+{
+    std::ifstream ifs(file);
+    if (!ifs.is_open())
+        return 1;
+
+    std::string line;
+    while (std::getline(ifs, line))
+    {
+        if (!line.empty())
+            cmds.push_back(line);
+    }
+    return 0;
+}
+
+static void run(const std::string &name, const std::vector<std::string> &cmds)
+{
+    if (Erizo::getInstance()->init("agent", "erizo", "127.0.0.1", 0))
+    {
+        printf("erizo initialize failed\n");
+        return;
+    }
+    Erizo::getInstance()->ready(0);
+
+    std::vector<uint64_t> latency;
+    latency.reserve(cmds.size());
+    uint64_t replies = FakeBroker::getInstance()->getReplies();
+
+    uint64_t begin = Tracer::now();
+    for (const std::string &cmd : cmds)
+    {
+        uint64_t start = Tracer::now();
+        FakeBroker::getInstance()->publish(cmd);
+        latency.push_back(Tracer::now() - start);
+    }
+    uint64_t elapsed = Tracer::now() - begin;
+    replies = FakeBroker::getInstance()->getReplies() - replies;
+
+    Erizo::getInstance()->close();
+
+    if (latency.empty())
+        return;
+    std::sort(latency.begin(), latency.end());
+    printf("%-16s %10zu %12.0f %10lu %10lu %10lu %10lu\n",
+           name.c_str(),
+           cmds.size(),
+           elapsed ? cmds.size() * 1000000.0 / elapsed : 0.0,
+           (unsigned long)latency[latency.size() / 2],
+           (unsigned long)latency[latency.size() * 99 / 100],
+           (unsigned long)latency.back(),
+           (unsigned long)replies);
+}
+
+static bool isMethod(const std::string &cmd, const char *method)
+{
+    std::string key = std::string("\"method\":\"") + method + "\"";
+    return cmd.find(key) != std::string::npos;
+}
+
+static bool isRemove(const std::string &cmd);
+
+static void runMemory(const std::string &name, const std::vector<std::string> &cmds, bool slab)
+{
+    SlabPool::setEnabled(slab);
+    if (Erizo::getInstance()->init("agent", "erizo", "127.0.0.1", 0))
+    {
+        printf("erizo initialize failed\n");
+        return;
+    }
+    Erizo::getInstance()->ready(0);
+
+    uint64_t joins = 0, join_allocs = 0, conns = 0;
+    // what the parent freed stays resident otherwise and hides the growth
+    malloc_trim(0);
+    long rss_begin = rssKb(), rss_peak = rss_begin;
+    int64_t heap_begin = g_live_bytes, heap_peak = heap_begin;
+    bool in_join = false;
+    for (const std::string &cmd : cmds)
+    {
+        bool subscribe = isMethod(cmd, "addSubscriber");
+        if (subscribe || isMethod(cmd, "addPublisher"))
+            conns++;
+        if (isRemove(cmd))
+        {
+            rss_peak = std::max(rss_peak, rssKb());
+            heap_peak = std::max(heap_peak, (int64_t)g_live_bytes);
+        }
+
+        // a join is the addSubscriber and the offer right behind it
+        bool counted = subscribe || (in_join && isMethod(cmd, "processSignaling"));
+        in_join = subscribe;
+        uint64_t before = g_allocs;
+        FakeBroker::getInstance()->publish(cmd);
+        if (counted)
+            join_allocs += g_allocs - before;
+        if (subscribe)
+            joins++;
+    }
+    rss_peak = std::max(rss_peak, rssKb());
+    heap_peak = std::max(heap_peak, (int64_t)g_live_bytes);
+    Erizo::getInstance()->close();
+
+    printf("%-16s %6s %10lu %12.1f %12.1f %12.1f %10lu\n",
+           name.c_str(),
+           slab ? "slab" : "heap",
+           (unsigned long)joins,
+           joins ? (double)join_allocs / joins : 0.0,
+           conns ? (rss_peak - rss_begin) * 1000.0 / conns : 0.0,
+           conns ? (heap_peak - heap_begin) / 1024.0 * 1000.0 / conns : 0.0,
+           (unsigned long)SlabPool::getSlabBytes() / 1024);
+}
+
+static bool isRemove(const std::string &cmd)
+{
+    return isMethod(cmd, "removeSubscriber") || isMethod(cmd, "removePublisher") || isMethod(cmd, "removeRoom");
+}
+
+static void forkMemory(const std::string &name, std::vector<std::string> cmds)
+{
+    // every room up before any goes away, so the peak holds all connections
+    std::stable_partition(cmds.begin(), cmds.end(), [](const std::string &cmd) { return !isRemove(cmd); });
+    for (bool slab : {false, true})
+    {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            runMemory(name, cmds, slab);
+            fflush(stdout);
+            _exit(0);
+        }
+        if (pid > 0)
+            waitpid(pid, nullptr, 0);
+    }
+}
+
+static std::vector<int> parseList(const char *arg)
+{
+    std::vector<int> list;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if (atoi(item.c_str()) > 0)
+            list.push_back(atoi(item.c_str()));
+    }
+    return list;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> clients = {50, 200, 500};
+    std::vector<int> rooms = {1, 10};
+    std::string replay;
+    bool remove_room = false;
+    bool memory = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:r:f:Rm")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            clients = parseList(optarg);
+            break;
+        case 'r':
+            rooms = parseList(optarg);
+            break;
+        case 'f':
+            replay = optarg;
+            break;
+        case 'R':
+            remove_room = true;
+            break;
+        case 'm':
+            memory = true;
+            break;
+        default:
+            printf("Usage:%s [-c clients,..] [-r rooms,..] [-R] [-m] [-f replay.jsonl]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (memory)
+        printf("%-16s %6s %10s %12s %12s %12s %10s\n", "case", "alloc", "joins", "allocs/join", "rss KB/1k", "heap KB/1k", "slab KB");
+    else
+        printf("%-16s %10s %12s %10s %10s %10s %10s\n", "case", "commands", "cmds/s", "p50(us)", "p99(us)", "max(us)", "replies");
+
+    if (!replay.empty())
+    {
+        std::vector<std::string> cmds;
+        if (load(replay, cmds))
+        {
+            printf("open %s failed\n", replay.c_str());
+            return 1;
+        }
+        if (memory)
+            forkMemory("replay", cmds);
+        else
+            run("replay", cmds);
+        return 0;
+    }
+
+    for (int c : clients)
+    {
+        for (int r : rooms)
+        {
+            if (r > c)
+                continue;
+            std::vector<std::string> cmds;
+            generate(c, r, remove_room, cmds);
+            if (memory)
+                forkMemory("c" + std::to_string(c) + "/r" + std::to_string(r), cmds);
+            else
+                run("c" + std::to_string(c) + "/r" + std::to_string(r), cmds);
+        }
+    }
+    return 0;
+}
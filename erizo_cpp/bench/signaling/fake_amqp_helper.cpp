@@ -0,0 +1,104 @@
+#include "rabbitmq/amqp_helper.h"
+
+#include <unistd.h>
+
+#include "common/trace.h"
+#include "fake_broker.h"
+
+DEFINE_LOGGER(AMQPHelper, "AMQPHelper");
+
+FakeBroker *FakeBroker::instance_ = nullptr;
+
+FakeBroker::FakeBroker() : func_(nullptr),
+                           replies_(0),
+                           connect_delay_ms_(0)
+{
+}
+
+FakeBroker *FakeBroker::getInstance()
+{
+    if (instance_ == nullptr)
+        instance_ = new FakeBroker;
+    return instance_;
+}
+
+void FakeBroker::bind(const std::function<void(const std::string &msg, uint64_t recv_time)> &func)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    func_ = func;
+}
+
+void FakeBroker::unbind()
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    func_ = nullptr;
+}
+
+void FakeBroker::publish(const std::string &msg)
+{
+    std::function<void(const std::string &msg, uint64_t recv_time)> func;
+    {
+        std::unique_lock<std::mutex> lock(mux_);
+        func = func_;
+    }
+    if (func)
+        func(msg, Tracer::now());
+}
+
+void FakeBroker::reply(const std::string &queuename, const std::string &msg)
+{
+    replies_++;
+}
+
+AMQPHelper::AMQPHelper() : conn_(nullptr),
+                           recv_thread_(nullptr),
+                           send_thread_(nullptr),
+                           dispatch_thread_(nullptr),
+                           run_(false),
+                           init_(false) {}
+
+AMQPHelper::~AMQPHelper() {}
+
+int AMQPHelper::checkError(amqp_rpc_reply_t x)
+{
+    return 0;
+}
+
+int AMQPHelper::init(const std::string &binding_key, const std::function<void(const std::string &msg, uint64_t recv_time)> &func)
+{
+    if (init_)
+        return 0;
+
+    if (FakeBroker::getInstance()->getConnectDelay() > 0)
+        usleep(FakeBroker::getInstance()->getConnectDelay() * 1000);
+    FakeBroker::getInstance()->bind(func);
+    init_ = true;
+    return 0;
+}
+
+void AMQPHelper::close()
+{
+    if (!init_)
+        return;
+
+    FakeBroker::getInstance()->unbind();
+    init_ = false;
+}
+
+void AMQPHelper::sendMessage(const std::string &queuename, const std::string &binding_key, const std::string &send_msg, uint64_t trace_id)
+{
+    FakeBroker::getInstance()->reply(queuename, send_msg);
+}
+
+void AMQPHelper::broadcastMessage(const std::string &binding_key, const std::string &send_msg)
+{
+}
+
+int AMQPHelper::send(const std::string &exchange,
+                     const std::string &queuename,
+                     const std::string &binding_key,
+                     const std::string &send_msg)
+{
+    FakeBroker::getInstance()->reply(queuename, send_msg);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef FAKE_BROKER_H
+#define FAKE_BROKER_H
+
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <functional>
+
+// In-process stand-in for the rabbitmq broker. The fake AMQPHelper binds
+// its consumer here and routes every reply back here instead of a socket.
+class FakeBroker
+{
+public:
+  static FakeBroker *getInstance();
+
+  void bind(const std::function<void(const std::string &msg, uint64_t recv_time)> &func);
+  void unbind();
+
+  // agent -> erizo, dispatched synchronously on the calling thread
+  void publish(const std::string &msg);
+  // erizo -> agent
+  void reply(const std::string &queuename, const std::string &msg);
+
+  uint64_t getReplies() { return replies_; }
+
+  // AMQPHelper::init sleeps this long, standing in for the broker handshake
+  void setConnectDelay(uint32_t ms) { connect_delay_ms_ = ms; }
+  uint32_t getConnectDelay() { return connect_delay_ms_; }
+
+private:
+  FakeBroker();
+
+private:
+  std::mutex mux_;
+  std::function<void(const std::string &msg, uint64_t recv_time)> func_;
+  std::atomic<uint64_t> replies_;
+  std::atomic<uint32_t> connect_delay_ms_;
+
+  static FakeBroker *instance_;
+};
+
+#endif
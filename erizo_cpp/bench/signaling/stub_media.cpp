@@ -0,0 +1,304 @@
+// Connection and BridgeConn without ICE, DTLS or media streams, so the
+// benchmark measures Erizo's dispatch and bookkeeping only. Events are
+// raised synchronously the way the real connection raises them later.
+#include "model/connection.h"
+#include "model/bridge_conn.h"
+
+#include <json/json.h>
+
+#include "common/trace.h"
+#include "core/erizo.h"
+
+#include <thread/ThreadPool.h>
+#include <thread/IOThreadPool.h>
+
+DEFINE_LOGGER(Connection, "Connection");
+
+Connection::Connection() : webrtc_connection_(nullptr),
+                           otm_processor_(nullptr),
+                           publisher_proxy_(nullptr),
+                           speaker_detector_(nullptr),
+                           media_stream_(nullptr),
+                           worker_(nullptr),
+                           listener_(nullptr),
+                           config_(nullptr),
+                           network_interface_(""),
+                           resource_cost_(),
+                           attach_count_(0),
+                           ready_(false),
+                           source_proxy_(),
+                           source_id_(""),
+                           agent_id_(""),
+                           erizo_id_(""),
+                           room_id_(""),
+                           client_id_(""),
+                           stream_id_(""),
+                           label_(""),
+                           is_publisher_(false),
+                           reply_to_(""),
+                           trace_id_(0),
+                           init_time_(0),
+                           sdp_time_(0),
+                           init_(false) {}
+
+Connection::~Connection() {}
+
+void Connection::init(const InternedId &agent_id,
+                      const InternedId &erizo_id,
+                      const InternedId &client_id,
+                      const InternedId &stream_id,
+                      const std::string &label,
+                      bool is_publisher,
+                      const std::string &reply_to,
+                      const std::string &isp,
+                      std::shared_ptr<erizo::ThreadPool> thread_pool,
+                      std::shared_ptr<erizo::IOThreadPool> io_thread_pool)
+{
+    if (init_)
+        return;
+
+    agent_id_ = agent_id;
+    erizo_id_ = erizo_id;
+    client_id_ = client_id;
+    stream_id_ = stream_id;
+    label_ = label;
+    is_publisher_ = is_publisher;
+    reply_to_ = reply_to;
+    trace_id_ = Tracer::makeId(client_id_, stream_id_);
+    worker_ = thread_pool->getLessUsedWorker();
+    init_ = true;
+
+    notifyEvent(erizo::CONN_INITIAL, "");
+}
+
+void Connection::close()
+{
+    if (!init_)
+        return;
+
+    listener_ = nullptr;
+    worker_ = nullptr;
+    subscribers_.clear();
+    init_ = false;
+}
+
+void Connection::asyncClose(const std::function<void()> &callback)
+{
+    std::shared_ptr<erizo::Worker> worker = worker_;
+    if (worker == nullptr)
+    {
+        close();
+        if (callback)
+            callback();
+        return;
+    }
+
+    std::shared_ptr<Connection> self = shared_from_this();
+    worker->task([self, callback]() {
+        self->close();
+        if (callback)
+            callback();
+    });
+}
+
+void Connection::notifyEvent(erizo::WebRTCEvent newEvent, const std::string &message, const std::string &stream_id)
+{
+    Json::Value data = Json::nullValue;
+    switch (newEvent)
+    {
+    case erizo::CONN_INITIAL:
+        data["type"] = "started";
+        data["agentId"] = agent_id_.str();
+        data["erizoId"] = erizo_id_.str();
+        data["streamId"] = stream_id_.str();
+        data["clientId"] = client_id_.str();
+        break;
+    case erizo::CONN_SDP_PROCESSED:
+        if (is_publisher_)
+        {
+            data["type"] = "publisher_answer";
+            data["videoSSRC"] = 0;
+            data["audioSSRC"] = 0;
+            data["roomId"] = room_id_.str();
+        }
+        else
+        {
+            data["type"] = "subscriber_answer";
+            data["erizoId"] = erizo_id_.str();
+        }
+
+        data["streamId"] = stream_id_.str();
+        data["clientId"] = client_id_.str();
+        data["sdp"] = message;
+        break;
+    default:
+        break;
+    }
+
+    if (data.type() != Json::nullValue && listener_ != nullptr)
+    {
+        Json::FastWriter writer;
+        Json::Value reply;
+        reply["data"] = data;
+        listener_->onEvent(reply_to_, writer.write(reply), trace_id_);
+    }
+}
+
+int Connection::setRemoteSdp(const std::string &sdp)
+{
+    if (!init_)
+        return 1;
+    notifyEvent(erizo::CONN_SDP_PROCESSED, sdp);
+    return 0;
+}
+
+int Connection::addRemoteCandidate(const std::string &mid, int sdp_mine_index, const std::string &sdp)
+{
+    return init_ ? 0 : 1;
+}
+
+void Connection::addSubscriber(const InternedId &client_id, std::shared_ptr<Connection> sub_conn)
+{
+    // no fan-out, but the attachments are counted as the real one does
+    if (is_publisher_)
+        attach(subscribers_, client_id, sub_conn);
+}
+
+void Connection::addSubscriber(const InternedId &bridge_stream_id, std::shared_ptr<erizo::MediaSink> bridge_sink)
+{
+}
+
+void Connection::replaceSubscriber(const InternedId &bridge_stream_id, std::shared_ptr<erizo::MediaSink> bridge_sink)
+{
+}
+
+void Connection::setSourceProxy(std::shared_ptr<PublisherProxy> proxy, const InternedId &id)
+{
+}
+
+void Connection::removeSubscriber(const InternedId &id)
+{
+    detach(subscribers_, id);
+}
+
+int Connection::setQualityLayer(int spatial_layer, int temporal_layer)
+{
+    return 0;
+}
+
+void Connection::setSpeakerDetector(std::shared_ptr<ActiveSpeakerDetector> detector)
+{
+}
+
+std::shared_ptr<erizo::MediaStream> Connection::getMediaStream()
+{
+    return media_stream_;
+}
+
+BridgeConn::BridgeConn() : bridge_media_stream_(nullptr),
+                           otm_processor_(nullptr),
+                           publisher_proxy_(nullptr),
+                           mux_sink_(nullptr),
+                           mux_source_(nullptr),
+                           mux_link_(nullptr),
+                           io_worker_(nullptr),
+                           migrating_(false),
+                           retired_stream_(nullptr),
+                           retired_worker_(nullptr),
+                           port_(0),
+                           video_ssrc_(0),
+                           audio_ssrc_(0),
+                           resource_cost_(),
+                           bridge_stream_id_(""),
+                           src_stream_id_(""),
+                           init_(false)
+{
+}
+
+BridgeConn::~BridgeConn() {}
+
+int BridgeConn::init(const InternedId &bridge_stream_id,
+                     const InternedId &src_stream_id,
+                     const std::string &ip,
+                     uint16_t port,
+                     std::shared_ptr<erizo::IOThreadPool> io_thread_pool,
+                     bool is_send,
+                     uint32_t video_ssrc,
+                     uint32_t audio_ssrc,
+                     uint32_t fec_group)
+{
+    if (init_)
+        return 0;
+
+    bridge_stream_id_ = bridge_stream_id;
+    src_stream_id_ = src_stream_id;
+    is_send_ = is_send;
+    io_worker_ = io_thread_pool->getLessUsedIOWorker();
+    init_ = true;
+    return 0;
+}
+
+void BridgeConn::close()
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    io_worker_ = nullptr;
+    init_ = false;
+}
+
+void BridgeConn::asyncClose(const std::function<void()> &callback)
+{
+    std::shared_ptr<erizo::IOWorker> io_worker = getIOWorker();
+    if (io_worker == nullptr)
+    {
+        close();
+        if (callback)
+            callback();
+        return;
+    }
+
+    std::shared_ptr<BridgeConn> self = shared_from_this();
+    io_worker->task([self, callback]() {
+        self->close();
+        if (callback)
+            callback();
+    });
+}
+
+std::shared_ptr<erizo::MediaSink> BridgeConn::getMediaSink()
+{
+    return nullptr;
+}
+
+void BridgeConn::setSource(std::shared_ptr<Connection> src_conn)
+{
+}
+
+std::shared_ptr<erizo::IOWorker> BridgeConn::getIOWorker()
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    return io_worker_;
+}
+
+uint64_t BridgeConn::getPackets()
+{
+    return 0;
+}
+
+void BridgeConn::migrate(std::shared_ptr<erizo::IOWorker> io_worker)
+{
+}
+
+void BridgeConn::releaseRetired()
+{
+}
+
+void BridgeConn::addSubscriber(const InternedId &client_id, std::shared_ptr<Connection> sub_conn)
+{
+    if (!is_send_)
+        Connection::attach(subscribers_, client_id, sub_conn);
+}
+
+void BridgeConn::removeSubscriber(const InternedId &client_id)
+{
+    Connection::detach(subscribers_, client_id);
+}
@@ -0,0 +1,187 @@
+// Time from process start to "ready", once with every startup step run one
+// after the other and once concurrently as main does it. Every run is a
+// fresh forked process, DTLS certificates, sockets and thread pools are
+// created for real; only the broker is the in-process fake, its handshake
+// replaced by a fixed delay. Also compares resolving the executable path
+// through ls | grep | awk against readlink.
+//
+//   bench_startup [-n runs] [-p bridge port] [-b broker ms] [-c config.json] [-m]
+//
+// -m binds the multiplexed bridge socket too.
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "common/utils.h"
+#include "common/config.h"
+#include "common/trace.h"
+#include "core/startup.h"
+#include "bench/signaling/fake_broker.h"
+
+LOGGER_DECLARE()
+
+// what Utils::initPath used to do
+static int legacyExePath(std::string &path)
+{
+    char buf[256] = {0};
+    char cmd[256] = {0};
+    snprintf(cmd, sizeof(cmd), "ls -l /proc/%d | grep exe | awk '{print $11}'", getpid());
+    FILE *fp = popen(cmd, "r");
+    if (fp == nullptr)
+        return 1;
+    if (fgets(buf, sizeof(buf), fp) == nullptr)
+    {
+        pclose(fp);
+        return 1;
+    }
+    pclose(fp);
+    path = buf;
+    return 0;
+}
+
+static int exePath(std::string &path)
+{
+    char buf[4096] = {0};
+    ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+    if (len <= 0)
+        return 1;
+    path.assign(buf, len);
+    return 0;
+}
+
+static double timePath(int (*func)(std::string &), int iterations)
+{
+    std::string path;
+    uint64_t begin = Tracer::now();
+    for (int i = 0; i < iterations; i++)
+        func(path);
+    return (double)(Tracer::now() - begin) / iterations;
+}
+
+// one startup in a child process, its times come back over a pipe
+static int runOnce(uint16_t port, bool parallel, StartupTimes &times)
+{
+    int fds[2];
+    if (pipe(fds) < 0)
+        return 1;
+
+    pid_t pid = fork();
+    if (pid < 0)
+        return 1;
+    if (pid == 0)
+    {
+        ::close(fds[0]);
+        StartupTimes child;
+        memset(&child, 0, sizeof(child));
+        int ret = Startup::run("agent", "erizo", "127.0.0.1", port, parallel, &child);
+        if (ret == 0 && write(fds[1], &child, sizeof(child)) != sizeof(child))
+            ret = 1;
+        ::close(fds[1]);
+        // skip the teardown, the next run measures a fresh process anyway
+        _exit(ret);
+    }
+
+    ::close(fds[1]);
+    ssize_t len = read(fds[0], &times, sizeof(times));
+    ::close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return len == sizeof(times) && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
+
+static uint64_t median(std::vector<uint64_t> values)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+static void run(const char *name, int runs, uint16_t port, bool parallel)
+{
+    std::vector<uint64_t> dtls, bridge, erizo, total;
+    for (int i = 0; i < runs; i++)
+    {
+        StartupTimes times{};
+        if (runOnce(port, parallel, times))
+        {
+            printf("%s startup failed\n", name);
+            return;
+        }
+        dtls.push_back(times.dtls);
+        bridge.push_back(times.bridge);
+        erizo.push_back(times.erizo);
+        total.push_back(times.total);
+    }
+
+    printf("%-10s %10.1f %10.1f %10.1f %10.1f\n",
+           name,
+           median(dtls) / 1000.0,
+           median(bridge) / 1000.0,
+           median(erizo) / 1000.0,
+           median(total) / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    int runs = 5;
+    int port = 48000;
+    int broker_ms = 20;
+    const char *config = nullptr;
+    bool multiplex = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:b:c:m")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'b':
+            broker_ms = atoi(optarg);
+            break;
+        case 'c':
+            config = optarg;
+            break;
+        case 'm':
+            multiplex = true;
+            break;
+        default:
+            printf("Usage:%s [-n runs] [-p bridge port] [-b broker ms] [-c config.json] [-m]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    LOGGER_INIT();
+
+    uint64_t begin = Tracer::now();
+    if (config != nullptr && Config::getInstance()->init(config))
+    {
+        printf("load %s failed\n", config);
+        return 1;
+    }
+    uint64_t config_us = Tracer::now() - begin;
+
+    Config::getInstance()->bridge_multiplex = multiplex;
+    Config::getInstance()->load_report_interval_ms = 0;
+    FakeBroker::getInstance()->setConnectDelay(broker_ms > 0 ? broker_ms : 0);
+
+    printf("exe path: ls|grep|awk %.1f us, readlink %.1f us\n", timePath(legacyExePath, 20), timePath(exePath, 1000));
+    if (config != nullptr)
+        printf("config: %.1f ms\n", config_us / 1000.0);
+
+    printf("%-10s %10s %10s %10s %10s\n", "startup", "dtls(ms)", "bridge(ms)", "erizo(ms)", "ready(ms)");
+    run("serial", runs, port, false);
+    run("parallel", runs, port, true);
+    return 0;
+}
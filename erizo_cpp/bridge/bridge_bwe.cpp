@@ -0,0 +1,39 @@
+#include "bridge_bwe.h"
+
+#define BRIDGE_BWE_OVERUSE_MS 30
+#define BRIDGE_BWE_UNDERUSE_MS 10
+#define BRIDGE_BWE_DECREASE 0.85
+#define BRIDGE_BWE_INCREASE 1.08
+
+BridgeBwe::BridgeBwe(uint32_t start_kbps, uint32_t min_kbps, uint32_t max_kbps) : estimate_kbps_(start_kbps),
+                                                                                  min_kbps_(min_kbps),
+                                                                                  max_kbps_(max_kbps),
+                                                                                  last_delay_ms_(0)
+{
+}
+
+BridgeBwe::~BridgeBwe() {}
+
+uint32_t BridgeBwe::onReport(uint32_t recv_kbps, uint32_t queue_delay_ms)
+{
+    double estimate = estimate_kbps_;
+    if (queue_delay_ms > BRIDGE_BWE_OVERUSE_MS && queue_delay_ms >= last_delay_ms_)
+    {
+        // the link queues up, fall back below what actually got through
+        double backoff = recv_kbps * BRIDGE_BWE_DECREASE;
+        if (backoff < estimate)
+            estimate = backoff;
+    }
+    else if (queue_delay_ms < BRIDGE_BWE_UNDERUSE_MS)
+    {
+        estimate *= BRIDGE_BWE_INCREASE;
+    }
+    last_delay_ms_ = queue_delay_ms;
+
+    if (estimate < min_kbps_)
+        estimate = min_kbps_;
+    if (estimate > max_kbps_)
+        estimate = max_kbps_;
+    estimate_kbps_ = (uint32_t)estimate;
+    return estimate_kbps_;
+}
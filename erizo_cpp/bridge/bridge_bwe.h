@@ -0,0 +1,31 @@
+#ifndef BRIDGE_BWE_H
+#define BRIDGE_BWE_H
+
+#include <stdint.h>
+
+// Delay based estimate of one bridge link. The receiving node reports its
+// receive rate and the queuing delay (one way delay above the lowest one
+// seen recently) every BRIDGE_REPORT_INTERVAL_MS; a growing delay backs the
+// estimate off below the receive rate, a flat one lets it grow again.
+class BridgeBwe
+{
+public:
+  BridgeBwe(uint32_t start_kbps, uint32_t min_kbps, uint32_t max_kbps);
+  ~BridgeBwe();
+
+  // returns the new estimate
+  uint32_t onReport(uint32_t recv_kbps, uint32_t queue_delay_ms);
+
+  uint32_t getEstimate()
+  {
+    return estimate_kbps_;
+  }
+
+private:
+  uint32_t estimate_kbps_;
+  uint32_t min_kbps_;
+  uint32_t max_kbps_;
+  uint32_t last_delay_ms_;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "bridge_fec.h"
+
+#include "bridge_xor.h"
+
+#define BRIDGE_FEC_SLOTS 64
+#define BRIDGE_FEC_PARITIES 8
+
+BridgeFecEncoder::BridgeFecEncoder(uint32_t group_size) : group_size_(group_size),
+                                                          count_(0),
+                                                          base_seq_(0),
+                                                          len_xor_(0),
+                                                          flags_xor_(0),
+                                                          max_len_(0)
+{
+    if (group_size_ < 2)
+        group_size_ = 2;
+    if (group_size_ > BRIDGE_FEC_MAX_GROUP)
+        group_size_ = BRIDGE_FEC_MAX_GROUP;
+    memset(parity_, 0, sizeof(parity_));
+}
+
+BridgeFecEncoder::~BridgeFecEncoder() {}
+
+bool BridgeFecEncoder::add(uint16_t seq, uint8_t flags, const char *payload, int len)
+{
+    if (count_ == 0)
+    {
+        // only the bytes the last group used are dirty
+        memset(parity_, 0, BRIDGE_FEC_HEADER_SIZE + max_len_);
+        base_seq_ = seq;
+        len_xor_ = 0;
+        flags_xor_ = 0;
+        max_len_ = 0;
+    }
+
+    len_xor_ ^= (uint16_t)len;
+    flags_xor_ ^= flags;
+    bridgeXor(parity_ + BRIDGE_FEC_HEADER_SIZE, payload, len);
+    if (len > max_len_)
+        max_len_ = len;
+
+    if (++count_ < group_size_)
+        return false;
+
+    uint16_t len_xor_n = htons(len_xor_);
+    memcpy(parity_, &len_xor_n, 2);
+    parity_[2] = (char)flags_xor_;
+    parity_[3] = (char)group_size_;
+    count_ = 0;
+    return true;
+}
+
+BridgeFecDecoder::BridgeFecDecoder() : slots_(BRIDGE_FEC_SLOTS),
+                                       parities_(BRIDGE_FEC_PARITIES),
+                                       next_parity_(0)
+{
+    for (Slot &slot : slots_)
+        slot.valid = false;
+    for (Parity &parity : parities_)
+        parity.count = 0;
+}
+
+BridgeFecDecoder::~BridgeFecDecoder() {}
+
+BridgeFecDecoder::Slot *BridgeFecDecoder::find(uint16_t seq)
+{
+    Slot &slot = slots_[seq % BRIDGE_FEC_SLOTS];
+    if (slot.valid && slot.seq == seq)
+        return &slot;
+    return nullptr;
+}
+
+void BridgeFecDecoder::addPacket(uint16_t seq, uint8_t flags, const char *payload, int len)
+{
+    Slot &slot = slots_[seq % BRIDGE_FEC_SLOTS];
+    slot.seq = seq;
+    slot.valid = true;
+    slot.flags = flags;
+    slot.length = len;
+    memcpy(slot.data, payload, len);
+}
+
+void BridgeFecDecoder::addParity(uint16_t base_seq, const char *payload, int len)
+{
+    if (len < BRIDGE_FEC_HEADER_SIZE || len > BRIDGE_FEC_HEADER_SIZE + BRIDGE_MUX_MAX_PAYLOAD)
+        return;
+    uint8_t count = (uint8_t)payload[3];
+    if (count < 2 || count > BRIDGE_FEC_MAX_GROUP)
+        return;
+
+    Parity &parity = parities_[next_parity_++ % BRIDGE_FEC_PARITIES];
+    parity.base_seq = base_seq;
+    parity.count = count;
+    parity.length = len;
+    memcpy(parity.data, payload, len);
+}
+
+bool BridgeFecDecoder::recover(uint16_t &seq, uint8_t &flags, char *payload, int &len)
+{
+    for (Parity &parity : parities_)
+    {
+        if (parity.count > 0 && tryParity(parity, seq, flags, payload, len))
+            return true;
+    }
+    return false;
+}
+
+bool BridgeFecDecoder::tryParity(Parity &parity, uint16_t &seq, uint8_t &flags, char *payload, int &len)
+{
+    int missing = 0;
+    uint16_t missing_seq = 0;
+    for (uint16_t i = 0; i < parity.count; i++)
+    {
+        uint16_t s = parity.base_seq + i;
+        if (find(s) == nullptr)
+        {
+            missing_seq = s;
+            if (++missing > 1)
+                return false;
+        }
+    }
+
+    // complete, or rebuilt below: either way this parity is spent
+    uint8_t count = parity.count;
+    parity.count = 0;
+    if (missing == 0)
+        return false;
+
+    uint16_t len_xor;
+    memcpy(&len_xor, parity.data, 2);
+    len_xor = ntohs(len_xor);
+    uint8_t flags_xor = (uint8_t)parity.data[2];
+    int parity_len = parity.length - BRIDGE_FEC_HEADER_SIZE;
+
+    memset(payload, 0, BRIDGE_MUX_MAX_PAYLOAD);
+    memcpy(payload, parity.data + BRIDGE_FEC_HEADER_SIZE, parity_len);
+    for (uint16_t i = 0; i < count; i++)
+    {
+        Slot *slot = find(parity.base_seq + i);
+        if (slot == nullptr)
+            continue;
+        len_xor ^= (uint16_t)slot->length;
+        flags_xor ^= slot->flags;
+        bridgeXor(payload, slot->data, slot->length);
+    }
+
+    if (len_xor == 0 || len_xor > parity_len)
+        return false;
+
+    seq = missing_seq;
+    flags = flags_xor;
+    len = len_xor;
+    addPacket(seq, flags, payload, len);
+    return true;
+}
@@ -0,0 +1,102 @@
+#ifndef BRIDGE_FEC_H
+#define BRIDGE_FEC_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "bridge_packet.h"
+
+// XOR parity over groups of consecutive packets of one bridge stream.
+// A BRIDGE_FEC datagram carries the first covered seq in the header seq
+// and this payload:
+//
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |        length xor             |   flags xor   |  group size   |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                  payload xor, longest packet                  |
+//
+// Any one lost packet of a group is rebuilt from the parity and the others.
+
+#define BRIDGE_FEC_HEADER_SIZE 4
+#define BRIDGE_FEC_MAX_GROUP 48
+
+class BridgeFecEncoder
+{
+public:
+  BridgeFecEncoder(uint32_t group_size);
+  ~BridgeFecEncoder();
+
+  // true once seq completes a group, getParity() is valid until the next add
+  bool add(uint16_t seq, uint8_t flags, const char *payload, int len);
+
+  const char *getParity()
+  {
+    return parity_;
+  }
+
+  int getParityLength()
+  {
+    return BRIDGE_FEC_HEADER_SIZE + max_len_;
+  }
+
+  uint16_t getBaseSeq()
+  {
+    return base_seq_;
+  }
+
+  uint32_t getGroupSize()
+  {
+    return group_size_;
+  }
+
+private:
+  uint32_t group_size_;
+  uint32_t count_;
+  uint16_t base_seq_;
+  uint16_t len_xor_;
+  uint8_t flags_xor_;
+  int max_len_;
+  char parity_[BRIDGE_FEC_HEADER_SIZE + BRIDGE_MUX_MAX_PAYLOAD];
+};
+
+// Receiving side: remembers the last packets and parities of one stream
+// and rebuilds a packet once its group is complete but for it.
+class BridgeFecDecoder
+{
+  struct Slot
+  {
+    uint16_t seq;
+    bool valid;
+    uint8_t flags;
+    int length;
+    char data[BRIDGE_MUX_MAX_PAYLOAD];
+  };
+
+  struct Parity
+  {
+    uint16_t base_seq;
+    uint8_t count;
+    int length;
+    char data[BRIDGE_FEC_HEADER_SIZE + BRIDGE_MUX_MAX_PAYLOAD];
+  };
+
+public:
+  BridgeFecDecoder();
+  ~BridgeFecDecoder();
+
+  void addPacket(uint16_t seq, uint8_t flags, const char *payload, int len);
+  void addParity(uint16_t base_seq, const char *payload, int len);
+  // one packet some parity can rebuild now, false when there is none
+  bool recover(uint16_t &seq, uint8_t &flags, char *payload, int &len);
+
+private:
+  Slot *find(uint16_t seq);
+  bool tryParity(Parity &parity, uint16_t &seq, uint8_t &flags, char *payload, int &len);
+
+private:
+  std::vector<Slot> slots_;
+  std::vector<Parity> parities_;
+  uint32_t next_parity_;
+};
+
+#endif
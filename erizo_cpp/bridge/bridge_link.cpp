@@ -0,0 +1,161 @@
+#include "bridge_link.h"
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "common/config.h"
+
+#define BRIDGE_LINK_SENDMMSG_MAX 64
+#define BRIDGE_LINK_RATE_WINDOW_US 1000000
+// pace above the estimate, the pacer only has to flatten bursts
+#define BRIDGE_LINK_PACING_FACTOR 1.5
+
+DEFINE_LOGGER(BridgeLink, "BridgeLink");
+
+BridgeLink::BridgeLink(int fd, const std::string &ip, uint16_t port) : fd_(fd),
+                                                                       key_(makeKey(ip, port)),
+                                                                       batch_size_(Config::getInstance()->bridge_mux_batch),
+                                                                       paced_(Config::getInstance()->bridge_pacer),
+                                                                       burst_ms_(Config::getInstance()->bridge_pacer_burst_ms),
+                                                                       pacer_(Config::getInstance()->bridge_mux_queue),
+                                                                       bwe_(Config::getInstance()->bridge_pacer_start_kbps,
+                                                                            Config::getInstance()->bridge_pacer_min_kbps,
+                                                                            Config::getInstance()->bridge_pacer_max_kbps),
+                                                                       sending_(BRIDGE_LINK_SENDMMSG_MAX * 4),
+                                                                       rate_time_us_(0),
+                                                                       rate_bytes_(0),
+                                                                       sent_packets_(0),
+                                                                       sent_bytes_(0),
+                                                                       dropped_packets_(0),
+                                                                       send_kbps_(0)
+{
+    memset(&addr_, 0, sizeof(addr_));
+    addr_.sin_family = AF_INET;
+    addr_.sin_port = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &addr_.sin_addr);
+    pacer_.setRate(bwe_.getEstimate() * BRIDGE_LINK_PACING_FACTOR, burst_ms_);
+}
+
+BridgeLink::~BridgeLink() {}
+
+std::string BridgeLink::makeKey(const std::string &ip, uint16_t port)
+{
+    return ip + ":" + std::to_string(port);
+}
+
+void BridgeLink::send(const BridgeHeader &header, const char *payload, int len)
+{
+    if (len <= 0 || len > BRIDGE_MUX_MAX_PACKET - BRIDGE_MUX_HEADER_SIZE)
+        return;
+
+    bool full = false;
+    {
+        std::unique_lock<std::mutex> lock(queue_mux_);
+        if (!pacer_.push(BridgePacer::getPriority(header), header, payload, len))
+        {
+            dropped_packets_++;
+            return;
+        }
+        full = pacer_.getQueued() >= batch_size_;
+    }
+
+    if (full)
+        flush();
+}
+
+uint32_t BridgeLink::flush()
+{
+    std::unique_lock<std::mutex> flush_lock(flush_mux_);
+    uint64_t now = bridgeNowUs();
+    uint32_t count = 0;
+    uint32_t flushed = 0;
+    do
+    {
+        {
+            std::unique_lock<std::mutex> lock(queue_mux_);
+            count = pacer_.pull(now, sending_, paced_);
+        }
+        if (!sendBatch(count))
+            break;
+        flushed += count;
+    } while (count == sending_.size());
+
+    if (rate_time_us_ == 0)
+    {
+        rate_time_us_ = now;
+    }
+    else if (now - rate_time_us_ >= BRIDGE_LINK_RATE_WINDOW_US)
+    {
+        send_kbps_ = rate_bytes_ * 8000 / (now - rate_time_us_);
+        rate_bytes_ = 0;
+        rate_time_us_ = now;
+    }
+    return flushed;
+}
+
+bool BridgeLink::sendBatch(uint32_t count)
+{
+    struct mmsghdr msgs[BRIDGE_LINK_SENDMMSG_MAX];
+    struct iovec iovs[BRIDGE_LINK_SENDMMSG_MAX];
+    uint32_t now = bridgeNowMs();
+    uint32_t pos = 0;
+    while (pos < count)
+    {
+        uint32_t num = count - pos < BRIDGE_LINK_SENDMMSG_MAX ? count - pos : BRIDGE_LINK_SENDMMSG_MAX;
+        memset(msgs, 0, sizeof(struct mmsghdr) * num);
+        for (uint32_t i = 0; i < num; i++)
+        {
+            bridgeSetSendTime(sending_[pos + i].data, now);
+            iovs[i].iov_base = sending_[pos + i].data;
+            iovs[i].iov_len = sending_[pos + i].length;
+            msgs[i].msg_hdr.msg_name = &addr_;
+            msgs[i].msg_hdr.msg_namelen = sizeof(addr_);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int sent = sendmmsg(fd_, msgs, num, 0);
+        if (sent <= 0)
+        {
+            dropped_packets_ += count - pos;
+            ELOG_DEBUG("link %s sendmmsg failed, drop %u packets", key_, count - pos);
+            return false;
+        }
+
+        for (int i = 0; i < sent; i++)
+        {
+            sent_bytes_ += sending_[pos + i].length;
+            rate_bytes_ += sending_[pos + i].length;
+        }
+        sent_packets_ += sent;
+        pos += sent;
+    }
+    return true;
+}
+
+void BridgeLink::onReport(const BridgeReport &report)
+{
+    std::unique_lock<std::mutex> lock(queue_mux_);
+    uint32_t last = bwe_.getEstimate();
+    uint32_t estimate = bwe_.onReport(report.recv_kbps, report.queue_delay_ms);
+    pacer_.setRate(estimate * BRIDGE_LINK_PACING_FACTOR, burst_ms_);
+    if (estimate < last)
+        ELOG_DEBUG("link %s queue delay %ums, estimate %u -> %u kbps", key_, report.queue_delay_ms, last, estimate);
+}
+
+BridgeLinkStats BridgeLink::getStats()
+{
+    BridgeLinkStats stats;
+    stats.key = key_;
+    {
+        std::unique_lock<std::mutex> lock(queue_mux_);
+        stats.queued_packets = pacer_.getQueued();
+        stats.queued_bytes = pacer_.getQueuedBytes();
+        stats.estimate_kbps = bwe_.getEstimate();
+    }
+    stats.send_kbps = send_kbps_;
+    stats.sent_packets = sent_packets_;
+    stats.sent_bytes = sent_bytes_;
+    stats.dropped_packets = dropped_packets_;
+    return stats;
+}
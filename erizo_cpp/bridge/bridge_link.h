@@ -0,0 +1,91 @@
+#ifndef BRIDGE_LINK_H
+#define BRIDGE_LINK_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <netinet/in.h>
+
+#include <logger.h>
+
+#include "bridge_packet.h"
+#include "bridge_pacer.h"
+#include "bridge_bwe.h"
+
+struct BridgeLinkStats
+{
+  std::string key;
+  uint32_t queued_packets;
+  uint64_t queued_bytes;
+  uint32_t send_kbps;
+  uint32_t estimate_kbps;
+  uint64_t sent_packets;
+  uint64_t sent_bytes;
+  uint64_t dropped_packets;
+};
+
+// All multiplexed streams towards one remote node. Packets are queued by
+// the publishing threads into the link's pacer and written with one
+// sendmmsg per batch, either when the batch is full or on the next
+// BridgeMux worker tick, as far as the pacer's budget allows.
+class BridgeLink
+{
+  DECLARE_LOGGER();
+
+public:
+  BridgeLink(int fd, const std::string &ip, uint16_t port);
+  ~BridgeLink();
+
+  void send(const BridgeHeader &header, const char *payload, int len);
+  // packets written to the socket
+  uint32_t flush();
+  // BRIDGE_REPORT from the remote node
+  void onReport(const BridgeReport &report);
+
+  const std::string &getKey()
+  {
+    return key_;
+  }
+
+  const struct sockaddr_in &getAddr()
+  {
+    return addr_;
+  }
+
+  uint64_t getSentPackets() { return sent_packets_; }
+  uint64_t getSentBytes() { return sent_bytes_; }
+  uint64_t getDroppedPackets() { return dropped_packets_; }
+  BridgeLinkStats getStats();
+
+  static std::string makeKey(const std::string &ip, uint16_t port);
+
+private:
+  // first count packets of sending_, false if the socket refused them
+  bool sendBatch(uint32_t count);
+
+private:
+  int fd_;
+  std::string key_;
+  struct sockaddr_in addr_;
+  uint32_t batch_size_;
+  bool paced_;
+  uint32_t burst_ms_;
+
+  std::mutex queue_mux_;
+  BridgePacer pacer_;
+  BridgeBwe bwe_;
+
+  // serializes flushers, filled from the pacer
+  std::mutex flush_mux_;
+  std::vector<BridgePacket> sending_;
+  uint64_t rate_time_us_;
+  uint64_t rate_bytes_;
+
+  std::atomic<uint64_t> sent_packets_;
+  std::atomic<uint64_t> sent_bytes_;
+  std::atomic<uint64_t> dropped_packets_;
+  std::atomic<uint32_t> send_kbps_;
+};
+
+#endif
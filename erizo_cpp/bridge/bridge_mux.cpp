@@ -0,0 +1,583 @@
+#include "bridge_mux.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "bridge_mux_stream.h"
+#include "common/config.h"
+
+#define BRIDGE_MUX_RECVMMSG_MAX 32
+#define BRIDGE_MUX_TICK_US 1000
+#define BRIDGE_MUX_STATS_INTERVAL_US 10000000
+#define BRIDGE_MUX_MIN_DELAY_WINDOW_MS 10000
+// below this a worker is idle enough whatever the others do
+#define BRIDGE_MUX_REBALANCE_MIN_PPS 1000
+
+DEFINE_LOGGER(BridgeMux, "BridgeMux");
+BridgeMux *BridgeMux::instance_ = nullptr;
+
+BridgeMux::BridgeMux() : fd_(-1),
+                         run_(false),
+                         loss_permille_(0),
+                         rebalance_us_(0),
+                         last_rebalance_(0),
+                         rebalance_passes_(0),
+                         hot_passes_(0),
+                         migrations_(0),
+                         init_(false)
+{
+}
+
+BridgeMux::~BridgeMux() {}
+
+BridgeMux *BridgeMux::getInstance()
+{
+    if (instance_ == nullptr)
+        instance_ = new BridgeMux;
+    return instance_;
+}
+
+int BridgeMux::openSocket(const std::string &ip, uint16_t port, bool reuse_port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+    {
+        ELOG_ERROR("create udp socket failed");
+        return -1;
+    }
+
+    int buf_size = 8 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+    struct timeval timeout = {0, 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int on = 1;
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+        ELOG_ERROR("set SO_REUSEPORT failed");
+        ::close(fd);
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) != 1 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        ELOG_ERROR("bind %s:%d failed", ip, port);
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int BridgeMux::init(const std::string &ip, uint16_t port, int worker_num, int recv_num)
+{
+    if (init_)
+        return 0;
+
+    // all sockets are bound before any thread reads, the kernel spreads
+    // over whatever is bound at the time a remote first shows up
+    for (int i = 0; i < (recv_num > 0 ? recv_num : 1); i++)
+    {
+        int fd = openSocket(ip, port, recv_num > 1);
+        if (fd < 0)
+        {
+            for (std::unique_ptr<Receiver> &receiver : receivers_)
+                ::close(receiver->fd);
+            receivers_.clear();
+            return 1;
+        }
+        Receiver *receiver = new Receiver;
+        receiver->fd = fd;
+        receivers_.push_back(std::unique_ptr<Receiver>(receiver));
+    }
+    fd_ = receivers_[0]->fd;
+
+    rebalance_us_ = (uint64_t)Config::getInstance()->bridge_rebalance_ms * 1000;
+    last_rebalance_ = bridgeNowUs();
+    rebalance_passes_ = 0;
+    hot_passes_ = 0;
+
+    run_ = true;
+    for (std::unique_ptr<Receiver> &receiver : receivers_)
+    {
+        Receiver *r = receiver.get();
+        receiver->thread = std::unique_ptr<std::thread>(new std::thread([this, r]() {
+            recvLoop(r);
+        }));
+    }
+
+    for (int i = 0; i < (worker_num > 0 ? worker_num : 1); i++)
+    {
+        Worker *worker = new Worker;
+        worker->load = 0;
+        workers_.push_back(std::unique_ptr<Worker>(worker));
+        worker->thread = std::unique_ptr<std::thread>(new std::thread([this, worker]() {
+            workerLoop(worker);
+        }));
+    }
+
+    init_ = true;
+    return 0;
+}
+
+void BridgeMux::close()
+{
+    if (!init_)
+        return;
+
+    run_ = false;
+    for (std::unique_ptr<Receiver> &receiver : receivers_)
+        receiver->thread->join();
+
+    for (std::unique_ptr<Worker> &worker : workers_)
+        worker->thread->join();
+    workers_.clear();
+
+    for (std::unique_ptr<Receiver> &receiver : receivers_)
+        ::close(receiver->fd);
+    receivers_.clear();
+    fd_ = -1;
+
+    links_.clear();
+    moved_.clear();
+    sinks_.clear();
+    sources_.clear();
+
+    init_ = false;
+}
+
+std::shared_ptr<BridgeLink> BridgeMux::addLink(const std::string &ip, uint16_t port)
+{
+    std::unique_lock<std::mutex> lock(links_mux_);
+    std::string key = BridgeLink::makeKey(ip, port);
+    auto it = links_.find(key);
+    if (it != links_.end())
+    {
+        it->second.second++;
+        return it->second.first;
+    }
+
+    std::shared_ptr<BridgeLink> link = std::make_shared<BridgeLink>(fd_, ip, port);
+    links_[key] = {link, 1};
+
+    // fewest packets flushed over the last pass, then fewest links
+    Worker *least = nullptr;
+    for (std::unique_ptr<Worker> &worker : workers_)
+    {
+        std::unique_lock<std::mutex> worker_lock(worker->mux);
+        if (least == nullptr ||
+            worker->load < least->load ||
+            (worker->load == least->load && worker->links.size() < least->links.size()))
+            least = worker.get();
+    }
+    if (least != nullptr)
+    {
+        std::unique_lock<std::mutex> worker_lock(least->mux);
+        least->links.push_back(link);
+    }
+    return link;
+}
+
+void BridgeMux::removeLink(std::shared_ptr<BridgeLink> link)
+{
+    std::unique_lock<std::mutex> lock(links_mux_);
+    auto it = links_.find(link->getKey());
+    if (it == links_.end() || --it->second.second > 0)
+        return;
+    links_.erase(it);
+    moved_.erase(link.get());
+
+    for (std::unique_ptr<Worker> &worker : workers_)
+    {
+        std::unique_lock<std::mutex> worker_lock(worker->mux);
+        worker->packets.erase(link.get());
+        for (auto itl = worker->links.begin(); itl != worker->links.end(); itl++)
+        {
+            if (*itl == link)
+            {
+                worker->links.erase(itl);
+                break;
+            }
+        }
+    }
+    link->flush();
+}
+
+int BridgeMux::addSink(std::shared_ptr<BridgeMuxSink> sink)
+{
+    std::unique_lock<std::mutex> lock(streams_mux_);
+    auto it = sinks_.find(sink->getStreamId());
+    if (it != sinks_.end() && it->second->getBridgeStreamId() != sink->getBridgeStreamId())
+    {
+        ELOG_ERROR("bridge stream %s collides with %s on id %u",
+                   sink->getBridgeStreamId(), it->second->getBridgeStreamId(), sink->getStreamId());
+        return 1;
+    }
+    sinks_[sink->getStreamId()] = sink;
+    return 0;
+}
+
+void BridgeMux::removeSink(std::shared_ptr<BridgeMuxSink> sink)
+{
+    std::unique_lock<std::mutex> lock(streams_mux_);
+    auto it = sinks_.find(sink->getStreamId());
+    if (it != sinks_.end() && it->second == sink)
+        sinks_.erase(it);
+}
+
+int BridgeMux::addSource(std::shared_ptr<BridgeMuxSource> source)
+{
+    std::unique_lock<std::mutex> lock(streams_mux_);
+    auto it = sources_.find(source->getStreamId());
+    if (it != sources_.end() && it->second->getBridgeStreamId() != source->getBridgeStreamId())
+    {
+        ELOG_ERROR("bridge stream %s collides with %s on id %u",
+                   source->getBridgeStreamId(), it->second->getBridgeStreamId(), source->getStreamId());
+        return 1;
+    }
+    sources_[source->getStreamId()] = source;
+    return 0;
+}
+
+void BridgeMux::removeSource(std::shared_ptr<BridgeMuxSource> source)
+{
+    std::unique_lock<std::mutex> lock(streams_mux_);
+    auto it = sources_.find(source->getStreamId());
+    if (it != sources_.end() && it->second == source)
+        sources_.erase(it);
+}
+
+void BridgeMux::sendTo(const struct sockaddr_in &addr, const BridgeHeader &header, const char *payload, int len)
+{
+    if (fd_ < 0 || len < 0 || len > BRIDGE_MUX_MAX_PAYLOAD)
+        return;
+
+    char buf[BRIDGE_MUX_MAX_PACKET];
+    header.write(buf);
+    memcpy(buf + BRIDGE_MUX_HEADER_SIZE, payload, len);
+    sendto(fd_, buf, BRIDGE_MUX_HEADER_SIZE + len, 0, (const struct sockaddr *)&addr, sizeof(addr));
+}
+
+std::vector<BridgeLinkStats> BridgeMux::getLinkStats()
+{
+    std::vector<BridgeLinkStats> stats;
+    std::unique_lock<std::mutex> lock(links_mux_);
+    for (auto &it : links_)
+        stats.push_back(it.second.first->getStats());
+    return stats;
+}
+
+void BridgeMux::recvLoop(Receiver *receiver)
+{
+    std::vector<char> storage(BRIDGE_MUX_RECVMMSG_MAX * BRIDGE_MUX_MAX_PACKET);
+    char *bufs[BRIDGE_MUX_RECVMMSG_MAX];
+    for (int i = 0; i < BRIDGE_MUX_RECVMMSG_MAX; i++)
+        bufs[i] = &storage[i * BRIDGE_MUX_MAX_PACKET];
+    struct mmsghdr msgs[BRIDGE_MUX_RECVMMSG_MAX];
+    struct iovec iovs[BRIDGE_MUX_RECVMMSG_MAX];
+    struct sockaddr_in addrs[BRIDGE_MUX_RECVMMSG_MAX];
+
+    while (run_)
+    {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < BRIDGE_MUX_RECVMMSG_MAX; i++)
+        {
+            iovs[i].iov_base = bufs[i];
+            iovs[i].iov_len = BRIDGE_MUX_MAX_PACKET;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int num = recvmmsg(receiver->fd, msgs, BRIDGE_MUX_RECVMMSG_MAX, MSG_WAITFORONE, nullptr);
+        for (int i = 0; i < num; i++)
+            dispatch(receiver, bufs[i], msgs[i].msg_len, addrs[i]);
+    }
+}
+
+void BridgeMux::dispatch(Receiver *receiver, const char *buf, int len, const struct sockaddr_in &from)
+{
+    BridgeHeader header;
+    if (!header.read(buf, len))
+        return;
+
+    const char *payload = buf + BRIDGE_MUX_HEADER_SIZE;
+    int payload_len = len - BRIDGE_MUX_HEADER_SIZE;
+    if (loss_permille_ > 0 && (header.type == BRIDGE_MEDIA || header.type == BRIDGE_FEC) &&
+        (uint32_t)(rand() % 1000) < loss_permille_)
+        return;
+
+    if (header.type == BRIDGE_MEDIA || header.type == BRIDGE_FEC)
+        onMedia(receiver, len, header.send_time, from);
+
+    if (header.type == BRIDGE_MEDIA)
+    {
+        std::shared_ptr<BridgeMuxSource> source;
+        {
+            std::unique_lock<std::mutex> lock(streams_mux_);
+            auto it = sources_.find(header.stream_id);
+            if (it == sources_.end())
+                return;
+            source = it->second;
+        }
+        source->onPacket(header, payload, payload_len, from);
+    }
+    else if (header.type == BRIDGE_FEC)
+    {
+        std::shared_ptr<BridgeMuxSource> source;
+        {
+            std::unique_lock<std::mutex> lock(streams_mux_);
+            auto it = sources_.find(header.stream_id);
+            if (it == sources_.end())
+                return;
+            source = it->second;
+        }
+        source->onFec(header, payload, payload_len, from);
+    }
+    else if (header.type == BRIDGE_FEEDBACK || header.type == BRIDGE_NACK)
+    {
+        std::shared_ptr<BridgeMuxSink> sink;
+        {
+            std::unique_lock<std::mutex> lock(streams_mux_);
+            auto it = sinks_.find(header.stream_id);
+            if (it == sinks_.end())
+                return;
+            sink = it->second;
+        }
+        if (header.type == BRIDGE_NACK)
+            sink->onNack(payload, payload_len);
+        else
+            sink->onFeedback(payload, payload_len);
+    }
+    else if (header.type == BRIDGE_REPORT)
+    {
+        onReport(payload, payload_len, from);
+    }
+}
+
+void BridgeMux::onMedia(Receiver *receiver, int len, uint32_t send_time, const struct sockaddr_in &from)
+{
+    std::map<uint64_t, Remote> &remotes = receiver->remotes;
+    uint32_t now = bridgeNowMs();
+    int64_t delay = (int32_t)(now - send_time);
+    uint64_t key = ((uint64_t)from.sin_addr.s_addr << 16) | from.sin_port;
+    auto it = remotes.find(key);
+    if (it == remotes.end())
+    {
+        Remote remote;
+        remote.addr = from;
+        remote.bytes = 0;
+        remote.min_delay = delay;
+        remote.window_min_delay = delay;
+        remote.window_start = now;
+        remote.delay_sum = 0;
+        remote.delay_count = 0;
+        remote.last_report = now;
+        it = remotes.insert({key, remote}).first;
+    }
+
+    Remote &remote = it->second;
+    remote.bytes += len;
+    if (delay < remote.window_min_delay)
+        remote.window_min_delay = delay;
+    if (delay < remote.min_delay)
+        remote.min_delay = delay;
+    if (now - remote.window_start >= BRIDGE_MUX_MIN_DELAY_WINDOW_MS)
+    {
+        // let the floor follow clock drift and route changes
+        remote.min_delay = remote.window_min_delay;
+        remote.window_min_delay = delay;
+        remote.window_start = now;
+    }
+    remote.delay_sum += delay - remote.min_delay;
+    remote.delay_count++;
+
+    uint32_t elapsed = now - remote.last_report;
+    if (elapsed < BRIDGE_REPORT_INTERVAL_MS)
+        return;
+
+    BridgeReport report;
+    report.recv_kbps = remote.bytes * 8 / elapsed;
+    report.queue_delay_ms = remote.delay_count > 0 ? remote.delay_sum / remote.delay_count : 0;
+    remote.bytes = 0;
+    remote.delay_sum = 0;
+    remote.delay_count = 0;
+    remote.last_report = now;
+
+    BridgeHeader header;
+    header.type = BRIDGE_REPORT;
+    header.flags = 0;
+    header.seq = 0;
+    header.stream_id = 0;
+    header.send_time = now;
+    char payload[BRIDGE_REPORT_SIZE];
+    report.write(payload);
+    sendTo(remote.addr, header, payload, sizeof(payload));
+}
+
+void BridgeMux::onReport(const char *payload, int len, const struct sockaddr_in &from)
+{
+    BridgeReport report;
+    if (!report.read(payload, len))
+        return;
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &from.sin_addr, ip, sizeof(ip));
+    std::shared_ptr<BridgeLink> link;
+    {
+        std::unique_lock<std::mutex> lock(links_mux_);
+        auto it = links_.find(BridgeLink::makeKey(ip, ntohs(from.sin_port)));
+        if (it == links_.end())
+            return;
+        link = it->second.first;
+    }
+    link->onReport(report);
+}
+
+void BridgeMux::workerLoop(Worker *worker)
+{
+    std::vector<std::shared_ptr<BridgeLink>> links;
+    std::vector<uint32_t> flushed;
+    uint64_t last_stats = bridgeNowUs();
+    while (run_)
+    {
+        usleep(BRIDGE_MUX_TICK_US);
+        {
+            std::unique_lock<std::mutex> lock(worker->mux);
+            links = worker->links;
+        }
+        flushed.resize(links.size());
+        for (size_t i = 0; i < links.size(); i++)
+            flushed[i] = links[i]->flush();
+
+        // only what this worker flushed, full batches flushed by the
+        // publishing threads cost them and not us
+        if (rebalance_us_ > 0)
+        {
+            std::unique_lock<std::mutex> lock(worker->mux);
+            for (size_t i = 0; i < links.size(); i++)
+            {
+                if (flushed[i] > 0)
+                    worker->packets[links[i].get()] += flushed[i];
+            }
+        }
+
+        uint64_t now = bridgeNowUs();
+        uint64_t last = last_rebalance_;
+        if (rebalance_us_ > 0 &&
+            now - last >= rebalance_us_ &&
+            last_rebalance_.compare_exchange_strong(last, now))
+            rebalance();
+
+        if (now - last_stats >= BRIDGE_MUX_STATS_INTERVAL_US)
+        {
+            last_stats = now;
+            for (std::shared_ptr<BridgeLink> &link : links)
+            {
+                BridgeLinkStats stats = link->getStats();
+                ELOG_DEBUG("link %s queued %u/%lu bytes, send %u kbps, estimate %u kbps, dropped %lu",
+                           stats.key, stats.queued_packets, (unsigned long)stats.queued_bytes,
+                           stats.send_kbps, stats.estimate_kbps, (unsigned long)stats.dropped_packets);
+            }
+        }
+        links.clear();
+    }
+}
+
+void BridgeMux::rebalance()
+{
+    std::unique_lock<std::mutex> lock(links_mux_);
+    rebalance_passes_++;
+
+    std::vector<std::map<BridgeLink *, uint64_t>> packets(workers_.size());
+    std::vector<uint64_t> loads(workers_.size(), 0);
+    uint64_t total = 0;
+    size_t hot = 0, cool = 0;
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+        Worker *worker = workers_[i].get();
+        {
+            std::unique_lock<std::mutex> worker_lock(worker->mux);
+            packets[i].swap(worker->packets);
+        }
+        for (auto &it : packets[i])
+            loads[i] += it.second;
+        worker->load = loads[i];
+        total += loads[i];
+        if (loads[i] > loads[hot])
+            hot = i;
+        if (loads[i] < loads[cool])
+            cool = i;
+    }
+
+    // hysteresis: the hottest worker must stay threshold percent above the
+    // mean for several passes in a row before anything moves
+    uint64_t mean = total / workers_.size();
+    uint64_t hot_pps = loads[hot] * 1000000 / rebalance_us_;
+    if (hot == cool ||
+        hot_pps < BRIDGE_MUX_REBALANCE_MIN_PPS ||
+        loads[hot] * 100 <= mean * (100 + Config::getInstance()->bridge_rebalance_threshold))
+    {
+        hot_passes_ = 0;
+        return;
+    }
+    if (++hot_passes_ < Config::getInstance()->bridge_rebalance_passes)
+        return;
+    hot_passes_ = 0;
+
+    // a link lighter than the gap narrows it, the one closest to half the
+    // gap evens the two workers best
+    uint64_t gap = loads[hot] - loads[cool];
+    Worker *from = workers_[hot].get();
+    Worker *to = workers_[cool].get();
+    std::shared_ptr<BridgeLink> best = nullptr;
+    uint64_t best_load = 0;
+    {
+        std::unique_lock<std::mutex> worker_lock(from->mux);
+        for (std::shared_ptr<BridgeLink> &link : from->links)
+        {
+            auto it = packets[hot].find(link.get());
+            if (it == packets[hot].end() || it->second >= gap)
+                continue;
+            auto itm = moved_.find(link.get());
+            if (itm != moved_.end() &&
+                rebalance_passes_ - itm->second < Config::getInstance()->bridge_rebalance_passes)
+                continue;
+
+            uint64_t distance = it->second > gap / 2 ? it->second - gap / 2 : gap / 2 - it->second;
+            uint64_t best_distance = best_load > gap / 2 ? best_load - gap / 2 : gap / 2 - best_load;
+            if (best == nullptr || distance < best_distance)
+            {
+                best = link;
+                best_load = it->second;
+            }
+        }
+        if (best == nullptr)
+            return;
+
+        for (auto itl = from->links.begin(); itl != from->links.end(); itl++)
+        {
+            if (*itl == best)
+            {
+                from->links.erase(itl);
+                break;
+            }
+        }
+    }
+    {
+        std::unique_lock<std::mutex> worker_lock(to->mux);
+        to->links.push_back(best);
+    }
+    moved_[best.get()] = rebalance_passes_;
+    migrations_++;
+
+    ELOG_INFO("move link %s from worker %u (%lu packets) to worker %u (%lu packets), link %lu packets",
+              best->getKey(), (uint32_t)hot, (unsigned long)loads[hot],
+              (uint32_t)cool, (unsigned long)loads[cool], (unsigned long)best_load);
+}
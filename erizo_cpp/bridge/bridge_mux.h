@@ -0,0 +1,155 @@
+#ifndef BRIDGE_MUX_H
+#define BRIDGE_MUX_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <netinet/in.h>
+
+#include <logger.h>
+
+#include "bridge_packet.h"
+#include "bridge_link.h"
+
+class BridgeMuxSink;
+class BridgeMuxSource;
+
+// Multiplexed bridge transport: one UDP port per node carries every
+// cascaded stream to and from every other node, demultiplexed by the
+// compact stream id in BridgeHeader. Counterpart of erizo::BridgeIO.
+//
+// With more than one receive thread the port is bound by that many
+// SO_REUSEPORT sockets. The kernel hashes every remote node's address to
+// one of them, so a node's streams stay on one thread and per remote state
+// needs no locking; the first socket also sends.
+//
+// Every link is flushed by one worker. Links are placed on the worker that
+// flushed the fewest packets lately, and when one worker stays hotter than
+// the others for several rebalance passes a link is moved off it; the
+// link's queue travels with it and flushes are serialized by the link, so
+// a move loses nothing.
+class BridgeMux
+{
+  DECLARE_LOGGER();
+
+  struct Worker
+  {
+    std::unique_ptr<std::thread> thread;
+    std::mutex mux;
+    std::vector<std::shared_ptr<BridgeLink>> links;
+    // packets this worker flushed per link since the last rebalance pass
+    std::map<BridgeLink *, uint64_t> packets;
+    // packets flushed over the last pass, for placing new links
+    std::atomic<uint64_t> load;
+  };
+
+  // a node sending to us, only touched by its receiver's thread
+  struct Remote
+  {
+    struct sockaddr_in addr;
+    uint64_t bytes;
+    // one way delay floor, clocks of the two nodes are not synced
+    int64_t min_delay;
+    int64_t window_min_delay;
+    uint32_t window_start;
+    int64_t delay_sum;
+    uint32_t delay_count;
+    uint32_t last_report;
+  };
+
+  struct Receiver
+  {
+    int fd;
+    std::unique_ptr<std::thread> thread;
+    // address << 16 | port -> sending node
+    std::map<uint64_t, Remote> remotes;
+  };
+
+public:
+  static BridgeMux *getInstance();
+  ~BridgeMux();
+
+  // recv_num sockets share the port, 1 binds it alone
+  int init(const std::string &ip, uint16_t port, int worker_num, int recv_num = 1);
+  void close();
+
+  // one link per remote node, shared by all streams towards it
+  std::shared_ptr<BridgeLink> addLink(const std::string &ip, uint16_t port);
+  void removeLink(std::shared_ptr<BridgeLink> link);
+
+  // 1 if another bridge_stream_id already holds the stream's compact id,
+  // the bridge cannot be multiplexed then
+  int addSink(std::shared_ptr<BridgeMuxSink> sink);
+  void removeSink(std::shared_ptr<BridgeMuxSink> sink);
+  int addSource(std::shared_ptr<BridgeMuxSource> source);
+  void removeSource(std::shared_ptr<BridgeMuxSource> source);
+
+  void sendTo(const struct sockaddr_in &addr, const BridgeHeader &header, const char *payload, int len);
+
+  std::vector<BridgeLinkStats> getLinkStats();
+
+  // links moved between workers so far
+  uint64_t getMigrations()
+  {
+    return migrations_;
+  }
+
+  // drops received media at random, for loss recovery benchmarks only
+  void setLossInjection(uint32_t permille)
+  {
+    loss_permille_ = permille;
+  }
+
+  bool isInit()
+  {
+    return init_;
+  }
+
+private:
+  BridgeMux();
+  static int openSocket(const std::string &ip, uint16_t port, bool reuse_port);
+  void recvLoop(Receiver *receiver);
+  void workerLoop(Worker *worker);
+  // takes links_mux_, moves at most one link
+  void rebalance();
+  void dispatch(Receiver *receiver, const char *buf, int len, const struct sockaddr_in &from);
+  void onMedia(Receiver *receiver, int len, uint32_t send_time, const struct sockaddr_in &from);
+  void onReport(const char *payload, int len, const struct sockaddr_in &from);
+
+private:
+  int fd_;
+  std::atomic<bool> run_;
+  std::atomic<uint32_t> loss_permille_;
+  std::vector<std::unique_ptr<Receiver>> receivers_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  std::mutex links_mux_;
+  // key -> (link, number of streams on it)
+  std::map<std::string, std::pair<std::shared_ptr<BridgeLink>, int>> links_;
+
+  // fixed by init, 0 never moves a link
+  uint64_t rebalance_us_;
+  // the worker that swaps it runs the pass
+  std::atomic<uint64_t> last_rebalance_;
+  // the rest under links_mux_
+  uint32_t rebalance_passes_;
+  // passes in a row the hottest worker was over the threshold
+  uint32_t hot_passes_;
+  // link -> pass it was last moved in, it stays put for a while after
+  std::map<BridgeLink *, uint32_t> moved_;
+  std::atomic<uint64_t> migrations_;
+
+  std::mutex streams_mux_;
+  std::map<uint32_t, std::shared_ptr<BridgeMuxSink>> sinks_;
+  std::map<uint32_t, std::shared_ptr<BridgeMuxSource>> sources_;
+
+  bool init_;
+
+  static BridgeMux *instance_;
+};
+
+#endif
@@ -0,0 +1,468 @@
+#include "bridge_mux_stream.h"
+
+#include "common/config.h"
+#include "bridge_link.h"
+#include "bridge_mux.h"
+
+// a gap wider than this is an outage, not loss worth repairing
+#define BRIDGE_NACK_MAX_GAP 256
+#define BRIDGE_NACK_RETRY_MS 100
+#define BRIDGE_NACK_MAX_RETRIES 3
+// subscribers NACKing the same rtp packet within this window share one upstream NACK
+#define BRIDGE_NACK_SUPPRESS_MS 100
+#define BRIDGE_NACK_HISTORY 4096
+
+DEFINE_LOGGER(BridgeMuxSink, "BridgeMuxSink");
+DEFINE_LOGGER(BridgeMuxSource, "BridgeMuxSource");
+
+BridgeMuxSink::BridgeMuxSink(const std::string &bridge_stream_id, std::shared_ptr<BridgeLink> link, uint32_t fec_group) : bridge_stream_id_(bridge_stream_id),
+                                                                                                                          stream_id_(bridgeStreamId(bridge_stream_id)),
+                                                                                                                          link_(link),
+                                                                                                                          seq_(0),
+                                                                                                                          fec_(nullptr),
+                                                                                                                          retransmitted_(0)
+{
+    sink_fb_source_ = this;
+    if (Config::getInstance()->bridge_nack)
+        rtx_.resize(Config::getInstance()->bridge_rtx_buffer);
+    if (fec_group > 0)
+        fec_.reset(new BridgeFecEncoder(fec_group));
+}
+
+BridgeMuxSink::~BridgeMuxSink() {}
+
+void BridgeMuxSink::close()
+{
+    fb_sink_ = nullptr;
+    std::unique_lock<std::mutex> lock(mux_);
+    rtx_.clear();
+}
+
+int BridgeMuxSink::deliverAudioData_(std::shared_ptr<erizo::DataPacket> packet)
+{
+    return deliver(packet, BRIDGE_FLAG_AUDIO);
+}
+
+int BridgeMuxSink::deliverVideoData_(std::shared_ptr<erizo::DataPacket> packet)
+{
+    return deliver(packet, packet->is_keyframe ? (BRIDGE_FLAG_VIDEO | BRIDGE_FLAG_KEYFRAME) : BRIDGE_FLAG_VIDEO);
+}
+
+int BridgeMuxSink::deliverEvent_(erizo::MediaEventPtr event)
+{
+    return 0;
+}
+
+int BridgeMuxSink::deliver(const std::shared_ptr<erizo::DataPacket> &packet, uint8_t flags)
+{
+    BridgeHeader header;
+    header.type = BRIDGE_MEDIA;
+    header.flags = flags;
+    header.stream_id = stream_id_;
+    header.send_time = bridgeNowMs();
+    BridgeHeader fec_header;
+    char parity[BRIDGE_FEC_HEADER_SIZE + BRIDGE_MUX_MAX_PAYLOAD];
+    int parity_len = 0;
+    {
+        std::unique_lock<std::mutex> lock(mux_);
+        header.seq = seq_++;
+        if (!rtx_.empty())
+        {
+            // the publisher's packet is shared with every subscriber, keep a reference not a copy
+            RtxSlot &slot = rtx_[header.seq % rtx_.size()];
+            slot.packet = packet;
+            slot.seq = header.seq;
+            slot.flags = flags;
+        }
+        if (fec_ != nullptr && fec_->add(header.seq, flags, packet->data, packet->length))
+        {
+            fec_header.type = BRIDGE_FEC;
+            fec_header.flags = 0;
+            fec_header.seq = fec_->getBaseSeq();
+            fec_header.stream_id = stream_id_;
+            fec_header.send_time = header.send_time;
+            parity_len = fec_->getParityLength();
+            memcpy(parity, fec_->getParity(), parity_len);
+        }
+    }
+    link_->send(header, packet->data, packet->length);
+    if (parity_len > 0)
+        link_->send(fec_header, parity, parity_len);
+    return packet->length;
+}
+
+void BridgeMuxSink::onFeedback(const char *data, int len)
+{
+    erizo::FeedbackSink *fb_sink = fb_sink_;
+    if (fb_sink != nullptr)
+        fb_sink->deliverFeedback(std::make_shared<erizo::DataPacket>(0, data, len, erizo::OTHER_PACKET));
+}
+
+void BridgeMuxSink::onNack(const char *data, int len)
+{
+    for (int pos = 0; pos + 2 <= len; pos += 2)
+    {
+        uint16_t seq;
+        memcpy(&seq, data + pos, 2);
+        seq = ntohs(seq);
+
+        std::shared_ptr<erizo::DataPacket> packet;
+        uint8_t flags = 0;
+        {
+            std::unique_lock<std::mutex> lock(mux_);
+            if (rtx_.empty())
+                return;
+            RtxSlot &slot = rtx_[seq % rtx_.size()];
+            if (slot.packet == nullptr || slot.seq != seq)
+                continue;
+            packet = slot.packet;
+            flags = slot.flags;
+        }
+
+        BridgeHeader header;
+        header.type = BRIDGE_MEDIA;
+        header.flags = flags | BRIDGE_FLAG_RTX;
+        header.seq = seq;
+        header.stream_id = stream_id_;
+        header.send_time = bridgeNowMs();
+        link_->send(header, packet->data, packet->length);
+        retransmitted_++;
+    }
+}
+
+BridgeMuxSource::BridgeMuxSource(const std::string &bridge_stream_id, uint32_t video_ssrc, uint32_t audio_ssrc) : bridge_stream_id_(bridge_stream_id),
+                                                                                                                 stream_id_(bridgeStreamId(bridge_stream_id)),
+                                                                                                                 has_remote_(false),
+                                                                                                                 nack_(Config::getInstance()->bridge_nack),
+                                                                                                                 has_seq_(false),
+                                                                                                                 max_seq_(0),
+                                                                                                                 recovered_(0),
+                                                                                                                 lost_(0),
+                                                                                                                 nacks_suppressed_(0),
+                                                                                                                 fec_recovered_(0)
+{
+    memset(&remote_, 0, sizeof(remote_));
+    setVideoSourceSSRC(video_ssrc);
+    setAudioSourceSSRC(audio_ssrc);
+    source_fb_sink_ = this;
+}
+
+BridgeMuxSource::~BridgeMuxSource() {}
+
+void BridgeMuxSource::close()
+{
+    video_sink_ = nullptr;
+    audio_sink_ = nullptr;
+    event_sink_ = nullptr;
+    ELOG_DEBUG("bridge stream %s recovered %lu (fec %lu) lost %lu suppressed %lu nacks",
+               bridge_stream_id_, (unsigned long)recovered_, (unsigned long)fec_recovered_,
+               (unsigned long)lost_, (unsigned long)nacks_suppressed_);
+}
+
+bool BridgeMuxSource::setRemote(const struct sockaddr_in &from)
+{
+    std::unique_lock<std::mutex> lock(remote_mux_);
+    if (has_remote_ &&
+        (remote_.sin_addr.s_addr != from.sin_addr.s_addr || remote_.sin_port != from.sin_port))
+        return false;
+    remote_ = from;
+    has_remote_ = true;
+    return true;
+}
+
+void BridgeMuxSource::onPacket(const BridgeHeader &header, const char *payload, int len, const struct sockaddr_in &from)
+{
+    if (!setRemote(from))
+        return;
+
+    if (fec_ != nullptr)
+        fec_->addPacket(header.seq, header.flags & ~BRIDGE_FLAG_RTX, payload, len);
+    receive(header.seq, header.flags, payload, len);
+    if (fec_ != nullptr)
+        recoverFec();
+    processMissing(bridgeNowMs());
+}
+
+void BridgeMuxSource::onFec(const BridgeHeader &header, const char *payload, int len, const struct sockaddr_in &from)
+{
+    if (!setRemote(from))
+        return;
+
+    if (fec_ == nullptr)
+        fec_.reset(new BridgeFecDecoder());
+    fec_->addParity(header.seq, payload, len);
+    recoverFec();
+}
+
+void BridgeMuxSource::recoverFec()
+{
+    char payload[BRIDGE_MUX_MAX_PAYLOAD];
+    uint16_t seq;
+    uint8_t flags;
+    int len;
+    while (fec_->recover(seq, flags, payload, len))
+    {
+        if (receive(seq, flags, payload, len))
+            fec_recovered_++;
+    }
+}
+
+bool BridgeMuxSource::receive(uint16_t seq, uint8_t flags, const char *payload, int len)
+{
+    if (!trackSeq(seq))
+        return false;
+
+    if (flags & BRIDGE_FLAG_AUDIO)
+    {
+        erizo::MediaSink *sink = audio_sink_;
+        if (sink != nullptr)
+            sink->deliverAudioData(std::make_shared<erizo::DataPacket>(0, payload, len, erizo::AUDIO_PACKET));
+    }
+    else
+    {
+        erizo::MediaSink *sink = video_sink_;
+        if (sink != nullptr)
+        {
+            std::shared_ptr<erizo::DataPacket> packet = std::make_shared<erizo::DataPacket>(0, payload, len, erizo::VIDEO_PACKET);
+            packet->is_keyframe = (flags & BRIDGE_FLAG_KEYFRAME) != 0;
+            sink->deliverVideoData(packet);
+        }
+    }
+    return true;
+}
+
+bool BridgeMuxSource::trackSeq(uint16_t seq)
+{
+    if (!has_seq_)
+    {
+        has_seq_ = true;
+        max_seq_ = seq;
+        return true;
+    }
+
+    int16_t diff = (int16_t)(seq - max_seq_);
+    if (diff > 0)
+    {
+        if (diff > BRIDGE_NACK_MAX_GAP)
+        {
+            lost_ += missing_.size() + diff - 1;
+            missing_.clear();
+        }
+        else
+        {
+            uint32_t now = bridgeNowMs();
+            for (uint16_t lost = max_seq_ + 1; lost != seq; lost++)
+                missing_[lost] = {now, 0, 0};
+        }
+        max_seq_ = seq;
+        return true;
+    }
+
+    // late or retransmitted, only what is still missing goes on
+    auto it = missing_.find(seq);
+    if (it == missing_.end())
+        return false;
+    missing_.erase(it);
+    recovered_++;
+    return true;
+}
+
+void BridgeMuxSource::processMissing(uint32_t now)
+{
+    if (missing_.empty())
+        return;
+
+    if (!nack_)
+    {
+        // only FEC can still bring these back
+        for (auto it = missing_.begin(); it != missing_.end();)
+        {
+            if (now - it->second.first_seen >= BRIDGE_NACK_RETRY_MS * BRIDGE_NACK_MAX_RETRIES)
+            {
+                lost_++;
+                it = missing_.erase(it);
+            }
+            else
+            {
+                it++;
+            }
+        }
+        return;
+    }
+
+    char buf[BRIDGE_NACK_MAX_SEQS * 2];
+    int count = 0;
+    for (auto it = missing_.begin(); it != missing_.end();)
+    {
+        Missing &missing = it->second;
+        if (missing.retries > 0 && now - missing.last_nack < BRIDGE_NACK_RETRY_MS)
+        {
+            it++;
+            continue;
+        }
+        if (missing.retries >= BRIDGE_NACK_MAX_RETRIES)
+        {
+            lost_++;
+            it = missing_.erase(it);
+            continue;
+        }
+
+        missing.last_nack = now;
+        missing.retries++;
+        uint16_t seq = htons(it->first);
+        memcpy(buf + count * 2, &seq, 2);
+        if (++count == BRIDGE_NACK_MAX_SEQS)
+        {
+            send(BRIDGE_NACK, buf, count * 2);
+            count = 0;
+        }
+        it++;
+    }
+
+    if (count > 0)
+        send(BRIDGE_NACK, buf, count * 2);
+}
+
+int BridgeMuxSource::deliverFeedback_(std::shared_ptr<erizo::DataPacket> packet)
+{
+    int len = filterNacks(packet->data, packet->length);
+    if (len > 0)
+        sendFeedback(packet->data, len);
+    return packet->length;
+}
+
+int BridgeMuxSource::filterNacks(char *buf, int len)
+{
+    char out[BRIDGE_MUX_MAX_PAYLOAD];
+    int out_len = 0;
+    uint32_t now = bridgeNowMs();
+
+    std::unique_lock<std::mutex> lock(nack_mux_);
+    if (downstream_nacks_.size() > BRIDGE_NACK_HISTORY)
+    {
+        for (auto it = downstream_nacks_.begin(); it != downstream_nacks_.end();)
+        {
+            if (now - it->second >= BRIDGE_NACK_SUPPRESS_MS)
+                it = downstream_nacks_.erase(it);
+            else
+                it++;
+        }
+    }
+
+    // walk the compound packet, copy everything but already requested NACK items
+    int pos = 0;
+    while (pos + 4 <= len)
+    {
+        uint8_t fmt = (uint8_t)buf[pos] & 0x1f;
+        uint8_t pt = (uint8_t)buf[pos + 1];
+        uint16_t words;
+        memcpy(&words, buf + pos + 2, 2);
+        int block_len = (ntohs(words) + 1) * 4;
+        if (pos + block_len > len)
+            break;
+
+        // generic NACK, rfc 4585 6.2.1
+        if (pt != 205 || fmt != 1 || block_len < 16)
+        {
+            memcpy(out + out_len, buf + pos, block_len);
+            out_len += block_len;
+            pos += block_len;
+            continue;
+        }
+
+        int start = pos;
+        uint32_t media_ssrc;
+        memcpy(&media_ssrc, buf + pos + 8, 4);
+        media_ssrc = ntohl(media_ssrc);
+
+        std::vector<uint16_t> seqs;
+        for (int fci = pos + 12; fci + 4 <= pos + block_len; fci += 4)
+        {
+            uint16_t pid, blp;
+            memcpy(&pid, buf + fci, 2);
+            memcpy(&blp, buf + fci + 2, 2);
+            pid = ntohs(pid);
+            blp = ntohs(blp);
+            for (int i = 0; i < 17; i++)
+            {
+                if (i > 0 && !(blp & (1 << (i - 1))))
+                    continue;
+                uint16_t seq = pid + i;
+                uint32_t &last = downstream_nacks_[((uint64_t)media_ssrc << 16) | seq];
+                if (last != 0 && now - last < BRIDGE_NACK_SUPPRESS_MS)
+                {
+                    nacks_suppressed_++;
+                    continue;
+                }
+                last = now;
+                seqs.push_back(seq);
+            }
+        }
+        pos += block_len;
+        if (seqs.empty())
+            continue;
+
+        // re-encode what is left as pid/blp pairs
+        int block = out_len;
+        memcpy(out + block, buf + start, 12);
+        out_len += 12;
+        size_t i = 0;
+        while (i < seqs.size() && out_len + 4 <= (int)sizeof(out))
+        {
+            uint16_t pid = seqs[i++];
+            uint16_t blp = 0;
+            while (i < seqs.size() && (uint16_t)(seqs[i] - pid) >= 1 && (uint16_t)(seqs[i] - pid) <= 16)
+            {
+                blp |= 1 << ((uint16_t)(seqs[i] - pid) - 1);
+                i++;
+            }
+            uint16_t pid_n = htons(pid);
+            uint16_t blp_n = htons(blp);
+            memcpy(out + out_len, &pid_n, 2);
+            memcpy(out + out_len + 2, &blp_n, 2);
+            out_len += 4;
+        }
+        uint16_t out_words = htons((out_len - block) / 4 - 1);
+        memcpy(out + block + 2, &out_words, 2);
+    }
+
+    memcpy(buf, out, out_len);
+    return out_len;
+}
+
+int BridgeMuxSource::sendPLI()
+{
+    // rtcp PLI (PT=206, FMT=1) towards the publisher's video ssrc
+    char pli[12] = {0};
+    pli[0] = (char)0x81;
+    pli[1] = (char)206;
+    pli[3] = 2;
+    uint32_t media_ssrc = htonl(getVideoSourceSSRC());
+    memcpy(pli + 8, &media_ssrc, 4);
+    sendFeedback(pli, sizeof(pli));
+    return 0;
+}
+
+void BridgeMuxSource::sendFeedback(const char *data, int len)
+{
+    send(BRIDGE_FEEDBACK, data, len);
+}
+
+void BridgeMuxSource::send(uint8_t type, const char *data, int len)
+{
+    struct sockaddr_in remote;
+    {
+        std::unique_lock<std::mutex> lock(remote_mux_);
+        if (!has_remote_)
+            return;
+        remote = remote_;
+    }
+
+    BridgeHeader header;
+    header.type = type;
+    header.flags = 0;
+    header.seq = 0;
+    header.stream_id = stream_id_;
+    header.send_time = bridgeNowMs();
+    BridgeMux::getInstance()->sendTo(remote, header, data, len);
+}
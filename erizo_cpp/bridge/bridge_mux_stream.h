@@ -0,0 +1,171 @@
+#ifndef BRIDGE_MUX_STREAM_H
+#define BRIDGE_MUX_STREAM_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <netinet/in.h>
+
+#include <logger.h>
+#include <MediaDefinitions.h>
+
+#include "bridge_packet.h"
+#include "bridge_fec.h"
+
+class BridgeLink;
+
+// Sending end of a multiplexed bridge stream, subscribed to the publisher's
+// OneToManyProcessor in place of a BridgeMediaStream. Keeps the last
+// packets it sent so the receiving node can NACK them, as the publisher's
+// proxy forwarded them: in the subscribers' rtp seq space, keyed by the
+// bridge stream seq.
+class BridgeMuxSink : public erizo::MediaSink,
+                      public erizo::FeedbackSource
+{
+  DECLARE_LOGGER();
+
+  struct RtxSlot
+  {
+    std::shared_ptr<erizo::DataPacket> packet;
+    uint16_t seq;
+    uint8_t flags;
+  };
+
+public:
+  // fec_group > 0 adds one parity packet every fec_group packets
+  BridgeMuxSink(const std::string &bridge_stream_id, std::shared_ptr<BridgeLink> link, uint32_t fec_group = 0);
+  ~BridgeMuxSink();
+
+  void close() override;
+  // rtcp sent back by the receiving node
+  void onFeedback(const char *data, int len);
+  // BRIDGE_NACK sent back by the receiving node
+  void onNack(const char *data, int len);
+
+  uint32_t getStreamId()
+  {
+    return stream_id_;
+  }
+
+  const std::string &getBridgeStreamId()
+  {
+    return bridge_stream_id_;
+  }
+
+  std::shared_ptr<BridgeLink> getLink()
+  {
+    return link_;
+  }
+
+  uint64_t getRetransmitted()
+  {
+    return retransmitted_;
+  }
+
+private:
+  int deliverAudioData_(std::shared_ptr<erizo::DataPacket> packet) override;
+  int deliverVideoData_(std::shared_ptr<erizo::DataPacket> packet) override;
+  int deliverEvent_(erizo::MediaEventPtr event) override;
+  int deliver(const std::shared_ptr<erizo::DataPacket> &packet, uint8_t flags);
+
+private:
+  std::string bridge_stream_id_;
+  uint32_t stream_id_;
+  std::shared_ptr<BridgeLink> link_;
+
+  // seq_ and the retransmission ring, delivery and NACKs come from different threads
+  std::mutex mux_;
+  uint16_t seq_;
+  std::vector<RtxSlot> rtx_;
+  std::unique_ptr<BridgeFecEncoder> fec_;
+  std::atomic<uint64_t> retransmitted_;
+};
+
+// Receiving end of a multiplexed bridge stream, the publisher of the
+// local OneToManyProcessor in place of a BridgeMediaStream. Detects gaps
+// in the stream seq, rebuilds what FEC parity covers and NACKs the rest
+// towards the sending node, and collapses the NACKs of all local
+// subscribers into one upstream request.
+class BridgeMuxSource : public erizo::MediaSource,
+                        public erizo::FeedbackSink
+{
+  DECLARE_LOGGER();
+
+  struct Missing
+  {
+    uint32_t first_seen;
+    uint32_t last_nack;
+    int retries;
+  };
+
+public:
+  BridgeMuxSource(const std::string &bridge_stream_id, uint32_t video_ssrc, uint32_t audio_ssrc);
+  ~BridgeMuxSource();
+
+  void close() override;
+  int sendPLI() override;
+  void onPacket(const BridgeHeader &header, const char *payload, int len, const struct sockaddr_in &from);
+  void onFec(const BridgeHeader &header, const char *payload, int len, const struct sockaddr_in &from);
+
+  uint32_t getStreamId()
+  {
+    return stream_id_;
+  }
+
+  const std::string &getBridgeStreamId()
+  {
+    return bridge_stream_id_;
+  }
+
+  uint64_t getRecovered() { return recovered_; }
+  uint64_t getLost() { return lost_; }
+  uint64_t getNacksSuppressed() { return nacks_suppressed_; }
+  uint64_t getFecRecovered() { return fec_recovered_; }
+
+private:
+  int deliverFeedback_(std::shared_ptr<erizo::DataPacket> packet) override;
+  void sendFeedback(const char *data, int len);
+  void send(uint8_t type, const char *data, int len);
+  // the first node to deliver owns the stream, false for any other: one
+  // whose bridge_stream_id hashes to the same id is not let in
+  bool setRemote(const struct sockaddr_in &from);
+  // false for a duplicate that must not reach the subscribers again
+  bool trackSeq(uint16_t seq);
+  bool receive(uint16_t seq, uint8_t flags, const char *payload, int len);
+  void recoverFec();
+  // NACKs what is due, gives up on what waited too long
+  void processMissing(uint32_t now);
+  // drops NACKed rtp seqs another subscriber already asked for, returns the new length
+  int filterNacks(char *buf, int len);
+
+private:
+  std::string bridge_stream_id_;
+  uint32_t stream_id_;
+
+  std::mutex remote_mux_;
+  struct sockaddr_in remote_;
+  bool has_remote_;
+
+  // only touched by the BridgeMux receive thread of the sending node
+  bool nack_;
+  bool has_seq_;
+  uint16_t max_seq_;
+  std::map<uint16_t, Missing> missing_;
+  // created by the first parity packet
+  std::unique_ptr<BridgeFecDecoder> fec_;
+
+  // ssrc << 16 | rtp seq -> when it was last NACKed upstream
+  std::mutex nack_mux_;
+  std::unordered_map<uint64_t, uint32_t> downstream_nacks_;
+
+  std::atomic<uint64_t> recovered_;
+  std::atomic<uint64_t> lost_;
+  std::atomic<uint64_t> nacks_suppressed_;
+  std::atomic<uint64_t> fec_recovered_;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include "bridge_pacer.h"
+
+BridgePacer::BridgePacer(uint32_t queue_size) : queued_bytes_(0),
+                                                rate_kbps_(0),
+                                                burst_bytes_(0),
+                                                tokens_(0),
+                                                last_us_(0)
+{
+    // audio and keyframes are a small share of a link
+    uint32_t sizes[BRIDGE_PRIORITY_NUM] = {queue_size / 4, queue_size / 2, queue_size};
+    for (int i = 0; i < BRIDGE_PRIORITY_NUM; i++)
+    {
+        queues_[i].slots.resize(sizes[i] > 16 ? sizes[i] : 16);
+        queues_[i].head = 0;
+        queues_[i].count = 0;
+    }
+}
+
+BridgePacer::~BridgePacer() {}
+
+int BridgePacer::getPriority(const BridgeHeader &header)
+{
+    if (header.flags & BRIDGE_FLAG_AUDIO)
+        return BRIDGE_PRIORITY_AUDIO;
+    // a retransmission is already late, parity is useless once it is
+    if ((header.flags & (BRIDGE_FLAG_KEYFRAME | BRIDGE_FLAG_RTX)) || header.type == BRIDGE_FEC)
+        return BRIDGE_PRIORITY_KEYFRAME;
+    return BRIDGE_PRIORITY_VIDEO;
+}
+
+void BridgePacer::setRate(uint32_t rate_kbps, uint32_t burst_ms)
+{
+    rate_kbps_ = rate_kbps;
+    burst_bytes_ = (double)rate_kbps * burst_ms / 8;
+    if (burst_bytes_ < BRIDGE_MUX_MAX_PACKET)
+        burst_bytes_ = BRIDGE_MUX_MAX_PACKET;
+    if (tokens_ > burst_bytes_)
+        tokens_ = burst_bytes_;
+}
+
+bool BridgePacer::push(int priority, const BridgeHeader &header, const char *payload, int len)
+{
+    Queue &queue = queues_[priority];
+    if (queue.count >= queue.slots.size())
+        return false;
+
+    BridgePacket &packet = queue.slots[(queue.head + queue.count) % queue.slots.size()];
+    header.write(packet.data);
+    memcpy(packet.data + BRIDGE_MUX_HEADER_SIZE, payload, len);
+    packet.length = BRIDGE_MUX_HEADER_SIZE + len;
+    queue.count++;
+    queued_bytes_ += packet.length;
+    return true;
+}
+
+uint32_t BridgePacer::pull(uint64_t now_us, std::vector<BridgePacket> &out, bool paced)
+{
+    if (last_us_ != 0 && now_us > last_us_)
+    {
+        tokens_ += (double)(now_us - last_us_) * rate_kbps_ / 8000;
+        if (tokens_ > burst_bytes_)
+            tokens_ = burst_bytes_;
+    }
+    last_us_ = now_us;
+
+    uint32_t count = 0;
+    for (int i = 0; i < BRIDGE_PRIORITY_NUM && count < out.size(); i++)
+    {
+        Queue &queue = queues_[i];
+        while (queue.count > 0 && count < out.size())
+        {
+            // the bucket may go negative by one packet, audio never waits
+            if (paced && i != BRIDGE_PRIORITY_AUDIO && tokens_ <= 0)
+                return count;
+
+            BridgePacket &packet = queue.slots[queue.head];
+            memcpy(out[count].data, packet.data, packet.length);
+            out[count].length = packet.length;
+            count++;
+
+            tokens_ -= packet.length;
+            queued_bytes_ -= packet.length;
+            queue.head = (queue.head + 1) % queue.slots.size();
+            queue.count--;
+        }
+    }
+    return count;
+}
+
+uint32_t BridgePacer::getQueued()
+{
+    uint32_t count = 0;
+    for (int i = 0; i < BRIDGE_PRIORITY_NUM; i++)
+        count += queues_[i].count;
+    return count;
+}
@@ -0,0 +1,68 @@
+#ifndef BRIDGE_PACER_H
+#define BRIDGE_PACER_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "bridge_packet.h"
+
+enum BridgePriority
+{
+  BRIDGE_PRIORITY_AUDIO = 0,
+  BRIDGE_PRIORITY_KEYFRAME,
+  BRIDGE_PRIORITY_VIDEO,
+  BRIDGE_PRIORITY_NUM
+};
+
+// Token bucket in front of one BridgeLink with a queue per priority.
+// Audio always goes out on the next tick and only borrows from the bucket,
+// keyframes drain before the rest of the video. Not thread safe, the owning
+// link serializes access.
+class BridgePacer
+{
+  struct Queue
+  {
+    std::vector<BridgePacket> slots;
+    uint32_t head;
+    uint32_t count;
+  };
+
+public:
+  BridgePacer(uint32_t queue_size);
+  ~BridgePacer();
+
+  void setRate(uint32_t rate_kbps, uint32_t burst_ms);
+  // false if the priority's queue is full and the packet was dropped
+  bool push(int priority, const BridgeHeader &header, const char *payload, int len);
+  // moves what the bucket allows at now_us into out, unpaced drains all
+  uint32_t pull(uint64_t now_us, std::vector<BridgePacket> &out, bool paced);
+
+  uint32_t getQueued();
+  uint32_t getQueued(int priority)
+  {
+    return queues_[priority].count;
+  }
+
+  uint64_t getQueuedBytes()
+  {
+    return queued_bytes_;
+  }
+
+  uint32_t getRate()
+  {
+    return rate_kbps_;
+  }
+
+  static int getPriority(const BridgeHeader &header);
+
+private:
+  Queue queues_[BRIDGE_PRIORITY_NUM];
+  uint64_t queued_bytes_;
+
+  uint32_t rate_kbps_;
+  double burst_bytes_;
+  double tokens_;
+  uint64_t last_us_;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef BRIDGE_PACKET_H
+#define BRIDGE_PACKET_H
+
+#include <string>
+#include <chrono>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+// Multiplexed bridge datagram, all fields network order:
+//
+//  0                   1                   2                   3
+//  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |ver|   type    |     flags     |         stream seq            |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                  stream id (hash of bridge id)                |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                       send time (ms)                          |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// |                     rtp/rtcp payload ...                      |
+
+#define BRIDGE_MUX_VERSION 1
+#define BRIDGE_MUX_HEADER_SIZE 12
+#define BRIDGE_MUX_MAX_PAYLOAD 1500
+// room for a FEC parity of a full size payload
+#define BRIDGE_MUX_MAX_PACKET (BRIDGE_MUX_HEADER_SIZE + 4 + BRIDGE_MUX_MAX_PAYLOAD)
+#define BRIDGE_REPORT_INTERVAL_MS 100
+#define BRIDGE_REPORT_SIZE 8
+// BRIDGE_NACK payload is a list of lost stream seqs, 2 bytes each
+#define BRIDGE_NACK_MAX_SEQS 64
+
+enum BridgePacketType
+{
+  BRIDGE_MEDIA = 1,    // sender -> receiver
+  BRIDGE_FEEDBACK = 2, // receiver -> sender, rtcp
+  BRIDGE_REPORT = 3,   // receiving node -> sending node, per link, stream id 0
+  BRIDGE_NACK = 4,     // receiver -> sender, lost stream seqs
+  BRIDGE_FEC = 5       // sender -> receiver, xor parity, see bridge_fec.h
+};
+
+enum BridgePacketFlag
+{
+  BRIDGE_FLAG_AUDIO = 0x01,
+  BRIDGE_FLAG_VIDEO = 0x02,
+  BRIDGE_FLAG_KEYFRAME = 0x04,
+  BRIDGE_FLAG_RTX = 0x08 // retransmission, keeps the original seq
+};
+
+struct BridgeHeader
+{
+  uint8_t type;
+  uint8_t flags;
+  uint16_t seq;
+  uint32_t stream_id;
+  uint32_t send_time;
+
+  void write(char *buf) const
+  {
+    buf[0] = (char)((BRIDGE_MUX_VERSION << 6) | (type & 0x3f));
+    buf[1] = (char)flags;
+    uint16_t seq_n = htons(seq);
+    uint32_t stream_id_n = htonl(stream_id);
+    uint32_t send_time_n = htonl(send_time);
+    memcpy(buf + 2, &seq_n, 2);
+    memcpy(buf + 4, &stream_id_n, 4);
+    memcpy(buf + 8, &send_time_n, 4);
+  }
+
+  bool read(const char *buf, int len)
+  {
+    if (len < BRIDGE_MUX_HEADER_SIZE || ((uint8_t)buf[0] >> 6) != BRIDGE_MUX_VERSION)
+      return false;
+    type = (uint8_t)buf[0] & 0x3f;
+    flags = (uint8_t)buf[1];
+    uint16_t seq_n;
+    uint32_t stream_id_n, send_time_n;
+    memcpy(&seq_n, buf + 2, 2);
+    memcpy(&stream_id_n, buf + 4, 4);
+    memcpy(&send_time_n, buf + 8, 4);
+    seq = ntohs(seq_n);
+    stream_id = ntohl(stream_id_n);
+    send_time = ntohl(send_time_n);
+    return true;
+  }
+};
+
+// BRIDGE_REPORT payload: receive rate and queuing delay of one link
+struct BridgeReport
+{
+  uint32_t recv_kbps;
+  uint32_t queue_delay_ms;
+
+  void write(char *buf) const
+  {
+    uint32_t recv_kbps_n = htonl(recv_kbps);
+    uint32_t queue_delay_ms_n = htonl(queue_delay_ms);
+    memcpy(buf, &recv_kbps_n, 4);
+    memcpy(buf + 4, &queue_delay_ms_n, 4);
+  }
+
+  bool read(const char *buf, int len)
+  {
+    if (len < BRIDGE_REPORT_SIZE)
+      return false;
+    uint32_t recv_kbps_n, queue_delay_ms_n;
+    memcpy(&recv_kbps_n, buf, 4);
+    memcpy(&queue_delay_ms_n, buf + 4, 4);
+    recv_kbps = ntohl(recv_kbps_n);
+    queue_delay_ms = ntohl(queue_delay_ms_n);
+    return true;
+  }
+};
+
+struct BridgePacket
+{
+  char data[BRIDGE_MUX_MAX_PACKET];
+  int length;
+};
+
+inline uint64_t bridgeNowUs()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// send_time on the wire, only differences between two packets matter
+inline uint32_t bridgeNowMs()
+{
+  return (uint32_t)(bridgeNowUs() / 1000);
+}
+
+// restamp a queued datagram when it actually leaves, so pacing delay is
+// not mistaken for link delay by the receiver
+inline void bridgeSetSendTime(char *buf, uint32_t send_time)
+{
+  uint32_t send_time_n = htonl(send_time);
+  memcpy(buf + 8, &send_time_n, 4);
+}
+
+// Both nodes derive the same compact id from the bridge_stream_id string
+inline uint32_t bridgeStreamId(const std::string &bridge_stream_id)
+{
+  uint32_t hash = 2166136261U;
+  for (char c : bridge_stream_id)
+    hash = (hash ^ (uint8_t)c) * 16777619U;
+  return hash;
+}
+
+#endif
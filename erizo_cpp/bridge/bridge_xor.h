@@ -0,0 +1,62 @@
+#ifndef BRIDGE_XOR_H
+#define BRIDGE_XOR_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// dst ^= src over len bytes, the FEC parity kernel. Uses the widest vector
+// unit the build targets, 64 bit words otherwise.
+inline void bridgeXor(char *dst, const char *src, int len)
+{
+  int i = 0;
+#if defined(__AVX2__)
+  for (; i + 32 <= len; i += 32)
+  {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(a, b));
+  }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+  for (; i + 16 <= len; i += 16)
+  {
+    __m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(a, b));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 16 <= len; i += 16)
+  {
+    uint8x16_t a = vld1q_u8((const uint8_t *)(dst + i));
+    uint8x16_t b = vld1q_u8((const uint8_t *)(src + i));
+    vst1q_u8((uint8_t *)(dst + i), veorq_u8(a, b));
+  }
+#endif
+  for (; i + 8 <= len; i += 8)
+  {
+    uint64_t a, b;
+    memcpy(&a, dst + i, 8);
+    memcpy(&b, src + i, 8);
+    a ^= b;
+    memcpy(dst + i, &a, 8);
+  }
+  for (; i < len; i++)
+    dst[i] ^= src[i];
+}
+
+// byte at a time reference, for the benchmark
+inline void bridgeXorScalar(char *dst, const char *src, int len)
+{
+  for (int i = 0; i < len; i++)
+    dst[i] ^= src[i];
+}
+
+#endif
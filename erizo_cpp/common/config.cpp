@@ -1,23 +1,94 @@
 #include "config.h"
 
 #include <fstream>
+#include <chrono>
 #include <string.h>
 #include <SdpInfo.h>
 
+#include "utils.h"
+
+// a getInstance() caller is done with a replaced snapshot long before this
+#define CONFIG_RETIRE_GRACE_S 60
+// 24 byte records, 384MB
+#define MAX_TRACE_CAPACITY (16 * 1024 * 1024)
+
 DEFINE_LOGGER(Config, "Config");
-Config *Config::instance_ = nullptr;
+std::atomic<Config *> Config::current_(nullptr);
+std::mutex Config::reload_mux_;
+std::shared_ptr<Config> Config::owner_;
+std::vector<std::pair<std::shared_ptr<Config>, uint64_t>> Config::retired_;
+
 Config::~Config()
 {
 }
 
+static uint64_t nowSeconds()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 Config *Config::getInstance()
 {
-    if (instance_ == nullptr)
-        instance_ = new Config;
-    return instance_;
+    Config *config = current_.load(std::memory_order_acquire);
+    if (config != nullptr)
+        return config;
+
+    std::unique_lock<std::mutex> lock(reload_mux_);
+    if (owner_ == nullptr)
+    {
+        owner_ = std::shared_ptr<Config>(new Config);
+        current_.store(owner_.get(), std::memory_order_release);
+    }
+    return owner_.get();
 }
 
-Config::Config()
+std::shared_ptr<Config> Config::getSnapshot()
+{
+    return getInstance()->shared_from_this();
+}
+
+int Config::reload()
+{
+    std::string config_file = getInstance()->config_file_;
+    std::shared_ptr<Config> next(new Config);
+    if (config_file.empty() || next->init(config_file))
+    {
+        ELOG_ERROR("reload %s failed, keep generation %u", config_file, getInstance()->generation_);
+        return 1;
+    }
+
+    std::unique_lock<std::mutex> lock(reload_mux_);
+    std::shared_ptr<Config> current = owner_;
+    next->generation_ = current->generation_ + 1;
+    if (next->rabbitmq_hostname != current->rabbitmq_hostname ||
+        next->rabbitmq_port != current->rabbitmq_port ||
+        next->erizo_worker_num != current->erizo_worker_num ||
+        next->erizo_io_worker_num != current->erizo_io_worker_num ||
+        next->bridge_io_worker_num != current->bridge_io_worker_num ||
+        next->bridge_multiplex != current->bridge_multiplex ||
+        next->bridge_mux_port_offset != current->bridge_mux_port_offset ||
+        next->bridge_mux_recv_threads != current->bridge_mux_recv_threads ||
+        next->trace_capacity != current->trace_capacity)
+        ELOG_WARN("broker, thread pool, bridge socket or trace settings changed, they apply on restart");
+
+    uint64_t now = nowSeconds();
+    retired_.push_back({current, now});
+    owner_ = next;
+    current_.store(next.get(), std::memory_order_release);
+
+    for (auto it = retired_.begin(); it != retired_.end();)
+    {
+        if (it->first.use_count() == 1 && now - it->second >= CONFIG_RETIRE_GRACE_S)
+            it = retired_.erase(it);
+        else
+            it++;
+    }
+
+    ELOG_INFO("reloaded %s, generation %u, %d older snapshots alive", config_file, next->generation_, (int)retired_.size());
+    return 0;
+}
+
+Config::Config() : generation_(0)
 {
     rabbitmq_username = "linmin";
     rabbitmq_passwd = "linmin";
@@ -44,6 +115,43 @@ Config::Config()
 
     audio_codec = "opus";
     video_codec = "vp8";
+    keyframe_window_ms = 1000;
+    gop_cache_packets = 512;
+    active_speaker_interval_ms = 300;
+    last_n = 0;
+    silence_level = 0;
+    silence_keepalive = 25;
+
+    trace_capacity = 65536;
+
+    bridge_multiplex = false;
+    bridge_mux_port_offset = 1;
+    bridge_mux_batch = 16;
+    bridge_mux_queue = 1024;
+    bridge_mux_recv_threads = 1;
+    bridge_pacer = true;
+    bridge_pacer_start_kbps = 300000;
+    bridge_pacer_min_kbps = 5000;
+    bridge_pacer_max_kbps = 1000000;
+    bridge_pacer_burst_ms = 5;
+    bridge_nack = true;
+    bridge_rtx_buffer = 512;
+    bridge_rebalance_ms = 1000;
+    bridge_rebalance_threshold = 25;
+    bridge_rebalance_passes = 3;
+
+    admission_max_memory_mb = 0;
+    admission_max_egress_mbps = 0;
+    admission_max_worker_load = 0;
+    admission_publisher_memory_kb = 1024;
+    admission_subscriber_memory_kb = 256;
+    admission_subscriber_kbps = 1500;
+    admission_publisher_load = 4;
+    admission_subscriber_load = 2;
+
+    load_report_interval_ms = 2000;
+    load_report_binding_key = "erizo_load";
+    drain_timeout_ms = 300000;
 }
 
 int Config::initConfig(const Json::Value &root)
@@ -86,18 +194,56 @@ int Config::initConfig(const Json::Value &root)
         return 1;
     }
 
-    Json::Value network_interfaces = ice["network_interfaces"];
-    if (network_interfaces.isMember("CTL") &&
-        network_interfaces["CTL"].type() == Json::stringValue)
-        network_interfaces_["CTL"] = network_interfaces["CTL"].asString();
-
-    if (network_interfaces.isMember("CNC") &&
-        network_interfaces["CNC"].type() == Json::stringValue)
-        network_interfaces_["CNC"] = network_interfaces["CNC"].asString();
+    // both 0 leaves ports to the kernel, otherwise the range admission
+    // budgets ice ports against
+    int ice_min_port = ice["min_port"].asInt();
+    int ice_max_port = ice["max_port"].asInt();
+    if ((ice_min_port != 0 || ice_max_port != 0) &&
+        (ice_min_port < 1 || ice_max_port > 65535 || ice_min_port > ice_max_port))
+    {
+        ELOG_ERROR("ice port range check error");
+        return 1;
+    }
 
-    if (network_interfaces.isMember("MOB") &&
-        network_interfaces["MOB"].type() == Json::stringValue)
-        network_interfaces_["MOB"] = network_interfaces["MOB"].asString();
+    // any isp key, one interface or a list of them, each a device name or
+    // a local address; the balancer reads the device's counters
+    Json::Value network_interfaces = ice["network_interfaces"];
+    for (const std::string &isp : network_interfaces.getMemberNames())
+    {
+        Json::Value value = network_interfaces[isp];
+        std::vector<std::string> names;
+        if (value.type() == Json::stringValue)
+        {
+            names.push_back(value.asString());
+        }
+        else if (value.type() == Json::arrayValue)
+        {
+            for (const Json::Value &name : value)
+            {
+                if (name.type() != Json::stringValue)
+                {
+                    ELOG_ERROR("network_interfaces %s check error", isp);
+                    return 1;
+                }
+                names.push_back(name.asString());
+            }
+        }
+        else
+        {
+            ELOG_ERROR("network_interfaces %s check error", isp);
+            return 1;
+        }
+        for (const std::string &name : names)
+        {
+            if (Utils::getInterfaceDevice(name).empty())
+            {
+                ELOG_ERROR("network_interfaces %s: %s is neither an interface nor a local address", isp, name);
+                return 1;
+            }
+        }
+        if (!names.empty())
+            network_interfaces_[isp] = names;
+    }
 
     Json::Value stun = ice["stun"];
     if (!ice.isMember("stun") ||
@@ -158,6 +304,206 @@ int Config::initConfig(const Json::Value &root)
     max_port = ice["max_port"].asInt();
     audio_codec = media["audio_codec"].asString();
     video_codec = media["video_codec"].asString();
+    if (media.isMember("keyframe_window_ms") &&
+        media["keyframe_window_ms"].type() == Json::intValue &&
+        media["keyframe_window_ms"].asInt() >= 0)
+        keyframe_window_ms = media["keyframe_window_ms"].asInt();
+    if (media.isMember("gop_cache_packets") &&
+        media["gop_cache_packets"].type() == Json::intValue &&
+        media["gop_cache_packets"].asInt() >= 0)
+        gop_cache_packets = media["gop_cache_packets"].asInt();
+    if (media.isMember("active_speaker_interval_ms") &&
+        media["active_speaker_interval_ms"].type() == Json::intValue &&
+        media["active_speaker_interval_ms"].asInt() > 0)
+        active_speaker_interval_ms = media["active_speaker_interval_ms"].asInt();
+    if (media.isMember("last_n") &&
+        media["last_n"].type() == Json::intValue &&
+        media["last_n"].asInt() >= 0)
+        last_n = media["last_n"].asInt();
+    if (media.isMember("silence_level") &&
+        media["silence_level"].type() == Json::intValue &&
+        media["silence_level"].asInt() >= 0 &&
+        media["silence_level"].asInt() <= 127)
+        silence_level = media["silence_level"].asInt();
+    if (media.isMember("silence_keepalive") &&
+        media["silence_keepalive"].type() == Json::intValue &&
+        media["silence_keepalive"].asInt() >= 0)
+        silence_keepalive = media["silence_keepalive"].asInt();
+
+    Json::Value isp_video_constraints = media["isp_video_constraints"];
+    if (media.isMember("isp_video_constraints") &&
+        isp_video_constraints.type() == Json::objectValue)
+    {
+        for (const std::string &isp : isp_video_constraints.getMemberNames())
+        {
+            Json::Value constraints = isp_video_constraints[isp];
+            if (constraints.type() != Json::objectValue ||
+                !constraints.isMember("max_width") ||
+                constraints["max_width"].type() != Json::intValue ||
+                !constraints.isMember("max_height") ||
+                constraints["max_height"].type() != Json::intValue ||
+                !constraints.isMember("max_fps") ||
+                constraints["max_fps"].type() != Json::intValue)
+            {
+                ELOG_ERROR("isp_video_constraints %s check error", isp);
+                return 1;
+            }
+            isp_video_constraints_[isp] = {constraints["max_width"].asInt(),
+                                           constraints["max_height"].asInt(),
+                                           constraints["max_fps"].asInt()};
+        }
+    }
+
+    Json::Value trace = root["trace"];
+    if (root.isMember("trace") &&
+        trace.type() == Json::objectValue &&
+        trace.isMember("capacity"))
+    {
+        if (trace["capacity"].type() != Json::intValue ||
+            trace["capacity"].asInt() <= 0 ||
+            trace["capacity"].asInt() > MAX_TRACE_CAPACITY)
+        {
+            ELOG_ERROR("trace capacity check error, 1 to %d records", MAX_TRACE_CAPACITY);
+            return 1;
+        }
+        trace_capacity = trace["capacity"].asInt();
+    }
+
+    Json::Value bridge = root["bridge"];
+    if (root.isMember("bridge") &&
+        bridge.type() == Json::objectValue)
+    {
+        if (bridge.isMember("multiplex") &&
+            bridge["multiplex"].type() == Json::booleanValue)
+            bridge_multiplex = bridge["multiplex"].asBool();
+        if (bridge.isMember("mux_port_offset") &&
+            bridge["mux_port_offset"].type() == Json::intValue)
+            bridge_mux_port_offset = bridge["mux_port_offset"].asInt();
+        if (bridge.isMember("mux_batch") &&
+            bridge["mux_batch"].type() == Json::intValue &&
+            bridge["mux_batch"].asInt() > 0)
+            bridge_mux_batch = bridge["mux_batch"].asInt();
+        if (bridge.isMember("mux_queue") &&
+            bridge["mux_queue"].type() == Json::intValue &&
+            bridge["mux_queue"].asInt() > 0)
+            bridge_mux_queue = bridge["mux_queue"].asInt();
+        if (bridge.isMember("mux_recv_threads") &&
+            bridge["mux_recv_threads"].type() == Json::intValue &&
+            bridge["mux_recv_threads"].asInt() > 0)
+            bridge_mux_recv_threads = bridge["mux_recv_threads"].asInt();
+
+        if (bridge.isMember("nack") &&
+            bridge["nack"].type() == Json::booleanValue)
+            bridge_nack = bridge["nack"].asBool();
+        if (bridge.isMember("rtx_buffer") &&
+            bridge["rtx_buffer"].type() == Json::intValue &&
+            bridge["rtx_buffer"].asInt() > 0)
+            bridge_rtx_buffer = bridge["rtx_buffer"].asInt();
+
+        Json::Value rebalance = bridge["rebalance"];
+        if (bridge.isMember("rebalance") &&
+            rebalance.type() == Json::objectValue)
+        {
+            if (rebalance.isMember("interval_ms") &&
+                rebalance["interval_ms"].type() == Json::intValue &&
+                rebalance["interval_ms"].asInt() >= 0)
+                bridge_rebalance_ms = rebalance["interval_ms"].asInt();
+            if (rebalance.isMember("threshold") &&
+                rebalance["threshold"].type() == Json::intValue &&
+                rebalance["threshold"].asInt() >= 0)
+                bridge_rebalance_threshold = rebalance["threshold"].asInt();
+            if (rebalance.isMember("passes") &&
+                rebalance["passes"].type() == Json::intValue &&
+                rebalance["passes"].asInt() > 0)
+                bridge_rebalance_passes = rebalance["passes"].asInt();
+        }
+
+        Json::Value pacer = bridge["pacer"];
+        if (bridge.isMember("pacer") &&
+            pacer.type() == Json::objectValue)
+        {
+            if (pacer.isMember("enable") &&
+                pacer["enable"].type() == Json::booleanValue)
+                bridge_pacer = pacer["enable"].asBool();
+            if (pacer.isMember("start_kbps") &&
+                pacer["start_kbps"].type() == Json::intValue &&
+                pacer["start_kbps"].asInt() > 0)
+                bridge_pacer_start_kbps = pacer["start_kbps"].asInt();
+            if (pacer.isMember("min_kbps") &&
+                pacer["min_kbps"].type() == Json::intValue &&
+                pacer["min_kbps"].asInt() > 0)
+                bridge_pacer_min_kbps = pacer["min_kbps"].asInt();
+            if (pacer.isMember("max_kbps") &&
+                pacer["max_kbps"].type() == Json::intValue &&
+                pacer["max_kbps"].asInt() > 0)
+                bridge_pacer_max_kbps = pacer["max_kbps"].asInt();
+            if (pacer.isMember("burst_ms") &&
+                pacer["burst_ms"].type() == Json::intValue &&
+                pacer["burst_ms"].asInt() > 0)
+                bridge_pacer_burst_ms = pacer["burst_ms"].asInt();
+        }
+    }
+
+    Json::Value admission = root["admission"];
+    if (root.isMember("admission") &&
+        admission.type() == Json::objectValue)
+    {
+        if (admission.isMember("max_memory_mb") &&
+            admission["max_memory_mb"].type() == Json::intValue &&
+            admission["max_memory_mb"].asInt() >= 0)
+            admission_max_memory_mb = admission["max_memory_mb"].asInt();
+        if (admission.isMember("max_egress_mbps") &&
+            admission["max_egress_mbps"].type() == Json::intValue &&
+            admission["max_egress_mbps"].asInt() >= 0)
+            admission_max_egress_mbps = admission["max_egress_mbps"].asInt();
+        if (admission.isMember("max_worker_load") &&
+            admission["max_worker_load"].type() == Json::intValue &&
+            admission["max_worker_load"].asInt() >= 0)
+            admission_max_worker_load = admission["max_worker_load"].asInt();
+        if (admission.isMember("publisher_memory_kb") &&
+            admission["publisher_memory_kb"].type() == Json::intValue &&
+            admission["publisher_memory_kb"].asInt() >= 0)
+            admission_publisher_memory_kb = admission["publisher_memory_kb"].asInt();
+        if (admission.isMember("subscriber_memory_kb") &&
+            admission["subscriber_memory_kb"].type() == Json::intValue &&
+            admission["subscriber_memory_kb"].asInt() >= 0)
+            admission_subscriber_memory_kb = admission["subscriber_memory_kb"].asInt();
+        if (admission.isMember("subscriber_kbps") &&
+            admission["subscriber_kbps"].type() == Json::intValue &&
+            admission["subscriber_kbps"].asInt() >= 0)
+            admission_subscriber_kbps = admission["subscriber_kbps"].asInt();
+        if (admission.isMember("publisher_load") &&
+            admission["publisher_load"].type() == Json::intValue &&
+            admission["publisher_load"].asInt() >= 0)
+            admission_publisher_load = admission["publisher_load"].asInt();
+        if (admission.isMember("subscriber_load") &&
+            admission["subscriber_load"].type() == Json::intValue &&
+            admission["subscriber_load"].asInt() >= 0)
+            admission_subscriber_load = admission["subscriber_load"].asInt();
+    }
+
+    Json::Value load_report = root["load_report"];
+    if (root.isMember("load_report") &&
+        load_report.type() == Json::objectValue)
+    {
+        if (load_report.isMember("interval_ms") &&
+            load_report["interval_ms"].type() == Json::intValue &&
+            load_report["interval_ms"].asInt() >= 0)
+            load_report_interval_ms = load_report["interval_ms"].asInt();
+        if (load_report.isMember("binding_key") &&
+            load_report["binding_key"].type() == Json::stringValue)
+            load_report_binding_key = load_report["binding_key"].asString();
+    }
+
+    Json::Value drain = root["drain"];
+    if (root.isMember("drain") &&
+        drain.type() == Json::objectValue)
+    {
+        if (drain.isMember("timeout_ms") &&
+            drain["timeout_ms"].type() == Json::intValue &&
+            drain["timeout_ms"].asInt() >= 0)
+            drain_timeout_ms = drain["timeout_ms"].asInt();
+    }
 
     return 0;
 }
@@ -236,6 +582,7 @@ int Config::initMedia(const Json::Value &root)
 
 int Config::init(const std::string &config_file)
 {
+    config_file_ = config_file;
     std::ifstream ifs(config_file, std::ios::binary);
     if (!ifs.is_open())
     {
@@ -3,6 +3,10 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
 
 #include <json/json.h>
 #include <logger.h>
@@ -13,15 +17,38 @@ class ExtMap;
 class RtpMap;
 } // namespace erizo
 
-class Config
+// Upper bound on what simulcast layer a subscriber gets, the bandwidth
+// estimate picks among the layers below it
+struct VideoConstraints
+{
+  int max_width;
+  int max_height;
+  int max_fps;
+};
+
+// Every Config is a snapshot. reload() parses the file into a new one and
+// swaps the current pointer, readers never lock. Whatever has to see the
+// same values for its whole life, a connection, holds the snapshot it was
+// created with; plain getInstance() callers use it briefly, and replaced
+// snapshots nobody holds are only freed a grace period later.
+class Config : public std::enable_shared_from_this<Config>
 {
   DECLARE_LOGGER();
 
 public:
   static Config *getInstance();
+  static std::shared_ptr<Config> getSnapshot();
+  // the file init loaded, into a new snapshot; a broken file leaves the
+  // current one in place
+  static int reload();
   virtual ~Config();
   int init(const std::string &config_file);
 
+  uint32_t getGeneration()
+  {
+    return generation_;
+  }
+
 private:
   Config();
   int initConfig(const Json::Value &root);
@@ -50,7 +77,9 @@ public:
   unsigned short turn_port;
   std::string turn_username;
   std::string turn_passwd;
-  std::map<std::string, std::string> network_interfaces_;
+  // isp -> interface names or addresses, new connections go to the one
+  // with the least measured egress
+  std::map<std::string, std::vector<std::string>> network_interfaces_;
   // other
   unsigned int ice_components;
   bool should_trickle;
@@ -60,12 +89,81 @@ public:
   //Erizo media type
   std::string audio_codec;
   std::string video_codec;
+  // PLI/FIR from subscribers reach a publisher at most once per window
+  unsigned int keyframe_window_ms;
+  // video packets since the last keyframe kept per publisher ssrc for late joiners, 0 disables
+  unsigned int gop_cache_packets;
+  // per ISP key of network_interfaces_, e.g. MOB subscribers capped to a low layer
+  std::map<std::string, VideoConstraints> isp_video_constraints_;
+  // room publishers ranked by audio level this often, video only from the top last_n, 0 forwards all
+  unsigned int active_speaker_interval_ms;
+  unsigned int last_n;
+  // audio quieter than silence_level (-dBov, rfc 6464) is not fanned out but for
+  // one packet in silence_keepalive, 0 forwards everything
+  unsigned int silence_level;
+  unsigned int silence_keepalive;
 
   std::vector<erizo::ExtMap> ext_maps;
   std::vector<erizo::RtpMap> rtp_maps;
 
+  // Signaling trace ring buffer, records
+  unsigned int trace_capacity;
+
+  // Multiplexed bridge, listens on the bridge port + bridge_mux_port_offset
+  bool bridge_multiplex;
+  int bridge_mux_port_offset;
+  unsigned int bridge_mux_batch;
+  unsigned int bridge_mux_queue;
+  // SO_REUSEPORT sockets sharing the mux port, one receive thread each
+  unsigned int bridge_mux_recv_threads;
+  // Token bucket pacer on multiplexed bridge links, rate follows the link estimate
+  bool bridge_pacer;
+  unsigned int bridge_pacer_start_kbps;
+  unsigned int bridge_pacer_min_kbps;
+  unsigned int bridge_pacer_max_kbps;
+  unsigned int bridge_pacer_burst_ms;
+  // NACK/RTX between nodes, packets kept per outbound bridge stream
+  bool bridge_nack;
+  unsigned int bridge_rtx_buffer;
+  // Moving bridges between workers, mux links between the mux workers or
+  // bridge streams between the io workers: one moves once the hottest
+  // worker stayed threshold percent above the mean for passes passes, 0 ms
+  // is off
+  unsigned int bridge_rebalance_ms;
+  unsigned int bridge_rebalance_threshold;
+  unsigned int bridge_rebalance_passes;
+
+  // Admission control, new connections are refused once their estimated
+  // cost would exceed a node budget, 0 is unlimited
+  unsigned int admission_max_memory_mb;
+  unsigned int admission_max_egress_mbps;
+  // percent of one worker, per worker
+  unsigned int admission_max_worker_load;
+  // estimated cost of one connection
+  unsigned int admission_publisher_memory_kb;
+  unsigned int admission_subscriber_memory_kb;
+  unsigned int admission_subscriber_kbps;
+  unsigned int admission_publisher_load;
+  unsigned int admission_subscriber_load;
+
+  // Load summary on the broadcast exchange every interval, 0 disables
+  unsigned int load_report_interval_ms;
+  std::string load_report_binding_key;
+
+  // Drain on SIGTERM or the drain command: how long existing connections
+  // may keep the node up once it stopped taking new ones
+  unsigned int drain_timeout_ms;
+
 private:
-  static Config *instance_;
+  std::string config_file_;
+  uint32_t generation_;
+
+  static std::atomic<Config *> current_;
+  // under reload_mux_
+  static std::mutex reload_mux_;
+  static std::shared_ptr<Config> owner_;
+  // replaced snapshot -> steady clock seconds it was replaced at
+  static std::vector<std::pair<std::shared_ptr<Config>, uint64_t>> retired_;
 };
 
 #endif
\ No newline at end of file
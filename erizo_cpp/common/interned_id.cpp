@@ -0,0 +1,73 @@
+#include "interned_id.h"
+
+const std::string InternedId::empty_;
+std::mutex InternedId::mux_;
+std::unordered_map<std::string, InternedId::Entry *> *InternedId::table_ = new std::unordered_map<std::string, InternedId::Entry *>();
+std::vector<uint32_t> *InternedId::free_handles_ = new std::vector<uint32_t>();
+uint32_t InternedId::next_handle_ = 1;
+
+uint32_t InternedId::newHandle()
+{
+    // recycled handles first, keeps the space dense
+    if (!free_handles_->empty())
+    {
+        uint32_t handle = free_handles_->back();
+        free_handles_->pop_back();
+        return handle;
+    }
+    return next_handle_++;
+}
+
+InternedId::Entry *InternedId::acquire(const std::string &str)
+{
+    if (str.empty())
+        return nullptr;
+
+    std::unique_lock<std::mutex> lock(mux_);
+    auto it = table_->find(str);
+    if (it != table_->end())
+    {
+        it->second->refs++;
+        return it->second;
+    }
+
+    Entry *entry = new Entry;
+    it = table_->insert({str, entry}).first;
+    entry->str = &it->first;
+    entry->handle = newHandle();
+    entry->refs = 1;
+    return entry;
+}
+
+void InternedId::release(Entry *entry)
+{
+    if (entry == nullptr)
+        return;
+
+    // only the last reference takes the lock, acquire() bumps under it
+    int refs = entry->refs.load();
+    while (refs > 1)
+    {
+        if (entry->refs.compare_exchange_weak(refs, refs - 1))
+            return;
+    }
+
+    std::unique_lock<std::mutex> lock(mux_);
+    if (--entry->refs > 0)
+        return;
+    free_handles_->push_back(entry->handle);
+    table_->erase(table_->find(*entry->str));
+    delete entry;
+}
+
+size_t InternedId::getCount()
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    return table_->size();
+}
+
+uint32_t InternedId::getHandleSpace()
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    return next_handle_ - 1;
+}
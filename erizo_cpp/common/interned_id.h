@@ -0,0 +1,126 @@
+#ifndef INTERNED_ID_H
+#define INTERNED_ID_H
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <stdint.h>
+
+// Refcounted handle on one process wide copy of an id string. Every
+// Connection of a node shares its agent/erizo ids and reply queue, and a
+// client or stream id is stored once however many maps and connections
+// refer to it. Copies only touch the refcount.
+//
+// Each live id also owns a dense 32-bit handle, recycled once its last
+// reference is gone. External ids are interned once where they come in
+// over AMQP, past that point maps hash and compare the handle and fan-out
+// keys are built from it, never from the string.
+class InternedId
+{
+  struct Entry
+  {
+    const std::string *str;
+    uint32_t handle;
+    std::atomic<int> refs;
+  };
+
+public:
+  InternedId() : entry_(nullptr) {}
+  InternedId(const std::string &str) : entry_(acquire(str)) {}
+  InternedId(const char *str) : entry_(acquire(str)) {}
+  InternedId(const InternedId &other) : entry_(other.entry_)
+  {
+    if (entry_ != nullptr)
+      entry_->refs++;
+  }
+  InternedId(InternedId &&other) : entry_(other.entry_)
+  {
+    other.entry_ = nullptr;
+  }
+  ~InternedId()
+  {
+    release(entry_);
+  }
+
+  InternedId &operator=(InternedId other)
+  {
+    std::swap(entry_, other.entry_);
+    return *this;
+  }
+
+  const std::string &str() const
+  {
+    return entry_ != nullptr ? *entry_->str : empty_;
+  }
+
+  operator const std::string &() const
+  {
+    return str();
+  }
+
+  bool empty() const
+  {
+    return entry_ == nullptr;
+  }
+
+  // 0 for the empty id, unique among live ids otherwise
+  uint32_t handle() const
+  {
+    return entry_ != nullptr ? entry_->handle : 0;
+  }
+
+  bool operator==(const InternedId &other) const
+  {
+    return entry_ == other.entry_;
+  }
+
+  bool operator!=(const InternedId &other) const
+  {
+    return entry_ != other.entry_;
+  }
+
+  // handle order, stable for the id's lifetime but unrelated to the string
+  bool operator<(const InternedId &other) const
+  {
+    return handle() < other.handle();
+  }
+
+  // ids currently interned, for the benchmarks
+  static size_t getCount();
+  // highest handle handed out so far, the size a table indexed by handle needs
+  static uint32_t getHandleSpace();
+
+private:
+  static Entry *acquire(const std::string &str);
+  static void release(Entry *entry);
+  // under mux_
+  static uint32_t newHandle();
+
+private:
+  Entry *entry_;
+  static const std::string empty_;
+
+  // the key is the only copy of the string, entries point at it; never
+  // freed, ids in other statics may outlive any destructor order
+  static std::mutex mux_;
+  static std::unordered_map<std::string, Entry *> *table_;
+  static std::vector<uint32_t> *free_handles_;
+  static uint32_t next_handle_;
+};
+
+namespace std
+{
+template <>
+struct hash<InternedId>
+{
+  size_t operator()(const InternedId &id) const
+  {
+    return id.handle();
+  }
+};
+} // namespace std
+
+#endif
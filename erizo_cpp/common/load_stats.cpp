@@ -0,0 +1,17 @@
+#include "load_stats.h"
+
+LoadStats::Shard LoadStats::shards_[LOAD_STATS_SHARDS];
+std::atomic<uint32_t> LoadStats::next_shard_(0);
+
+LoadStats::Totals LoadStats::getTotals()
+{
+    Totals totals = {0, 0, 0, 0};
+    for (Shard &s : shards_)
+    {
+        totals.packets_in += s.packets_in.load(std::memory_order_relaxed);
+        totals.bytes_in += s.bytes_in.load(std::memory_order_relaxed);
+        totals.packets_out += s.packets_out.load(std::memory_order_relaxed);
+        totals.bytes_out += s.bytes_out.load(std::memory_order_relaxed);
+    }
+    return totals;
+}
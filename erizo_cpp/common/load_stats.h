@@ -0,0 +1,62 @@
+#ifndef LOAD_STATS_H
+#define LOAD_STATS_H
+
+#include <atomic>
+#include <stdint.h>
+
+#define LOAD_STATS_SHARDS 32
+
+// Node wide media counters, bumped per packet from every delivery thread.
+// A thread always adds to the same cache line, readers sum all of them,
+// so the hot path is a relaxed add nobody else writes to.
+class LoadStats
+{
+  struct alignas(64) Shard
+  {
+    std::atomic<uint64_t> packets_in;
+    std::atomic<uint64_t> bytes_in;
+    std::atomic<uint64_t> packets_out;
+    std::atomic<uint64_t> bytes_out;
+  };
+
+public:
+  struct Totals
+  {
+    uint64_t packets_in;
+    uint64_t bytes_in;
+    uint64_t packets_out;
+    uint64_t bytes_out;
+  };
+
+  // one packet from a publisher or virtual publisher
+  static void onIngress(uint32_t bytes)
+  {
+    Shard &s = shard();
+    s.packets_in.fetch_add(1, std::memory_order_relaxed);
+    s.bytes_in.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  // packets fanned out to subscribers and virtual subscribers
+  static void onEgress(uint32_t packets, uint64_t bytes)
+  {
+    Shard &s = shard();
+    s.packets_out.fetch_add(packets, std::memory_order_relaxed);
+    s.bytes_out.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  // monotonic since start, rates are the difference of two reads
+  static Totals getTotals();
+
+private:
+  static Shard &shard()
+  {
+    static thread_local Shard *shard = &shards_[next_shard_.fetch_add(1) % LOAD_STATS_SHARDS];
+    return *shard;
+  }
+
+private:
+  static Shard shards_[LOAD_STATS_SHARDS];
+  static std::atomic<uint32_t> next_shard_;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "slab_pool.h"
+
+#define SLAB_BLOCKS 64
+#define SLAB_ALIGN 16
+#define SLAB_HEADER 16
+#define SLAB_CLASSES 32
+
+std::atomic<bool> SlabPool::enabled_(true);
+std::atomic<uint64_t> SlabPool::slab_bytes_(0);
+
+static thread_local SlabPool *t_pools[SLAB_CLASSES] = {nullptr};
+
+SlabPool::SlabPool(size_t block_size) : block_size_(block_size),
+                                        free_(nullptr),
+                                        remote_free_(nullptr)
+{
+}
+
+SlabPool *SlabPool::getPool(size_t size_class)
+{
+    SlabPool *&pool = t_pools[size_class];
+    if (pool == nullptr)
+        pool = new SlabPool(SLAB_HEADER + (size_class + 1) * SLAB_ALIGN);
+    return pool;
+}
+
+void *SlabPool::allocate(size_t size)
+{
+    size_t size_class = (size + SLAB_ALIGN - 1) / SLAB_ALIGN - 1;
+    if (size == 0 || size_class >= SLAB_CLASSES || !enabled_)
+    {
+        Block *block = static_cast<Block *>(::operator new(SLAB_HEADER + size));
+        block->owner = nullptr;
+        return reinterpret_cast<char *>(block) + SLAB_HEADER;
+    }
+    return getPool(size_class)->pop();
+}
+
+void SlabPool::deallocate(void *ptr)
+{
+    if (ptr == nullptr)
+        return;
+
+    Block *block = reinterpret_cast<Block *>(static_cast<char *>(ptr) - SLAB_HEADER);
+    SlabPool *owner = block->owner;
+    if (owner == nullptr)
+    {
+        ::operator delete(block);
+        return;
+    }
+
+    size_t size_class = (owner->block_size_ - SLAB_HEADER) / SLAB_ALIGN - 1;
+    if (t_pools[size_class] == owner)
+    {
+        owner->push(block);
+        return;
+    }
+
+    Block *head = owner->remote_free_.load(std::memory_order_relaxed);
+    do
+    {
+        block->next = head;
+    } while (!owner->remote_free_.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void *SlabPool::pop()
+{
+    if (free_ == nullptr)
+        free_ = remote_free_.exchange(nullptr, std::memory_order_acquire);
+    if (free_ == nullptr)
+        refill();
+
+    Block *block = free_;
+    free_ = block->next;
+    block->owner = this;
+    return reinterpret_cast<char *>(block) + SLAB_HEADER;
+}
+
+void SlabPool::push(Block *block)
+{
+    block->next = free_;
+    free_ = block;
+}
+
+void SlabPool::refill()
+{
+    char *slab = static_cast<char *>(::operator new(block_size_ * SLAB_BLOCKS));
+    slab_bytes_ += block_size_ * SLAB_BLOCKS;
+    for (int i = SLAB_BLOCKS - 1; i >= 0; i--)
+        push(reinterpret_cast<Block *>(slab + i * block_size_));
+}
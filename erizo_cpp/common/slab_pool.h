@@ -0,0 +1,94 @@
+#ifndef SLAB_POOL_H
+#define SLAB_POOL_H
+
+#include <new>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed size blocks carved out of 64 block slabs, one pool per size class
+// and thread. The thread that allocates owns the block; frees from any
+// other thread go to the owner's remote list, which the owner takes over
+// whole once its own list runs dry, so neither side ever locks. Pools are
+// never handed back to the system, they live as long as the process.
+class SlabPool
+{
+  struct Block
+  {
+    SlabPool *owner;
+    Block *next;
+  };
+
+public:
+  static void *allocate(size_t size);
+  static void deallocate(void *ptr);
+
+  // off: plain operator new, for before/after comparisons
+  static void setEnabled(bool enabled)
+  {
+    enabled_ = enabled;
+  }
+
+  static uint64_t getSlabBytes()
+  {
+    return slab_bytes_;
+  }
+
+private:
+  SlabPool(size_t block_size);
+  void *pop();
+  void push(Block *block);
+  void refill();
+
+  static SlabPool *getPool(size_t size_class);
+
+private:
+  size_t block_size_;
+  Block *free_;
+  std::atomic<Block *> remote_free_;
+
+  static std::atomic<bool> enabled_;
+  static std::atomic<uint64_t> slab_bytes_;
+};
+
+// std allocator over SlabPool, for allocate_shared and node based
+// containers; anything but a single object goes to operator new
+template <typename T>
+class SlabAllocator
+{
+public:
+  typedef T value_type;
+
+  SlabAllocator() {}
+  template <typename U>
+  SlabAllocator(const SlabAllocator<U> &) {}
+
+  T *allocate(size_t n)
+  {
+    if (n == 1)
+      return static_cast<T *>(SlabPool::allocate(sizeof(T)));
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T *ptr, size_t n)
+  {
+    if (n == 1)
+      SlabPool::deallocate(ptr);
+    else
+      ::operator delete(ptr);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const SlabAllocator<T> &, const SlabAllocator<U> &)
+{
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const SlabAllocator<T> &, const SlabAllocator<U> &)
+{
+  return false;
+}
+
+#endif
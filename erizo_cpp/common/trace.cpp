@@ -0,0 +1,95 @@
+#include "trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <string.h>
+
+DEFINE_LOGGER(Tracer, "Tracer");
+Tracer *Tracer::instance_ = nullptr;
+
+Tracer::Tracer() : mask_(0),
+                   pos_(0)
+{
+}
+
+Tracer::~Tracer() {}
+
+Tracer *Tracer::getInstance()
+{
+    if (instance_ == nullptr)
+        instance_ = new Tracer;
+    return instance_;
+}
+
+void Tracer::init(uint32_t capacity)
+{
+    if (!records_.empty() || capacity == 0)
+        return;
+
+    uint64_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    records_.resize(size);
+    memset(&records_[0], 0, size * sizeof(TraceRecord));
+    mask_ = size - 1;
+}
+
+void Tracer::record(uint64_t trace_id, TraceSpan span, uint64_t start, uint64_t end)
+{
+    if (records_.empty())
+        return;
+
+    TraceRecord &rec = records_[pos_.fetch_add(1, std::memory_order_relaxed) & mask_];
+    rec.trace_id = trace_id;
+    rec.start = start;
+    rec.duration = end > start ? (uint32_t)(end - start) : 0;
+    rec.span = span;
+}
+
+int Tracer::dump(const std::string &file)
+{
+    if (records_.empty())
+        return 1;
+
+    std::ofstream ofs(file, std::ios::binary | std::ios::trunc);
+    if (!ofs.is_open())
+    {
+        ELOG_ERROR("open %s failed", file);
+        return 1;
+    }
+
+    uint64_t pos = pos_.load(std::memory_order_relaxed);
+    uint64_t count = pos < records_.size() ? pos : records_.size();
+
+    TraceFileHeader header;
+    memcpy(header.magic, "ETRC", 4);
+    header.version = 1;
+    header.record_size = sizeof(TraceRecord);
+    header.count = count;
+    header.dropped = pos - count;
+    ofs.write((const char *)&header, sizeof(header));
+
+    for (uint64_t i = pos - count; i < pos; i++)
+        ofs.write((const char *)&records_[i & mask_], sizeof(TraceRecord));
+
+    ELOG_INFO("dump %u trace records to %s", (uint32_t)count, file);
+    return 0;
+}
+
+uint64_t Tracer::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t Tracer::makeId(const std::string &client_id, const std::string &stream_id)
+{
+    // FNV-1a over "client_id/stream_id"
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c : client_id)
+        hash = (hash ^ (uint8_t)c) * 1099511628211ULL;
+    hash = (hash ^ '/') * 1099511628211ULL;
+    for (char c : stream_id)
+        hash = (hash ^ (uint8_t)c) * 1099511628211ULL;
+    return hash;
+}
@@ -0,0 +1,73 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+
+#include <logger.h>
+
+enum TraceSpan
+{
+  TRACE_QUEUE_WAIT = 1,   // amqp receive -> dispatch thread pickup
+  TRACE_PARSE,            // json parse of the command
+  TRACE_DISPATCH,         // command handler
+  TRACE_ICE_GATHER,       // WebRtcConnection::init -> CONN_GATHERED
+  TRACE_SDP_PROCESS,      // setRemoteSdp -> CONN_SDP_PROCESSED
+  TRACE_PUBLISH_QUEUE,    // sendMessage -> send thread pickup
+  TRACE_BROKER_WRITE      // amqp_basic_publish
+};
+
+// One span, 24 bytes on disk.
+#pragma pack(push, 1)
+struct TraceRecord
+{
+  uint64_t trace_id;
+  uint64_t start;
+  uint32_t duration;
+  uint8_t span;
+  uint8_t reserved[3];
+};
+
+// Dump file header, followed by `count` TraceRecord oldest first.
+struct TraceFileHeader
+{
+  char magic[4];
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t count;
+  uint64_t dropped;
+};
+#pragma pack(pop)
+
+// Lock-free ring buffer of signaling spans. Writers from any thread claim a
+// slot with a single fetch_add; old records are overwritten. Timestamps are
+// steady clock microseconds, spans are correlated by makeId(client, stream).
+class Tracer
+{
+  DECLARE_LOGGER();
+
+public:
+  static Tracer *getInstance();
+  ~Tracer();
+
+  void init(uint32_t capacity);
+  void record(uint64_t trace_id, TraceSpan span, uint64_t start, uint64_t end);
+  int dump(const std::string &file);
+
+  static uint64_t now();
+  static uint64_t makeId(const std::string &client_id, const std::string &stream_id);
+
+private:
+  Tracer();
+
+private:
+  std::vector<TraceRecord> records_;
+  uint64_t mask_;
+  std::atomic<uint64_t> pos_;
+
+  static Tracer *instance_;
+};
+
+#endif
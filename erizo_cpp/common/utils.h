@@ -4,6 +4,9 @@
 #include <string>
 #include <stdlib.h>
 #include <unistd.h>
+#include <ifaddrs.h>
+#include <netdb.h>
+#include <net/if.h>
 
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
@@ -27,28 +30,14 @@
 class Utils
 {
   public:
+    // changes into the directory of the executable
     static int initPath()
     {
-        char buf[256] = {0};
-        char filepath[256] = {0};
-        char cmd[256] = {0};
-        FILE *fp = NULL;
-
-        sprintf(filepath, "/proc/%d", getpid());
-        if (chdir(filepath) < 0)
-            return 1;
-
-        snprintf(cmd, 256, "ls -l | grep exe | awk '{print $11}'");
-        if ((fp = popen(cmd, "r")) == nullptr)
-        {
+        char buf[4096] = {0};
+        ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+        if (len <= 0)
             return 1;
-        }
-
-        if (fgets(buf, sizeof(buf) / sizeof(buf[0]), fp) == nullptr)
-        {
-            pclose(fp);
-            return 1;
-        }
+        buf[len] = '\0';
 
         std::string path = buf;
         size_t pos = path.find_last_of('/');
@@ -60,6 +49,35 @@ class Utils
         return 0;
     }
 
+    // the network device name stands for, itself or the one holding that
+    // local address, "" if there is none
+    static std::string getInterfaceDevice(const std::string &name)
+    {
+        if (if_nametoindex(name.c_str()) != 0)
+            return name;
+
+        struct ifaddrs *addrs = nullptr;
+        if (getifaddrs(&addrs) < 0)
+            return "";
+        std::string device;
+        for (struct ifaddrs *it = addrs; it != nullptr; it = it->ifa_next)
+        {
+            if (it->ifa_addr == nullptr ||
+                (it->ifa_addr->sa_family != AF_INET && it->ifa_addr->sa_family != AF_INET6))
+                continue;
+            char host[NI_MAXHOST];
+            socklen_t len = it->ifa_addr->sa_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+            if (getnameinfo(it->ifa_addr, len, host, sizeof(host), nullptr, 0, NI_NUMERICHOST) == 0 &&
+                name == host)
+            {
+                device = it->ifa_name;
+                break;
+            }
+        }
+        freeifaddrs(addrs);
+        return device;
+    }
+
     static std::string getUUID()
     {
         boost::uuids::uuid uuid = boost::uuids::random_generator()();
@@ -1,9 +1,14 @@
 #include "erizo.h"
+#include "load_reporter.h"
+#include "worker_balancer.h"
 
 #include "common/utils.h"
 #include "common/config.h"
+#include "common/trace.h"
+#include "common/slab_pool.h"
 
 #include "model/client.h"
+#include "model/room.h"
 #include "model/connection.h"
 #include "model/bridge_conn.h"
 
@@ -12,11 +17,18 @@
 #include <thread/IOThreadPool.h>
 #include <thread/ThreadPool.h>
 
+#include <future>
+
 DEFINE_LOGGER(Erizo, "Erizo");
 
 Erizo::Erizo() : amqp_uniquecast_(nullptr),
+                 load_reporter_(nullptr),
                  thread_pool_(nullptr),
                  io_thread_pool_(nullptr),
+                 pending_closes_(0),
+                 ready_(false),
+                 draining_(false),
+                 drain_deadline_(0),
                  agent_id_(""),
                  erizo_id_(""),
                  init_(false)
@@ -33,11 +45,11 @@ Erizo *Erizo::getInstance()
     return instance_;
 }
 
-void Erizo::onEvent(const std::string &reply_to, const std::string &msg)
+void Erizo::onEvent(const std::string &reply_to, const std::string &msg, uint64_t trace_id)
 {
     if (!init_)
         return;
-    amqp_uniquecast_->sendMessage(reply_to, reply_to, msg);
+    amqp_uniquecast_->sendMessage(reply_to, reply_to, msg, trace_id);
 }
 
 int Erizo::init(const std::string &agent_id, const std::string &erizo_id, const std::string &ip, uint16_t port)
@@ -49,13 +61,19 @@ int Erizo::init(const std::string &agent_id, const std::string &erizo_id, const
     erizo_id_ = erizo_id;
 
     io_thread_pool_ = std::make_shared<erizo::IOThreadPool>(Config::getInstance()->erizo_io_worker_num);
-    io_thread_pool_->start();
-
     thread_pool_ = std::make_shared<erizo::ThreadPool>(Config::getInstance()->erizo_worker_num);
-    thread_pool_->start();
+    // the pools start while the broker connection is set up
+    std::future<void> pools = std::async(std::launch::async, [this]() {
+        io_thread_pool_->start();
+        thread_pool_->start();
+    });
+
+    ResourceAccountant::getInstance()->init(Config::getInstance()->erizo_worker_num);
 
     amqp_uniquecast_ = std::make_shared<AMQPHelper>();
-    if (amqp_uniquecast_->init(erizo_id_, [this](const std::string &msg) {
+    if (amqp_uniquecast_->init(erizo_id_, [this](const std::string &msg, uint64_t recv_time) {
+            waitReady();
+            uint64_t parse_time = Tracer::now();
             Json::Value root;
             Json::Reader reader(Json::Features::strictMode());
             if (!reader.parse(msg, root))
@@ -80,6 +98,11 @@ int Erizo::init(const std::string &agent_id, const std::string &erizo_id, const
             }
 
             std::string method = data["method"].asString();
+            uint64_t trace_id = getTraceId(method, data);
+            uint64_t dispatch_time = Tracer::now();
+            Tracer::getInstance()->record(trace_id, TRACE_QUEUE_WAIT, recv_time, parse_time);
+            Tracer::getInstance()->record(trace_id, TRACE_PARSE, parse_time, dispatch_time);
+
             if (!method.compare("addPublisher"))
             {
                 addPublisher(data);
@@ -116,15 +139,74 @@ int Erizo::init(const std::string &agent_id, const std::string &erizo_id, const
             {
                 removeVirtualSubscriber(data);
             }
+            else if (!method.compare("setSubscriberLayer"))
+            {
+                setSubscriberLayer(data);
+            }
+            else if (!method.compare("removeRoom"))
+            {
+                removeRoom(data);
+            }
+            else if (!method.compare("getHeadroom"))
+            {
+                getHeadroom(data);
+            }
+            else if (!method.compare("drain"))
+            {
+                startDrain(data);
+            }
+            else if (!method.compare("reloadConfig"))
+            {
+                reloadConfig(data);
+            }
+            Tracer::getInstance()->record(trace_id, TRACE_DISPATCH, dispatch_time, Tracer::now());
         }))
     {
         ELOG_ERROR("amqp initialize failed");
         return 1;
     }
+    pools.get();
+    WorkerBalancer::getInstance()->init(io_thread_pool_, Config::getInstance()->erizo_io_worker_num);
+
+    if (Config::getInstance()->load_report_interval_ms > 0)
+    {
+        load_reporter_ = std::make_shared<LoadReporter>();
+        load_reporter_->init(amqp_uniquecast_, agent_id_, erizo_id_,
+                             thread_pool_, Config::getInstance()->erizo_worker_num,
+                             io_thread_pool_, Config::getInstance()->erizo_io_worker_num);
+    }
     init_ = true;
     return 0;
 }
 
+void Erizo::waitReady()
+{
+    if (ready_)
+        return;
+    std::unique_lock<std::mutex> lock(ready_mux_);
+    ready_cond_.wait(lock, [this]() { return (bool)ready_; });
+}
+
+void Erizo::ready(uint64_t startup_us)
+{
+    if (!init_)
+        return;
+
+    {
+        std::unique_lock<std::mutex> lock(ready_mux_);
+        ready_ = true;
+        ready_cond_.notify_all();
+    }
+
+    Json::FastWriter writer;
+    Json::Value msg;
+    msg["data"]["type"] = "ready";
+    msg["data"]["agentId"] = agent_id_.str();
+    msg["data"]["erizoId"] = erizo_id_.str();
+    msg["data"]["startupMs"] = (Json::UInt64)(startup_us / 1000);
+    amqp_uniquecast_->broadcastMessage(Config::getInstance()->load_report_binding_key, writer.write(msg));
+}
+
 void Erizo::addSubscriber(const Json::Value &root)
 {
     if (!root.isMember("args") ||
@@ -148,36 +230,52 @@ void Erizo::addSubscriber(const Json::Value &root)
         ELOG_ERROR("json parse args type failed,dump %s", Utils::dumpJson(root));
         return;
     }
-    std::string client_id = args[0].asString();
-    std::string stream_id = args[1].asString();
+    InternedId client_id = args[0].asString();
+    InternedId stream_id = args[1].asString();
     std::string stream_label = args[2].asString();
     std::string reply_to = args[3].asString();
     std::string isp = args[4].asString();
 
-    std::shared_ptr<Client> client = getOrCreateClient(client_id);
+    // a retry replaces the subscriber before it, whose budget goes back
+    // before the new one is admitted
+    auto itc = clients_.find(client_id);
+    if (itc != clients_.end() && getSubscribeConn(itc->second, stream_id) != nullptr)
+    {
+        ELOG_WARN("client-->%s stream-->%s subscribed again, the old subscriber is closed", client_id.str(), stream_id.str());
+        removeSubscriber(client_id, stream_id);
+    }
+
     std::shared_ptr<Connection> pub_conn = getPublishConn(stream_id);
+    std::shared_ptr<BridgeConn> bridge_conn = getBridgeConn(stream_id);
+    if ((pub_conn != nullptr || bridge_conn != nullptr) &&
+        !admit(RESOURCE_SUBSCRIBER, reply_to, client_id, stream_id))
+        return;
+
+    std::shared_ptr<Client> client = getOrCreateClient(client_id);
     if (pub_conn != nullptr)
     {
-        std::shared_ptr<Connection> sub_conn = std::make_shared<Connection>();
+        std::shared_ptr<Connection> sub_conn = std::allocate_shared<Connection>(SlabAllocator<Connection>());
         sub_conn->setConnectionListener(this);
         sub_conn->init(agent_id_, erizo_id_, client_id, stream_id, stream_label, false, reply_to, isp, thread_pool_, io_thread_pool_);
+        sub_conn->setResourceCost(ResourceAccountant::getInstance()->reserve(RESOURCE_SUBSCRIBER, sub_conn->getWorker().get()));
 
-        pub_conn->addSubscriber(client_id, sub_conn->getMediaStream());
+        pub_conn->addSubscriber(client_id, sub_conn);
         client->subscribers[stream_id] = sub_conn;
     }
-    else
+    else if (bridge_conn != nullptr)
     {
-        std::shared_ptr<BridgeConn> bridge_conn = getBridgeConn(stream_id);
-        if (bridge_conn != nullptr)
-        {
-            std::shared_ptr<Connection> sub_conn = std::make_shared<Connection>();
-            sub_conn->setConnectionListener(this);
-            sub_conn->init(agent_id_, erizo_id_, client_id, stream_id, stream_label, false, reply_to, isp, thread_pool_, io_thread_pool_);
+        std::shared_ptr<Connection> sub_conn = std::allocate_shared<Connection>(SlabAllocator<Connection>());
+        sub_conn->setConnectionListener(this);
+        sub_conn->init(agent_id_, erizo_id_, client_id, stream_id, stream_label, false, reply_to, isp, thread_pool_, io_thread_pool_);
+        sub_conn->setResourceCost(ResourceAccountant::getInstance()->reserve(RESOURCE_SUBSCRIBER, sub_conn->getWorker().get()));
 
-            bridge_conn->addSubscriber(client_id, sub_conn->getMediaStream());
-            client->subscribers[stream_id] = sub_conn;
-        }
+        bridge_conn->addSubscriber(client_id, sub_conn);
+        client->subscribers[stream_id] = sub_conn;
     }
+
+    std::shared_ptr<Room> room = getStreamRoom(stream_id);
+    if (room != nullptr && getSubscribeConn(client, stream_id) != nullptr)
+        room->subscribers.insert({client_id, stream_id});
 }
 
 void Erizo::removeSubscriber(const Json::Value &root)
@@ -200,9 +298,13 @@ void Erizo::removeSubscriber(const Json::Value &root)
         ELOG_ERROR("json parse args type failed,dump %s", Utils::dumpJson(root));
         return;
     }
-    std::string client_id = args[0].asString();
-    std::string stream_id = args[1].asString();
+    InternedId client_id = args[0].asString();
+    InternedId stream_id = args[1].asString();
+    removeSubscriber(client_id, stream_id);
+}
 
+void Erizo::removeSubscriber(const InternedId &client_id, const InternedId &stream_id)
+{
     std::shared_ptr<Connection> pub_conn = getPublishConn(stream_id);
     if (pub_conn != nullptr)
         pub_conn->removeSubscriber(client_id);
@@ -215,10 +317,16 @@ void Erizo::removeSubscriber(const Json::Value &root)
     std::shared_ptr<Connection> sub_conn = getSubscribeConn(client, stream_id);
     if (sub_conn != nullptr)
     {
+        std::shared_ptr<Room> room = getStreamRoom(stream_id);
+        if (room != nullptr)
+        {
+            room->subscribers.erase({client_id, stream_id});
+            releaseRoom(room);
+        }
+
         client->subscribers.erase(stream_id);
-        if (client->publishers.size() == 0 && client->subscribers.size() == 0)
-            clients_.erase(client->id);
-        sub_conn->close();
+        releaseClient(client);
+        closeConnection(sub_conn);
     }
 }
 
@@ -247,19 +355,28 @@ void Erizo::addPublisher(const Json::Value &root)
         return;
     }
 
-    std::string room_id = args[0].asString();
-    std::string client_id = args[1].asString();
-    std::string stream_id = args[2].asString();
+    InternedId room_id = args[0].asString();
+    InternedId client_id = args[1].asString();
+    InternedId stream_id = args[2].asString();
     std::string label = args[3].asString();
     std::string reply_to = args[4].asString();
     std::string isp = args[5].asString();
 
+    if (!admit(RESOURCE_PUBLISHER, reply_to, client_id, stream_id))
+        return;
+
     std::shared_ptr<Client> client = getOrCreateClient(client_id);
-    std::shared_ptr<Connection> conn = std::make_shared<Connection>();
+    std::shared_ptr<Connection> conn = std::allocate_shared<Connection>(SlabAllocator<Connection>());
     conn->setConnectionListener(this);
     conn->setRoomId(room_id);
     conn->init(agent_id_, erizo_id_, client_id, stream_id, label, true, reply_to, isp, thread_pool_, io_thread_pool_);
+    conn->setResourceCost(ResourceAccountant::getInstance()->reserve(RESOURCE_PUBLISHER, conn->getWorker().get()));
     client->publishers[stream_id] = conn;
+
+    std::shared_ptr<Room> room = getOrCreateRoom(room_id);
+    room->publishers[stream_id] = client_id;
+    conn->setSpeakerDetector(room->speakers);
+    stream_rooms_[stream_id] = room_id;
 }
 
 void Erizo::addVirtualPublisher(const Json::Value &root)
@@ -286,19 +403,37 @@ void Erizo::addVirtualPublisher(const Json::Value &root)
         return;
     }
 
-    std::string bridge_stream_id = args[0].asString();
-    std::string src_stream_id = args[1].asString();
+    InternedId bridge_stream_id = args[0].asString();
+    InternedId src_stream_id = args[1].asString();
     std::string ip = args[2].asString();
     uint16_t port = args[3].asInt();
     uint32_t video_ssrc = args[4].asUInt();
     uint32_t audio_ssrc = args[5].asUInt();
+    // optional, lets removeRoom reach the cascaded stream and its subscribers
+    InternedId room_id;
+    if (args.size() > 6 && args[6].type() == Json::stringValue)
+        room_id = args[6].asString();
 
     std::shared_ptr<BridgeConn> bridge_conn = getBridgeConn(src_stream_id);
     if (bridge_conn == nullptr)
     {
+        if (!admit(RESOURCE_BRIDGE_IN, "", InternedId(), src_stream_id))
+            return;
+
         bridge_conn = std::make_shared<BridgeConn>();
-        bridge_conn->init(bridge_stream_id, src_stream_id, ip, port, io_thread_pool_, false, video_ssrc, audio_ssrc);
+        if (bridge_conn->init(bridge_stream_id, src_stream_id, ip, port, io_thread_pool_, false, video_ssrc, audio_ssrc))
+        {
+            ELOG_ERROR("virtual publisher %s init failed", bridge_stream_id.str());
+            return;
+        }
+        bridge_conn->setResourceCost(ResourceAccountant::getInstance()->reserve(RESOURCE_BRIDGE_IN, nullptr));
         bridge_conns_[src_stream_id] = bridge_conn;
+
+        if (!room_id.empty())
+        {
+            getOrCreateRoom(room_id)->bridges.insert(src_stream_id);
+            stream_rooms_[src_stream_id] = room_id;
+        }
     }
 }
 
@@ -323,23 +458,34 @@ void Erizo::removeVirtualPublisher(const Json::Value &root)
         return;
     }
 
-    std::string src_stream_id = args[0].asString();
+    InternedId src_stream_id = args[0].asString();
     std::shared_ptr<BridgeConn> bridge_conn = getBridgeConn(src_stream_id);
     if (bridge_conn != nullptr)
     {
+        std::shared_ptr<Room> room = getStreamRoom(src_stream_id);
         std::vector<std::shared_ptr<Client>> sub_clients = getSubscribers(src_stream_id);
         for (std::shared_ptr<Client> sub_client : sub_clients)
         {
             std::shared_ptr<Connection> sub_conn = getSubscribeConn(sub_client, src_stream_id);
             if (sub_conn != nullptr)
             {
+                if (room != nullptr)
+                    room->subscribers.erase({sub_client->id, src_stream_id});
                 sub_client->subscribers.erase(src_stream_id);
-                sub_conn->close();
+                bridge_conn->removeSubscriber(sub_client->id);
+                closeConnection(sub_conn);
             }
         }
 
+        if (room != nullptr)
+        {
+            room->bridges.erase(src_stream_id);
+            stream_rooms_.erase(src_stream_id);
+            releaseRoom(room);
+        }
+
         bridge_conns_.erase(src_stream_id);
-        bridge_conn->close();
+        closeBridgeConn(bridge_conn);
     }
 }
 
@@ -367,24 +513,58 @@ void Erizo::addVirtualSubscriber(const Json::Value &root)
         return;
     }
 
-    std::string bridge_stream_id = args[0].asString();
-    std::string src_stream_id = args[1].asString();
+    InternedId bridge_stream_id = args[0].asString();
+    InternedId src_stream_id = args[1].asString();
     std::string ip = args[2].asString();
     uint16_t port = args[3].asInt();
+    // optional parity group size for lossy long haul links, multiplexed bridges only
+    uint32_t fec_group = 0;
+    if (args.size() > 4 && args[4].type() == Json::intValue && args[4].asInt() > 0)
+        fec_group = args[4].asInt();
 
-    std::shared_ptr<BridgeConn> bridge_conn = getBridgeConn(bridge_stream_id);
-    if (bridge_conn == nullptr)
+    if (bridge_aliases_.find(bridge_stream_id) != bridge_aliases_.end())
+        return;
+    // not even onto a shared bridge, it would hold the drain up
+    if (draining_)
     {
-        std::shared_ptr<Connection> pub_conn = getPublishConn(src_stream_id);
-        if (pub_conn == nullptr)
-            return;
+        ELOG_WARN("stream-->%s bridge refused, draining", src_stream_id.str());
+        return;
+    }
 
-        bridge_conn = std::make_shared<BridgeConn>();
-        bridge_conn->init(bridge_stream_id, src_stream_id, ip, port, io_thread_pool_, true);
+    // The same stream towards the same node rides on one outbound bridge,
+    // the receiving node keeps a single virtual publisher per src_stream_id.
+    // Later requests share the FEC setting of the first one.
+    std::string dest = src_stream_id.str() + "@" + ip + ":" + std::to_string(port);
+    auto it = bridge_dests_.find(dest);
+    if (it != bridge_dests_.end())
+    {
+        it->second.second++;
+        bridge_aliases_[bridge_stream_id] = dest;
+        ELOG_DEBUG("virtual subscriber %s shares bridge %s, refs %d", bridge_stream_id.str(), it->second.first.str(), it->second.second);
+        return;
+    }
 
-        pub_conn->addSubscriber(bridge_stream_id, bridge_conn->getBridgeMediaStream());
-        bridge_conns_[bridge_stream_id] = bridge_conn;
+    std::shared_ptr<Connection> pub_conn = getPublishConn(src_stream_id);
+    if (pub_conn == nullptr || !admit(RESOURCE_BRIDGE_OUT, "", InternedId(), src_stream_id))
+        return;
+
+    std::shared_ptr<BridgeConn> bridge_conn = std::make_shared<BridgeConn>();
+    if (bridge_conn->init(bridge_stream_id, src_stream_id, ip, port, io_thread_pool_, true, 0, 0, fec_group))
+    {
+        ELOG_ERROR("virtual subscriber %s init failed", bridge_stream_id.str());
+        return;
     }
+    bridge_conn->setResourceCost(ResourceAccountant::getInstance()->reserve(RESOURCE_BRIDGE_OUT, nullptr));
+
+    pub_conn->addSubscriber(bridge_stream_id, bridge_conn->getMediaSink());
+    bridge_conn->setSource(pub_conn);
+    bridge_conns_[bridge_stream_id] = bridge_conn;
+    bridge_dests_[dest] = {bridge_stream_id, 1};
+    bridge_aliases_[bridge_stream_id] = dest;
+
+    std::shared_ptr<Room> room = getStreamRoom(src_stream_id);
+    if (room != nullptr)
+        room->bridges.insert(bridge_stream_id);
 }
 
 void Erizo::removeVirtualSubscriber(const Json::Value &root)
@@ -409,18 +589,37 @@ void Erizo::removeVirtualSubscriber(const Json::Value &root)
         return;
     }
 
-    std::string bridge_stream_id = args[0].asString();
-    std::string src_stream_id = args[1].asString();
+    InternedId bridge_stream_id = args[0].asString();
+    InternedId src_stream_id = args[1].asString();
+
+    auto ita = bridge_aliases_.find(bridge_stream_id);
+    if (ita == bridge_aliases_.end())
+        return;
+    auto it = bridge_dests_.find(ita->second);
+    bridge_aliases_.erase(ita);
+    if (it == bridge_dests_.end() || --it->second.second > 0)
+        return;
+
+    // last virtual subscriber gone, the bridge is keyed by the first one's id
+    InternedId key = it->second.first;
+    bridge_dests_.erase(it);
 
     std::shared_ptr<Connection> pub_conn = getPublishConn(src_stream_id);
     if (pub_conn != nullptr)
-        pub_conn->removeSubscriber(bridge_stream_id);
+        pub_conn->removeSubscriber(key);
 
-    std::shared_ptr<BridgeConn> bridge_conn = getBridgeConn(bridge_stream_id);
+    std::shared_ptr<BridgeConn> bridge_conn = getBridgeConn(key);
     if (bridge_conn != nullptr)
     {
-        bridge_conns_.erase(bridge_stream_id);
-        bridge_conn->close();
+        std::shared_ptr<Room> room = getStreamRoom(src_stream_id);
+        if (room != nullptr)
+        {
+            room->bridges.erase(key);
+            releaseRoom(room);
+        }
+
+        bridge_conns_.erase(key);
+        closeBridgeConn(bridge_conn);
     }
 }
 
@@ -445,35 +644,49 @@ void Erizo::removePublisher(const Json::Value &root)
         ELOG_ERROR("json parse args type failed,dump %s", Utils::dumpJson(root));
         return;
     }
-    std::string client_id = args[0].asString();
-    std::string stream_id = args[1].asString();
+    InternedId client_id = args[0].asString();
+    InternedId stream_id = args[1].asString();
 
     std::shared_ptr<Client> pub_client = getOrCreateClient(client_id);
     std::shared_ptr<Connection> pub_conn = getPublishConn(pub_client, stream_id);
     if (pub_conn != nullptr)
     {
+        std::shared_ptr<Room> room = getStreamRoom(stream_id);
         std::vector<std::shared_ptr<Client>> sub_clients = getSubscribers(stream_id);
         for (std::shared_ptr<Client> sub_client : sub_clients)
         {
             std::shared_ptr<Connection> sub_conn = getSubscribeConn(sub_client, stream_id);
             if (sub_conn != nullptr)
             {
+                if (room != nullptr)
+                    room->subscribers.erase({sub_client->id, stream_id});
                 sub_client->subscribers.erase(stream_id);
-                sub_conn->close();
+                pub_conn->removeSubscriber(sub_client->id);
+                closeConnection(sub_conn);
             }
         }
 
         std::vector<std::shared_ptr<BridgeConn>> bridge_conns = getBridgeConns(stream_id);
         for (std::shared_ptr<BridgeConn> bridge_conn : bridge_conns)
         {
+            pub_conn->removeSubscriber(bridge_conn->getBridgeStreamId());
+            if (room != nullptr)
+                room->bridges.erase(bridge_conn->getBridgeStreamId());
             bridge_conns_.erase(bridge_conn->getBridgeStreamId());
-            bridge_conn->close();
+            releaseBridgeDest(bridge_conn->getBridgeStreamId());
+            closeBridgeConn(bridge_conn);
+        }
+
+        if (room != nullptr)
+        {
+            room->publishers.erase(stream_id);
+            stream_rooms_.erase(stream_id);
+            releaseRoom(room);
         }
 
         pub_client->publishers.erase(stream_id);
-        if (pub_client->publishers.size() == 0 && pub_client->subscribers.size() == 0)
-            clients_.erase(pub_client->id);
-        pub_conn->close();
+        releaseClient(pub_client);
+        closeConnection(pub_conn);
     }
 }
 
@@ -482,10 +695,31 @@ void Erizo::close()
     if (!init_)
         return;
 
+    if (load_reporter_ != nullptr)
+    {
+        load_reporter_->close();
+        load_reporter_.reset();
+        load_reporter_ = nullptr;
+    }
+    WorkerBalancer::getInstance()->close();
+
+    // a dispatch still held back must not keep the broker connection open
+    {
+        std::unique_lock<std::mutex> lock(ready_mux_);
+        ready_ = true;
+        ready_cond_.notify_all();
+    }
     amqp_uniquecast_->close();
     amqp_uniquecast_.reset();
     amqp_uniquecast_ = nullptr;
 
+    // let closes already posted to the workers finish before stopping them
+    {
+        std::unique_lock<std::mutex> lock(close_mux_);
+        if (!close_cond_.wait_for(lock, std::chrono::seconds(5), [this]() { return pending_closes_ == 0; }))
+            ELOG_WARN("%d connections still closing", (int)pending_closes_);
+    }
+
     thread_pool_->close();
     thread_pool_.reset();
     thread_pool_ = nullptr;
@@ -496,13 +730,55 @@ void Erizo::close()
 
     clients_.clear();
     bridge_conns_.clear();
+    bridge_dests_.clear();
+    bridge_aliases_.clear();
+    rooms_.clear();
+    stream_rooms_.clear();
 
     agent_id_ = "";
     erizo_id_ = "";
+    draining_ = false;
+    ready_ = false;
 
     init_ = false;
 }
 
+void Erizo::setSubscriberLayer(const Json::Value &root)
+{
+    if (!root.isMember("args") ||
+        root["args"].type() != Json::arrayValue)
+    {
+        ELOG_ERROR("json parse args failed,dump %s", Utils::dumpJson(root));
+        return;
+    }
+    if (root["args"].size() < 4)
+    {
+        ELOG_ERROR("json parse args num failed,dump %s", Utils::dumpJson(root));
+        return;
+    }
+    Json::Value args = root["args"];
+    if (args[0].type() != Json::stringValue ||
+        args[1].type() != Json::stringValue ||
+        !args[2].isInt() ||
+        !args[3].isInt())
+    {
+        ELOG_ERROR("json parse args type failed,dump %s", Utils::dumpJson(root));
+        return;
+    }
+    InternedId client_id = args[0].asString();
+    InternedId stream_id = args[1].asString();
+    int spatial_layer = args[2].asInt();
+    int temporal_layer = args[3].asInt();
+
+    auto it = clients_.find(client_id);
+    if (it == clients_.end())
+        return;
+
+    std::shared_ptr<Connection> sub_conn = getSubscribeConn(it->second, stream_id);
+    if (sub_conn == nullptr || sub_conn->setQualityLayer(spatial_layer, temporal_layer))
+        ELOG_WARN("client-->%s stream-->%s no subscriber to set layer", client_id.str(), stream_id.str());
+}
+
 void Erizo::processSignaling(const Json::Value &root)
 {
     if (!root.isMember("args") ||
@@ -528,8 +804,8 @@ void Erizo::processSignaling(const Json::Value &root)
         return;
     }
 
-    std::string client_id = args[0].asString();
-    std::string stream_id = args[1].asString();
+    InternedId client_id = args[0].asString();
+    InternedId stream_id = args[1].asString();
     Json::Value msg = args[2];
 
     std::shared_ptr<Client> client = getOrCreateClient(client_id);
@@ -590,7 +866,363 @@ void Erizo::processSignaling(const Json::Value &root)
     }
 }
 
-std::shared_ptr<Connection> Erizo::getPublishConn(const std::string &stream_id)
+void Erizo::removeRoom(const Json::Value &root)
+{
+    if (!root.isMember("args") ||
+        root["args"].type() != Json::arrayValue)
+    {
+        ELOG_ERROR("json parse args failed,dump %s", Utils::dumpJson(root));
+        return;
+    }
+    if (root["args"].size() < 1)
+    {
+        ELOG_ERROR("json parse args num failed,dump %s", Utils::dumpJson(root));
+        return;
+    }
+
+    Json::Value args = root["args"];
+    if (args[0].type() != Json::stringValue)
+    {
+        ELOG_ERROR("json parse args type failed,dump %s", Utils::dumpJson(root));
+        return;
+    }
+
+    InternedId room_id = args[0].asString();
+    auto itr = rooms_.find(room_id);
+    if (itr == rooms_.end())
+        return;
+    std::shared_ptr<Room> room = itr->second;
+    rooms_.erase(itr);
+
+    // Drop all bookkeeping in one pass, then close outside of it. Like
+    // removePublisher, every subscriber and outbound bridge leaves its
+    // publisher's fan-out right here: the closes run later on other
+    // workers, a publisher must not deliver into a stream closing there.
+    std::vector<std::shared_ptr<Connection>> conns;
+    std::vector<std::shared_ptr<BridgeConn>> bridges;
+    std::set<InternedId> touched_clients;
+
+    for (auto &sub : room->subscribers)
+    {
+        auto it = clients_.find(sub.first);
+        if (it == clients_.end())
+            continue;
+        std::shared_ptr<Connection> sub_conn = getSubscribeConn(it->second, sub.second);
+        if (sub_conn != nullptr)
+        {
+            std::shared_ptr<Connection> pub_conn = getRoomPublishConn(room, sub.second);
+            std::shared_ptr<BridgeConn> bridge_conn = pub_conn == nullptr ? getBridgeConn(sub.second) : nullptr;
+            if (pub_conn != nullptr)
+                pub_conn->removeSubscriber(sub.first);
+            else if (bridge_conn != nullptr)
+                bridge_conn->removeSubscriber(sub.first);
+
+            it->second->subscribers.erase(sub.second);
+            conns.push_back(sub_conn);
+        }
+        touched_clients.insert(sub.first);
+    }
+
+    for (const InternedId &key : room->bridges)
+    {
+        std::shared_ptr<BridgeConn> bridge_conn = getBridgeConn(key);
+        if (bridge_conn == nullptr || !bridge_conn->isSend())
+            continue;
+        std::shared_ptr<Connection> pub_conn = getRoomPublishConn(room, bridge_conn->getSrcStreamId());
+        if (pub_conn != nullptr)
+            pub_conn->removeSubscriber(key);
+    }
+
+    for (auto &pub : room->publishers)
+    {
+        auto it = clients_.find(pub.second);
+        if (it != clients_.end())
+        {
+            std::shared_ptr<Connection> pub_conn = getPublishConn(it->second, pub.first);
+            if (pub_conn != nullptr)
+            {
+                it->second->publishers.erase(pub.first);
+                conns.push_back(pub_conn);
+            }
+            touched_clients.insert(pub.second);
+        }
+        stream_rooms_.erase(pub.first);
+    }
+
+    for (const InternedId &key : room->bridges)
+    {
+        std::shared_ptr<BridgeConn> bridge_conn = getBridgeConn(key);
+        if (bridge_conn != nullptr)
+        {
+            bridge_conns_.erase(key);
+            releaseBridgeDest(key);
+            bridges.push_back(bridge_conn);
+        }
+        stream_rooms_.erase(key);
+    }
+
+    for (const InternedId &client_id : touched_clients)
+    {
+        auto it = clients_.find(client_id);
+        if (it != clients_.end())
+            releaseClient(it->second);
+    }
+
+    for (std::shared_ptr<BridgeConn> bridge_conn : bridges)
+        closeBridgeConn(bridge_conn);
+
+    for (std::shared_ptr<Connection> conn : conns)
+        closeConnection(conn);
+
+    ELOG_INFO("room %s removed, %d connections %d bridges", room_id.str(), (int)conns.size(), (int)bridges.size());
+}
+
+void Erizo::getHeadroom(const Json::Value &root)
+{
+    if (!root.isMember("args") ||
+        root["args"].type() != Json::arrayValue)
+    {
+        ELOG_ERROR("json parse args failed,dump %s", Utils::dumpJson(root));
+        return;
+    }
+    if (root["args"].size() < 1)
+    {
+        ELOG_ERROR("json parse args num failed,dump %s", Utils::dumpJson(root));
+        return;
+    }
+
+    Json::Value args = root["args"];
+    if (args[0].type() != Json::stringValue)
+    {
+        ELOG_ERROR("json parse args type failed,dump %s", Utils::dumpJson(root));
+        return;
+    }
+
+    std::string reply_to = args[0].asString();
+    Json::Value data;
+    data["type"] = "headroom";
+    data["agentId"] = agent_id_.str();
+    data["erizoId"] = erizo_id_.str();
+    data["headroom"] = ResourceAccountant::getInstance()->getHeadroom();
+    sendReply(reply_to, data, 0);
+}
+
+void Erizo::startDrain(const Json::Value &root)
+{
+    // args are optional, [timeout_ms]
+    uint32_t timeout_ms = Config::getInstance()->drain_timeout_ms;
+    if (root.isMember("args") &&
+        root["args"].type() == Json::arrayValue &&
+        root["args"].size() > 0)
+    {
+        Json::Value args = root["args"];
+        if (args[0].type() != Json::intValue || args[0].asInt() < 0)
+        {
+            ELOG_ERROR("json parse args type failed,dump %s", Utils::dumpJson(root));
+            return;
+        }
+        timeout_ms = args[0].asInt();
+    }
+    drain(timeout_ms);
+}
+
+void Erizo::reloadConfig(const Json::Value &root)
+{
+    // args are optional, [reply_to]
+    std::string reply_to;
+    if (root.isMember("args") &&
+        root["args"].type() == Json::arrayValue &&
+        root["args"].size() > 0)
+    {
+        Json::Value args = root["args"];
+        if (args[0].type() != Json::stringValue)
+        {
+            ELOG_ERROR("json parse args type failed,dump %s", Utils::dumpJson(root));
+            return;
+        }
+        reply_to = args[0].asString();
+    }
+
+    int ret = Config::reload();
+    if (reply_to.empty())
+        return;
+
+    Json::Value data;
+    data["type"] = "configReloaded";
+    data["agentId"] = agent_id_.str();
+    data["erizoId"] = erizo_id_.str();
+    data["ok"] = ret == 0;
+    data["generation"] = Config::getInstance()->getGeneration();
+    sendReply(reply_to, data, 0);
+}
+
+void Erizo::drain(uint32_t timeout_ms)
+{
+    if (!init_ || draining_.exchange(true))
+        return;
+
+    drain_deadline_ = Tracer::now() + (uint64_t)timeout_ms * 1000;
+    if (load_reporter_ != nullptr)
+        load_reporter_->setDraining(true);
+
+    ResourceAccountant *accountant = ResourceAccountant::getInstance();
+    uint32_t publishers = accountant->getCount(RESOURCE_PUBLISHER) + accountant->getCount(RESOURCE_BRIDGE_IN);
+    uint32_t subscribers = accountant->getCount(RESOURCE_SUBSCRIBER) + accountant->getCount(RESOURCE_BRIDGE_OUT);
+    ELOG_INFO("draining, %u publishers %u subscribers, deadline in %ums", publishers, subscribers, timeout_ms);
+
+    // placement stops picking this node, reconnects go elsewhere as streams end
+    Json::FastWriter writer;
+    Json::Value msg;
+    msg["data"]["type"] = "draining";
+    msg["data"]["agentId"] = agent_id_.str();
+    msg["data"]["erizoId"] = erizo_id_.str();
+    msg["data"]["timeoutMs"] = timeout_ms;
+    msg["data"]["publishers"] = publishers;
+    msg["data"]["subscribers"] = subscribers;
+    amqp_uniquecast_->broadcastMessage(Config::getInstance()->load_report_binding_key, writer.write(msg));
+}
+
+bool Erizo::isDrained()
+{
+    if (!draining_)
+        return false;
+
+    ResourceAccountant *accountant = ResourceAccountant::getInstance();
+    uint32_t left = 0;
+    for (int kind = 0; kind < RESOURCE_KIND_NUM; kind++)
+        left += accountant->getCount((ResourceKind)kind);
+    if (left == 0)
+    {
+        ELOG_INFO("drained");
+        return true;
+    }
+    if (Tracer::now() >= drain_deadline_)
+    {
+        ELOG_WARN("drain deadline passed, %u connections left", left);
+        return true;
+    }
+    return false;
+}
+
+void Erizo::sendReply(const std::string &reply_to, const Json::Value &data, uint64_t trace_id)
+{
+    Json::FastWriter writer;
+    Json::Value reply;
+    reply["data"] = data;
+    onEvent(reply_to, writer.write(reply), trace_id);
+}
+
+bool Erizo::admit(ResourceKind kind, const std::string &reply_to, const InternedId &client_id, const InternedId &stream_id)
+{
+    ResourceAccountant *accountant = ResourceAccountant::getInstance();
+    const char *reason = "draining";
+    if (!draining_)
+    {
+        reason = accountant->admit(kind);
+        if (reason == nullptr)
+            return true;
+        accountant->reject(kind, reason);
+    }
+    // bridges are asked for without a reply queue, the log is all there is
+    if (reply_to.empty())
+    {
+        if (draining_)
+            ELOG_WARN("stream-->%s bridge refused, draining", stream_id.str());
+        return false;
+    }
+    // the requester can retry on the node with the most headroom
+    Json::Value data;
+    data["type"] = "rejected";
+    data["erizoId"] = erizo_id_.str();
+    data["streamId"] = stream_id.str();
+    data["clientId"] = client_id.str();
+    data["reason"] = reason;
+    data["headroom"] = accountant->getHeadroom();
+    sendReply(reply_to, data, Tracer::makeId(client_id, stream_id));
+    return false;
+}
+
+void Erizo::closeConnection(std::shared_ptr<Connection> conn)
+{
+    // Teardown of ICE/DTLS/MediaStream runs on the connection's own worker,
+    // the caller has already dropped it from the bookkeeping and detached
+    // it from its publisher, nothing may deliver into it while it closes
+    if (conn->getAttachCount() != 0)
+    {
+        // a bookkeeping slip, not worth the node: take it out of whatever
+        // still fans out its stream
+        ELOG_ERROR("stream-->%s subscriber closed while still in %u fan-outs", conn->getStreamId(), conn->getAttachCount());
+        std::shared_ptr<Connection> pub_conn = getPublishConn(conn->getStreamId());
+        if (pub_conn != nullptr)
+            pub_conn->removeSubscriber(conn->getClientId());
+        std::shared_ptr<BridgeConn> bridge_conn = getBridgeConn(conn->getStreamId());
+        if (bridge_conn != nullptr)
+            bridge_conn->removeSubscriber(conn->getClientId());
+    }
+    ResourceAccountant::getInstance()->release(conn->getResourceCost());
+    conn->setResourceCost(ResourceCost());
+    pending_closes_++;
+    conn->asyncClose([this]() {
+        onClosed();
+    });
+}
+
+void Erizo::closeBridgeConn(std::shared_ptr<BridgeConn> bridge_conn)
+{
+    ResourceAccountant::getInstance()->release(bridge_conn->getResourceCost());
+    bridge_conn->setResourceCost(ResourceCost());
+    pending_closes_++;
+    bridge_conn->asyncClose([this]() {
+        onClosed();
+    });
+}
+
+void Erizo::releaseBridgeDest(const InternedId &bridge_stream_id)
+{
+    // drop the shared outbound bridge keyed by bridge_stream_id together with
+    // every virtual subscriber riding on it
+    for (auto it = bridge_dests_.begin(); it != bridge_dests_.end(); it++)
+    {
+        if (it->second.first != bridge_stream_id)
+            continue;
+
+        for (auto ita = bridge_aliases_.begin(); ita != bridge_aliases_.end();)
+        {
+            if (!ita->second.compare(it->first))
+                ita = bridge_aliases_.erase(ita);
+            else
+                ita++;
+        }
+        bridge_dests_.erase(it);
+        return;
+    }
+}
+
+void Erizo::onClosed()
+{
+    std::unique_lock<std::mutex> lock(close_mux_);
+    if (--pending_closes_ == 0)
+        close_cond_.notify_all();
+}
+
+uint64_t Erizo::getTraceId(const std::string &method, const Json::Value &root)
+{
+    if (!root.isMember("args") ||
+        root["args"].type() != Json::arrayValue)
+        return 0;
+
+    // addPublisher is [room_id, client_id, stream_id, ...], the others start with [id, stream_id, ...]
+    const Json::Value &args = root["args"];
+    Json::ArrayIndex index = !method.compare("addPublisher") ? 1 : 0;
+    if (args.size() < index + 2 ||
+        args[index].type() != Json::stringValue ||
+        args[index + 1].type() != Json::stringValue)
+        return 0;
+
+    return Tracer::makeId(args[index].asString(), args[index + 1].asString());
+}
+
+std::shared_ptr<Connection> Erizo::getPublishConn(const InternedId &stream_id)
 {
     for (auto it = clients_.begin(); it != clients_.end(); it++)
     {
@@ -601,7 +1233,7 @@ std::shared_ptr<Connection> Erizo::getPublishConn(const std::string &stream_id)
     return nullptr;
 }
 
-std::vector<std::shared_ptr<Client>> Erizo::getSubscribers(const std::string &subscribe_to)
+std::vector<std::shared_ptr<Client>> Erizo::getSubscribers(const InternedId &subscribe_to)
 {
     std::vector<std::shared_ptr<Client>> subscribers;
     for (auto it = clients_.begin(); it != clients_.end(); it++)
@@ -613,7 +1245,7 @@ std::vector<std::shared_ptr<Client>> Erizo::getSubscribers(const std::string &su
     return subscribers;
 }
 
-std::shared_ptr<Connection> Erizo::getPublishConn(std::shared_ptr<Client> client, const std::string &stream_id)
+std::shared_ptr<Connection> Erizo::getPublishConn(std::shared_ptr<Client> client, const InternedId &stream_id)
 {
     auto it = client->publishers.find(stream_id);
     if (it != client->publishers.end())
@@ -622,7 +1254,7 @@ std::shared_ptr<Connection> Erizo::getPublishConn(std::shared_ptr<Client> client
     return nullptr;
 }
 
-std::shared_ptr<Connection> Erizo::getSubscribeConn(std::shared_ptr<Client> client, const std::string &stream_id)
+std::shared_ptr<Connection> Erizo::getSubscribeConn(std::shared_ptr<Client> client, const InternedId &stream_id)
 {
     auto it = client->subscribers.find(stream_id);
     if (it != client->subscribers.end())
@@ -631,7 +1263,7 @@ std::shared_ptr<Connection> Erizo::getSubscribeConn(std::shared_ptr<Client> clie
     return nullptr;
 }
 
-std::shared_ptr<Connection> Erizo::getConn(std::shared_ptr<Client> client, const std::string &stream_id)
+std::shared_ptr<Connection> Erizo::getConn(std::shared_ptr<Client> client, const InternedId &stream_id)
 {
     {
         auto it = client->publishers.find(stream_id);
@@ -647,7 +1279,7 @@ std::shared_ptr<Connection> Erizo::getConn(std::shared_ptr<Client> client, const
     return nullptr;
 }
 
-std::shared_ptr<BridgeConn> Erizo::getBridgeConn(const std::string &stream_id)
+std::shared_ptr<BridgeConn> Erizo::getBridgeConn(const InternedId &stream_id)
 {
     auto it = bridge_conns_.find(stream_id);
     if (it != bridge_conns_.end())
@@ -655,23 +1287,72 @@ std::shared_ptr<BridgeConn> Erizo::getBridgeConn(const std::string &stream_id)
     return nullptr;
 }
 
-std::vector<std::shared_ptr<BridgeConn>> Erizo::getBridgeConns(const std::string &src_stream_id)
+std::shared_ptr<Connection> Erizo::getRoomPublishConn(std::shared_ptr<Room> room, const InternedId &stream_id)
+{
+    auto it = room->publishers.find(stream_id);
+    if (it == room->publishers.end())
+        return nullptr;
+    auto itc = clients_.find(it->second);
+    if (itc == clients_.end())
+        return nullptr;
+    return getPublishConn(itc->second, stream_id);
+}
+
+std::vector<std::shared_ptr<BridgeConn>> Erizo::getBridgeConns(const InternedId &src_stream_id)
 {
     std::vector<std::shared_ptr<BridgeConn>> bridge_conns;
     for (auto it = bridge_conns_.begin(); it != bridge_conns_.end(); it++)
     {
-        if (!it->second->getSrcStreamId().compare(src_stream_id))
+        if (it->second->getSrcStreamId() == src_stream_id)
             bridge_conns.push_back(it->second);
     }
     return bridge_conns;
 }
 
-std::shared_ptr<Client> Erizo::getOrCreateClient(const std::string &client_id)
+std::shared_ptr<Room> Erizo::getOrCreateRoom(const InternedId &room_id)
+{
+    std::shared_ptr<Room> &room = rooms_[room_id];
+    if (room == nullptr)
+    {
+        room = std::make_shared<Room>();
+        room->id = room_id;
+        room->speakers = std::make_shared<ActiveSpeakerDetector>(room_id,
+                                                                 Config::getInstance()->last_n,
+                                                                 Config::getInstance()->active_speaker_interval_ms);
+    }
+    return room;
+}
+
+std::shared_ptr<Room> Erizo::getStreamRoom(const InternedId &stream_id)
+{
+    auto it = stream_rooms_.find(stream_id);
+    if (it == stream_rooms_.end())
+        return nullptr;
+
+    auto itr = rooms_.find(it->second);
+    if (itr != rooms_.end())
+        return itr->second;
+    return nullptr;
+}
+
+void Erizo::releaseRoom(std::shared_ptr<Room> room)
+{
+    if (room->publishers.size() == 0 && room->subscribers.size() == 0 && room->bridges.size() == 0)
+        rooms_.erase(room->id);
+}
+
+void Erizo::releaseClient(std::shared_ptr<Client> client)
+{
+    if (client->publishers.size() == 0 && client->subscribers.size() == 0)
+        clients_.erase(client->id);
+}
+
+std::shared_ptr<Client> Erizo::getOrCreateClient(const InternedId &client_id)
 {
     auto it = clients_.find(client_id);
     if (it == clients_.end())
     {
-        clients_[client_id] = std::make_shared<Client>();
+        clients_[client_id] = std::allocate_shared<Client>(SlabAllocator<Client>());
         clients_[client_id]->id = client_id;
     }
     return clients_[client_id];
@@ -3,10 +3,19 @@
 
 #include <string>
 #include <memory>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #include <json/json.h>
 #include <logger.h>
 
+#include "common/interned_id.h"
+#include "resource_accountant.h"
+
 namespace erizo
 {
 class IOThreadPool;
@@ -16,12 +25,14 @@ class ThreadPool;
 class Connection;
 class BridgeConn;
 class Client;
+struct Room;
 class AMQPHelper;
+class LoadReporter;
 
 class ConnectionListener
 {
 public:
-  virtual void onEvent(const std::string &reply_to, const std::string &event) = 0;
+  virtual void onEvent(const std::string &reply_to, const std::string &event, uint64_t trace_id) = 0;
 };
 
 class Erizo : public ConnectionListener
@@ -33,8 +44,21 @@ public:
   static Erizo *getInstance();
 
   int init(const std::string &agent_id, const std::string &erizo_id, const std::string &ip, uint16_t port);
+  // commands received after init wait for this, once the rest of the node
+  // is up too; tells the fleet the node takes connections
+  void ready(uint64_t startup_us);
   void close();
-  void onEvent(const std::string &reply_to, const std::string &msg) override;
+  void onEvent(const std::string &reply_to, const std::string &msg, uint64_t trace_id) override;
+
+  // stops admitting publishers, subscribers and bridges and tells the
+  // fleet, existing connections live on until they end or timeout_ms passes
+  void drain(uint32_t timeout_ms);
+  bool isDraining()
+  {
+    return draining_;
+  }
+  // draining and nothing left to serve or past the deadline, time to close
+  bool isDrained();
 
 private:
   Erizo();
@@ -47,30 +71,77 @@ private:
 
   void addSubscriber(const Json::Value &root);
   void removeSubscriber(const Json::Value &root);
+  void removeSubscriber(const InternedId &client_id, const InternedId &stream_id);
 
   void addVirtualSubscriber(const Json::Value &root);
   void removeVirtualSubscriber(const Json::Value &root);
 
   void processSignaling(const Json::Value &root);
-
-  std::shared_ptr<Connection> getPublishConn(const std::string &stream_id);
-  std::vector<std::shared_ptr<Client>> getSubscribers(const std::string &subscribe_to);
-  std::shared_ptr<Connection> getPublishConn(std::shared_ptr<Client> client, const std::string &stream_id);
-  std::shared_ptr<Connection> getConn(std::shared_ptr<Client> client, const std::string &stream_id);
-  std::shared_ptr<Connection> getSubscribeConn(std::shared_ptr<Client> client, const std::string &stream_id);
-  std::shared_ptr<BridgeConn> getBridgeConn(const std::string &bridge_stream_id);
-  std::vector<std::shared_ptr<BridgeConn>> getBridgeConns(const std::string &src_stream_id);
-  std::shared_ptr<Client> getOrCreateClient(const std::string &client_id);
+  void setSubscriberLayer(const Json::Value &root);
+
+  void removeRoom(const Json::Value &root);
+  void getHeadroom(const Json::Value &root);
+  void startDrain(const Json::Value &root);
+  void reloadConfig(const Json::Value &root);
+
+  uint64_t getTraceId(const std::string &method, const Json::Value &root);
+  void sendReply(const std::string &reply_to, const Json::Value &data, uint64_t trace_id);
+  // false once the connection was refused and the requester told so, an
+  // empty reply_to for bridges, whose refusal is only logged
+  bool admit(ResourceKind kind, const std::string &reply_to, const InternedId &client_id, const InternedId &stream_id);
+
+  // ids are interned once from the request args, from here on they are handles
+  std::shared_ptr<Connection> getPublishConn(const InternedId &stream_id);
+  std::vector<std::shared_ptr<Client>> getSubscribers(const InternedId &subscribe_to);
+  std::shared_ptr<Connection> getPublishConn(std::shared_ptr<Client> client, const InternedId &stream_id);
+  std::shared_ptr<Connection> getConn(std::shared_ptr<Client> client, const InternedId &stream_id);
+  std::shared_ptr<Connection> getSubscribeConn(std::shared_ptr<Client> client, const InternedId &stream_id);
+  // one of room's publishers through the room's index, no scan of every client
+  std::shared_ptr<Connection> getRoomPublishConn(std::shared_ptr<Room> room, const InternedId &stream_id);
+  std::shared_ptr<BridgeConn> getBridgeConn(const InternedId &bridge_stream_id);
+  std::vector<std::shared_ptr<BridgeConn>> getBridgeConns(const InternedId &src_stream_id);
+  std::shared_ptr<Client> getOrCreateClient(const InternedId &client_id);
+  std::shared_ptr<Room> getOrCreateRoom(const InternedId &room_id);
+  std::shared_ptr<Room> getStreamRoom(const InternedId &stream_id);
+  void releaseRoom(std::shared_ptr<Room> room);
+  void releaseClient(std::shared_ptr<Client> client);
+  void closeConnection(std::shared_ptr<Connection> conn);
+  void closeBridgeConn(std::shared_ptr<BridgeConn> bridge_conn);
+  void releaseBridgeDest(const InternedId &bridge_stream_id);
+  void onClosed();
+  void waitReady();
 
 private:
   std::shared_ptr<AMQPHelper> amqp_uniquecast_;
+  std::shared_ptr<LoadReporter> load_reporter_;
   std::shared_ptr<erizo::ThreadPool> thread_pool_;
   std::shared_ptr<erizo::IOThreadPool> io_thread_pool_;
-  std::map<std::string, std::shared_ptr<Client>> clients_;
-  std::map<std::string, std::shared_ptr<BridgeConn>> bridge_conns_;
-
-  std::string agent_id_;
-  std::string erizo_id_;
+  std::unordered_map<InternedId, std::shared_ptr<Client>> clients_;
+  std::unordered_map<InternedId, std::shared_ptr<BridgeConn>> bridge_conns_;
+  // "src_stream_id@ip:port" -> (bridge_conns_ key of the shared outbound bridge,
+  // number of virtual subscribers on it)
+  std::map<std::string, std::pair<InternedId, int>> bridge_dests_;
+  // virtual subscriber bridge_stream_id -> bridge_dests_ key
+  std::unordered_map<InternedId, std::string> bridge_aliases_;
+  std::unordered_map<InternedId, std::shared_ptr<Room>> rooms_;
+  // publisher/virtual publisher stream_id -> room_id
+  std::unordered_map<InternedId, InternedId> stream_rooms_;
+
+  // closes posted to workers and not finished yet
+  std::atomic<int> pending_closes_;
+  std::mutex close_mux_;
+  std::condition_variable close_cond_;
+
+  std::atomic<bool> ready_;
+  std::mutex ready_mux_;
+  std::condition_variable ready_cond_;
+
+  std::atomic<bool> draining_;
+  // Tracer::now() microseconds
+  std::atomic<uint64_t> drain_deadline_;
+
+  InternedId agent_id_;
+  InternedId erizo_id_;
   bool init_;
 
   static Erizo *instance_;
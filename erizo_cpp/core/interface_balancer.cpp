@@ -0,0 +1,135 @@
+#include "interface_balancer.h"
+
+#include <stdio.h>
+
+#include "common/utils.h"
+#include "common/config.h"
+#include "common/trace.h"
+
+#define INTERFACE_SAMPLE_INTERVAL_US 1000000
+
+DEFINE_LOGGER(InterfaceBalancer, "InterfaceBalancer");
+
+InterfaceBalancer *InterfaceBalancer::instance_ = nullptr;
+InterfaceBalancer *InterfaceBalancer::getInstance()
+{
+    if (instance_ == nullptr)
+        instance_ = new InterfaceBalancer;
+    return instance_;
+}
+
+InterfaceBalancer::InterfaceBalancer() : last_sample_(0) {}
+
+InterfaceBalancer::~InterfaceBalancer() {}
+
+uint64_t InterfaceBalancer::readTxBytes(const std::string &device)
+{
+    if (device.empty())
+        return 0;
+
+    std::string path = "/sys/class/net/" + device + "/statistics/tx_bytes";
+    FILE *file = fopen(path.c_str(), "r");
+    if (file == nullptr)
+        return 0;
+    unsigned long long bytes = 0;
+    if (fscanf(file, "%llu", &bytes) != 1)
+        bytes = 0;
+    fclose(file);
+    return bytes;
+}
+
+void InterfaceBalancer::sample()
+{
+    uint64_t now = Tracer::now();
+    if (now - last_sample_ < INTERFACE_SAMPLE_INTERVAL_US)
+        return;
+
+    uint64_t elapsed = now - last_sample_;
+    for (auto &it : interfaces_)
+    {
+        Interface &iface = it.second;
+        uint64_t tx_bytes = readTxBytes(iface.device);
+        if (last_sample_ > 0 && iface.tx_bytes > 0 && tx_bytes >= iface.tx_bytes)
+            iface.egress_kbps = (tx_bytes - iface.tx_bytes) * 8000 / elapsed;
+        iface.tx_bytes = tx_bytes;
+        iface.pending_kbps /= 2;
+    }
+    last_sample_ = now;
+}
+
+std::string InterfaceBalancer::acquire(const std::vector<std::string> &names, bool is_publisher)
+{
+    if (names.empty())
+        return "";
+
+    std::unique_lock<std::mutex> lock(mux_);
+    for (const std::string &name : names)
+    {
+        if (interfaces_.find(name) != interfaces_.end())
+            continue;
+        Interface iface = {Utils::getInterfaceDevice(name), 0, 0, 0, 0};
+        if (iface.device.empty())
+            ELOG_WARN("interface %s not found, only used when no other is", name);
+        iface.tx_bytes = readTxBytes(iface.device);
+        interfaces_[name] = iface;
+    }
+    sample();
+
+    // a measured interface first, then least egress measured plus placed
+    // lately, then fewest connections; one without counters reads as idle
+    const std::string *best = nullptr;
+    bool best_measured = false;
+    uint64_t best_load = 0;
+    uint32_t best_connections = 0;
+    for (const std::string &name : names)
+    {
+        Interface &iface = interfaces_[name];
+        bool measured = !iface.device.empty();
+        uint64_t load = iface.egress_kbps + iface.pending_kbps;
+        if (best == nullptr ||
+            (measured && !best_measured) ||
+            (measured == best_measured &&
+             (load < best_load ||
+              (load == best_load && iface.connections < best_connections))))
+        {
+            best = &name;
+            best_measured = measured;
+            best_load = load;
+            best_connections = iface.connections;
+        }
+    }
+
+    Interface &iface = interfaces_[*best];
+    iface.connections++;
+    // what a subscriber is budgeted, until the counters show the real thing;
+    // a publisher sends little more than rtcp
+    if (!is_publisher)
+        iface.pending_kbps += Config::getInstance()->admission_subscriber_kbps;
+    return *best;
+}
+
+void InterfaceBalancer::release(const std::string &name)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    auto it = interfaces_.find(name);
+    if (it != interfaces_.end() && it->second.connections > 0)
+        it->second.connections--;
+}
+
+Json::Value InterfaceBalancer::getStats()
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    sample();
+
+    Json::Value stats = Json::arrayValue;
+    for (auto &it : interfaces_)
+    {
+        Json::Value iface;
+        iface["name"] = it.first;
+        iface["device"] = it.second.device;
+        iface["connections"] = it.second.connections;
+        iface["egressKbps"] = (Json::UInt64)it.second.egress_kbps;
+        stats.append(iface);
+    }
+    return stats;
+}
@@ -0,0 +1,59 @@
+#ifndef INTERFACE_BALANCER_H
+#define INTERFACE_BALANCER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+
+#include <json/json.h>
+#include <logger.h>
+
+// Spreads new connections over the network interfaces configured for
+// their isp by the egress the kernel counted on each, so a multi-homed
+// node fills all its NICs instead of one per carrier. Connections placed
+// since the last samples count with an estimate until their media shows
+// up in the counters.
+class InterfaceBalancer
+{
+  DECLARE_LOGGER();
+
+  struct Interface
+  {
+    // kernel device, name itself or the one holding that address
+    std::string device;
+    uint32_t connections;
+    uint64_t tx_bytes;
+    uint64_t egress_kbps;
+    // estimate of what was placed recently, halves every sample
+    uint64_t pending_kbps;
+  };
+
+public:
+  static InterfaceBalancer *getInstance();
+  ~InterfaceBalancer();
+
+  // the one of names a new connection should use, "" if names is empty;
+  // only subscribers are charged an egress estimate
+  std::string acquire(const std::vector<std::string> &names, bool is_publisher);
+  void release(const std::string &name);
+
+  // per interface the connections on it and its measured egress
+  Json::Value getStats();
+
+private:
+  InterfaceBalancer();
+  // under mux_, at most once a second
+  void sample();
+  static uint64_t readTxBytes(const std::string &device);
+
+private:
+  std::mutex mux_;
+  std::map<std::string, Interface> interfaces_;
+  uint64_t last_sample_;
+
+  static InterfaceBalancer *instance_;
+};
+
+#endif
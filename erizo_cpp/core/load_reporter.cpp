@@ -0,0 +1,225 @@
+#include "load_reporter.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+
+#include <json/json.h>
+#include <thread/IOThreadPool.h>
+#include <thread/ThreadPool.h>
+
+#include "common/config.h"
+#include "common/trace.h"
+#include "rabbitmq/amqp_helper.h"
+#include "resource_accountant.h"
+#include "interface_balancer.h"
+
+DEFINE_LOGGER(LoadReporter, "LoadReporter");
+
+LoadReporter::LoadReporter() : amqp_(nullptr),
+                               last_time_(0),
+                               draining_(false),
+                               thread_(nullptr),
+                               run_(false),
+                               init_(false)
+{
+    last_totals_ = {0, 0, 0, 0};
+}
+
+LoadReporter::~LoadReporter() {}
+
+pid_t LoadReporter::currentTid()
+{
+    return (pid_t)syscall(SYS_gettid);
+}
+
+int LoadReporter::init(std::shared_ptr<AMQPHelper> amqp,
+                       const std::string &agent_id,
+                       const std::string &erizo_id,
+                       std::shared_ptr<erizo::ThreadPool> thread_pool,
+                       uint32_t worker_num,
+                       std::shared_ptr<erizo::IOThreadPool> io_thread_pool,
+                       uint32_t io_worker_num)
+{
+    if (init_)
+        return 0;
+
+    amqp_ = amqp;
+    agent_id_ = agent_id;
+    erizo_id_ = erizo_id;
+
+    // The pools hand out the worker with the fewest references. Holding
+    // every one returned walks each pool once, then a probe task on each
+    // worker tells which thread to sample.
+    std::vector<std::shared_ptr<erizo::Worker>> workers;
+    for (uint32_t i = 0; i < worker_num; i++)
+    {
+        std::shared_ptr<erizo::Worker> worker = thread_pool->getLessUsedWorker();
+        if (std::find(workers.begin(), workers.end(), worker) != workers.end())
+            continue;
+        workers.push_back(worker);
+
+        ThreadCpu thread = {std::make_shared<std::atomic<pid_t>>(0), 0};
+        std::shared_ptr<std::atomic<pid_t>> tid = thread.tid;
+        worker->task([tid]() {
+            *tid = currentTid();
+        });
+        workers_.push_back(thread);
+    }
+
+    std::vector<std::shared_ptr<erizo::IOWorker>> io_workers;
+    for (uint32_t i = 0; i < io_worker_num; i++)
+    {
+        std::shared_ptr<erizo::IOWorker> io_worker = io_thread_pool->getLessUsedIOWorker();
+        if (std::find(io_workers.begin(), io_workers.end(), io_worker) != io_workers.end())
+            continue;
+        io_workers.push_back(io_worker);
+
+        ThreadCpu thread = {std::make_shared<std::atomic<pid_t>>(0), 0};
+        std::shared_ptr<std::atomic<pid_t>> tid = thread.tid;
+        io_worker->task([tid]() {
+            *tid = currentTid();
+        });
+        io_workers_.push_back(thread);
+    }
+
+    last_totals_ = LoadStats::getTotals();
+    last_time_ = Tracer::now();
+
+    uint32_t interval_ms = Config::getInstance()->load_report_interval_ms;
+    run_ = true;
+    thread_ = std::unique_ptr<std::thread>(new std::thread([this, interval_ms]() {
+        std::unique_lock<std::mutex> lock(mux_);
+        while (run_)
+        {
+            cond_.wait_for(lock, std::chrono::milliseconds(interval_ms));
+            if (!run_)
+                break;
+            lock.unlock();
+            report();
+            lock.lock();
+        }
+    }));
+
+    init_ = true;
+    return 0;
+}
+
+void LoadReporter::close()
+{
+    if (!init_)
+        return;
+
+    {
+        std::unique_lock<std::mutex> lock(mux_);
+        run_ = false;
+        cond_.notify_all();
+    }
+    thread_->join();
+    thread_.reset();
+    thread_ = nullptr;
+
+    amqp_.reset();
+    amqp_ = nullptr;
+    workers_.clear();
+    io_workers_.clear();
+    init_ = false;
+}
+
+uint64_t LoadReporter::threadTicks(pid_t tid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", (int)tid);
+    FILE *file = fopen(path, "r");
+    if (file == nullptr)
+        return 0;
+
+    char buf[512];
+    size_t len = fread(buf, 1, sizeof(buf) - 1, file);
+    fclose(file);
+    buf[len] = '\0';
+
+    // the thread name may hold spaces, fields are counted past its ')'
+    char *p = strrchr(buf, ')');
+    if (p == nullptr)
+        return 0;
+    unsigned long utime = 0, stime = 0;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return 0;
+    return utime + stime;
+}
+
+uint64_t LoadReporter::residentKB()
+{
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file == nullptr)
+        return 0;
+    unsigned long size = 0, resident = 0;
+    if (fscanf(file, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(file);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+double LoadReporter::threadCpu(ThreadCpu &thread, double seconds)
+{
+    pid_t tid = *thread.tid;
+    if (tid == 0)
+        return -1;
+
+    uint64_t ticks = threadTicks(tid);
+    uint64_t delta = ticks >= thread.ticks ? ticks - thread.ticks : 0;
+    bool first = thread.ticks == 0;
+    thread.ticks = ticks;
+    if (first || seconds <= 0)
+        return 0;
+    return delta * 100.0 / sysconf(_SC_CLK_TCK) / seconds;
+}
+
+void LoadReporter::report()
+{
+    uint64_t now = Tracer::now();
+    double seconds = (now - last_time_) / 1000000.0;
+    LoadStats::Totals totals = LoadStats::getTotals();
+    if (seconds <= 0)
+        return;
+
+    Json::Value data;
+    data["type"] = "load";
+    data["agentId"] = agent_id_;
+    data["erizoId"] = erizo_id_;
+    data["intervalMs"] = (Json::UInt64)((now - last_time_) / 1000);
+    data["draining"] = (bool)draining_;
+
+    // percent of one core, -1 for a worker whose thread is not known yet
+    data["workers"] = Json::arrayValue;
+    for (ThreadCpu &thread : workers_)
+        data["workers"].append((int)threadCpu(thread, seconds));
+    data["ioWorkers"] = Json::arrayValue;
+    for (ThreadCpu &thread : io_workers_)
+        data["ioWorkers"].append((int)threadCpu(thread, seconds));
+
+    data["ppsIn"] = (Json::UInt64)((totals.packets_in - last_totals_.packets_in) / seconds);
+    data["ppsOut"] = (Json::UInt64)((totals.packets_out - last_totals_.packets_out) / seconds);
+    // integer kbps, a double would print with all its digits
+    data["ingressKbps"] = (Json::UInt64)((totals.bytes_in - last_totals_.bytes_in) * 8 / seconds / 1000);
+    data["egressKbps"] = (Json::UInt64)((totals.bytes_out - last_totals_.bytes_out) * 8 / seconds / 1000);
+
+    ResourceAccountant *accountant = ResourceAccountant::getInstance();
+    data["publishers"] = accountant->getCount(RESOURCE_PUBLISHER) + accountant->getCount(RESOURCE_BRIDGE_IN);
+    data["subscribers"] = accountant->getCount(RESOURCE_SUBSCRIBER) + accountant->getCount(RESOURCE_BRIDGE_OUT);
+    data["rssMB"] = (Json::UInt64)(residentKB() / 1024);
+    data["headroom"] = accountant->getHeadroom();
+    data["interfaces"] = InterfaceBalancer::getInstance()->getStats();
+
+    last_totals_ = totals;
+    last_time_ = now;
+
+    Json::FastWriter writer;
+    Json::Value msg;
+    msg["data"] = data;
+    amqp_->broadcastMessage(Config::getInstance()->load_report_binding_key, writer.write(msg));
+}
@@ -0,0 +1,86 @@
+#ifndef LOAD_REPORTER_H
+#define LOAD_REPORTER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <sys/types.h>
+
+#include <logger.h>
+
+#include "common/load_stats.h"
+
+namespace erizo
+{
+class ThreadPool;
+class IOThreadPool;
+}; // namespace erizo
+
+class AMQPHelper;
+
+// Publishes a compact load summary of the node on the broadcast exchange
+// every interval: cpu of every worker and io worker, packets and kbps in
+// and out, connection counts, resident memory, the admission headroom and
+// the egress of every interface. Media counters are the ones the media path
+// bumps lock-free, interface egress is what the kernel counted.
+class LoadReporter
+{
+  DECLARE_LOGGER();
+
+  struct ThreadCpu
+  {
+    // set from the worker's own thread, 0 until its probe task ran
+    std::shared_ptr<std::atomic<pid_t>> tid;
+    uint64_t ticks;
+  };
+
+public:
+  LoadReporter();
+  ~LoadReporter();
+
+  int init(std::shared_ptr<AMQPHelper> amqp,
+           const std::string &agent_id,
+           const std::string &erizo_id,
+           std::shared_ptr<erizo::ThreadPool> thread_pool,
+           uint32_t worker_num,
+           std::shared_ptr<erizo::IOThreadPool> io_thread_pool,
+           uint32_t io_worker_num);
+  void close();
+  // reports carry it so placement skips the node
+  void setDraining(bool draining)
+  {
+    draining_ = draining;
+  }
+
+  static pid_t currentTid();
+  // user and system clock ticks the thread ran, 0 if it is gone
+  static uint64_t threadTicks(pid_t tid);
+
+private:
+  void report();
+  // percent of one core since the last report, -1 if the thread is unknown
+  double threadCpu(ThreadCpu &thread, double seconds);
+  static uint64_t residentKB();
+
+private:
+  std::shared_ptr<AMQPHelper> amqp_;
+  std::string agent_id_;
+  std::string erizo_id_;
+  std::vector<ThreadCpu> workers_;
+  std::vector<ThreadCpu> io_workers_;
+  LoadStats::Totals last_totals_;
+  uint64_t last_time_;
+  std::atomic<bool> draining_;
+
+  std::unique_ptr<std::thread> thread_;
+  std::mutex mux_;
+  std::condition_variable cond_;
+  bool run_;
+  bool init_;
+};
+
+#endif
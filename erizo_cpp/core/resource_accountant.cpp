@@ -0,0 +1,258 @@
+#include "resource_accountant.h"
+
+#include <algorithm>
+
+#include "common/config.h"
+
+DEFINE_LOGGER(ResourceAccountant, "ResourceAccountant");
+
+ResourceAccountant *ResourceAccountant::instance_ = nullptr;
+ResourceAccountant *ResourceAccountant::getInstance()
+{
+    if (instance_ == nullptr)
+        instance_ = new ResourceAccountant;
+    return instance_;
+}
+
+ResourceAccountant::ResourceAccountant() : worker_num_(0),
+                                           memory_kb_(0),
+                                           egress_kbps_(0),
+                                           ports_(0)
+{
+    for (int i = 0; i < RESOURCE_KIND_NUM; i++)
+    {
+        counts_[i] = 0;
+        rejected_[i] = 0;
+    }
+}
+
+ResourceAccountant::~ResourceAccountant() {}
+
+static uint64_t memoryCost(ResourceKind kind)
+{
+    if (kind == RESOURCE_PUBLISHER || kind == RESOURCE_BRIDGE_IN)
+        return Config::getInstance()->admission_publisher_memory_kb;
+    return Config::getInstance()->admission_subscriber_memory_kb;
+}
+
+static uint64_t egressCost(ResourceKind kind)
+{
+    if (kind == RESOURCE_SUBSCRIBER || kind == RESOURCE_BRIDGE_OUT)
+        return Config::getInstance()->admission_subscriber_kbps;
+    return 0;
+}
+
+static const char *kindName(ResourceKind kind)
+{
+    switch (kind)
+    {
+    case RESOURCE_PUBLISHER:
+        return "publisher";
+    case RESOURCE_SUBSCRIBER:
+        return "subscriber";
+    case RESOURCE_BRIDGE_IN:
+        return "inbound bridge";
+    case RESOURCE_BRIDGE_OUT:
+        return "outbound bridge";
+    default:
+        return "connection";
+    }
+}
+
+// bridges run on the io workers, which are not budgeted
+static uint32_t loadCost(ResourceKind kind)
+{
+    if (kind == RESOURCE_PUBLISHER)
+        return Config::getInstance()->admission_publisher_load;
+    if (kind == RESOURCE_SUBSCRIBER)
+        return Config::getInstance()->admission_subscriber_load;
+    return 0;
+}
+
+// a WebRtcConnection binds a udp port of the ice range per component,
+// bridges share the BridgeIO socket
+static uint32_t portCost(ResourceKind kind)
+{
+    if (kind == RESOURCE_PUBLISHER || kind == RESOURCE_SUBSCRIBER)
+        return std::max<uint32_t>(Config::getInstance()->ice_components, 1);
+    return 0;
+}
+
+// 0 when the range is left to the kernel
+static uint32_t portBudget()
+{
+    Config *config = Config::getInstance();
+    if (config->min_port == 0 && config->max_port == 0)
+        return 0;
+    return config->max_port - config->min_port + 1;
+}
+
+void ResourceAccountant::init(uint32_t worker_num)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    worker_num_ = worker_num;
+    memory_kb_ = 0;
+    egress_kbps_ = 0;
+    ports_ = 0;
+    worker_loads_.clear();
+    for (int i = 0; i < RESOURCE_KIND_NUM; i++)
+    {
+        counts_[i] = 0;
+        rejected_[i] = 0;
+    }
+}
+
+uint32_t ResourceAccountant::getMinWorkerLoad()
+{
+    // idle workers have no entry
+    if (worker_loads_.size() < worker_num_)
+        return 0;
+
+    uint32_t min_load = UINT32_MAX;
+    for (auto &it : worker_loads_)
+    {
+        if (it.second < min_load)
+            min_load = it.second;
+    }
+    return min_load;
+}
+
+const char *ResourceAccountant::admit(ResourceKind kind)
+{
+    Config *config = Config::getInstance();
+    std::unique_lock<std::mutex> lock(mux_);
+    if (config->admission_max_memory_mb > 0 &&
+        memory_kb_ + memoryCost(kind) > config->admission_max_memory_mb * 1024ULL)
+        return "memory";
+    if (config->admission_max_egress_mbps > 0 &&
+        egress_kbps_ + egressCost(kind) > config->admission_max_egress_mbps * 1000ULL)
+        return "egress";
+    // the least used worker is where the connection would land
+    if (config->admission_max_worker_load > 0 &&
+        loadCost(kind) > 0 &&
+        getMinWorkerLoad() + loadCost(kind) > config->admission_max_worker_load)
+        return "cpu";
+    if (portBudget() > 0 &&
+        ports_ + portCost(kind) > portBudget())
+        return "ports";
+    return nullptr;
+}
+
+ResourceCost ResourceAccountant::reserve(ResourceKind kind, const erizo::Worker *worker)
+{
+    ResourceCost cost;
+    cost.kind = kind;
+    cost.memory_kb = memoryCost(kind);
+    cost.egress_kbps = egressCost(kind);
+    cost.ports = portCost(kind);
+    if (worker != nullptr)
+    {
+        cost.worker = worker;
+        cost.load = loadCost(kind);
+    }
+
+    std::unique_lock<std::mutex> lock(mux_);
+    memory_kb_ += cost.memory_kb;
+    egress_kbps_ += cost.egress_kbps;
+    ports_ += cost.ports;
+    if (cost.load > 0)
+        worker_loads_[worker] += cost.load;
+    counts_[kind]++;
+    return cost;
+}
+
+void ResourceAccountant::release(const ResourceCost &cost)
+{
+    if (cost.kind == RESOURCE_KIND_NUM)
+        return;
+
+    std::unique_lock<std::mutex> lock(mux_);
+    memory_kb_ -= cost.memory_kb;
+    egress_kbps_ -= cost.egress_kbps;
+    ports_ -= cost.ports;
+    if (cost.load > 0)
+    {
+        auto it = worker_loads_.find(cost.worker);
+        if (it != worker_loads_.end())
+        {
+            it->second -= cost.load;
+            if (it->second == 0)
+                worker_loads_.erase(it);
+        }
+    }
+    counts_[cost.kind]--;
+}
+
+void ResourceAccountant::reject(ResourceKind kind, const char *reason)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    rejected_[kind]++;
+    ELOG_WARN("%s rejected, %s budget exhausted, memory %lukB egress %lukbps ports %u",
+              kindName(kind),
+              reason,
+              (unsigned long)memory_kb_,
+              (unsigned long)egress_kbps_,
+              ports_);
+}
+
+int64_t ResourceAccountant::getFit(ResourceKind kind)
+{
+    Config *config = Config::getInstance();
+    int64_t fit = -1;
+    if (config->admission_max_memory_mb > 0 && memoryCost(kind) > 0)
+    {
+        uint64_t budget = config->admission_max_memory_mb * 1024ULL;
+        int64_t n = memory_kb_ < budget ? (budget - memory_kb_) / memoryCost(kind) : 0;
+        if (fit < 0 || n < fit)
+            fit = n;
+    }
+    if (config->admission_max_egress_mbps > 0 && egressCost(kind) > 0)
+    {
+        uint64_t budget = config->admission_max_egress_mbps * 1000ULL;
+        int64_t n = egress_kbps_ < budget ? (budget - egress_kbps_) / egressCost(kind) : 0;
+        if (fit < 0 || n < fit)
+            fit = n;
+    }
+    if (config->admission_max_worker_load > 0 && loadCost(kind) > 0)
+    {
+        uint32_t budget = config->admission_max_worker_load;
+        int64_t n = (int64_t)(worker_num_ - std::min<uint32_t>(worker_num_, worker_loads_.size())) * (budget / loadCost(kind));
+        for (auto &it : worker_loads_)
+        {
+            if (it.second < budget)
+                n += (budget - it.second) / loadCost(kind);
+        }
+        if (fit < 0 || n < fit)
+            fit = n;
+    }
+    if (portBudget() > 0 && portCost(kind) > 0)
+    {
+        int64_t n = ports_ < portBudget() ? (portBudget() - ports_) / portCost(kind) : 0;
+        if (fit < 0 || n < fit)
+            fit = n;
+    }
+    return fit;
+}
+
+Json::Value ResourceAccountant::getHeadroom()
+{
+    Config *config = Config::getInstance();
+    std::unique_lock<std::mutex> lock(mux_);
+    Json::Value headroom;
+    uint64_t memory_budget = config->admission_max_memory_mb * 1024ULL;
+    uint64_t egress_budget = config->admission_max_egress_mbps * 1000ULL;
+    uint32_t min_load = getMinWorkerLoad();
+    headroom["memoryKB"] = memory_budget == 0 ? Json::Int64(-1) : Json::Int64(memory_kb_ < memory_budget ? memory_budget - memory_kb_ : 0);
+    headroom["egressKbps"] = egress_budget == 0 ? Json::Int64(-1) : Json::Int64(egress_kbps_ < egress_budget ? egress_budget - egress_kbps_ : 0);
+    headroom["workerLoad"] = config->admission_max_worker_load == 0 ? Json::Int64(-1) : Json::Int64(min_load < config->admission_max_worker_load ? config->admission_max_worker_load - min_load : 0);
+    headroom["ports"] = portBudget() == 0 ? Json::Int64(-1) : Json::Int64(ports_ < portBudget() ? portBudget() - ports_ : 0);
+    headroom["publishers"] = Json::Int64(getFit(RESOURCE_PUBLISHER));
+    headroom["subscribers"] = Json::Int64(getFit(RESOURCE_SUBSCRIBER));
+    headroom["publisherCount"] = counts_[RESOURCE_PUBLISHER] + counts_[RESOURCE_BRIDGE_IN];
+    headroom["subscriberCount"] = counts_[RESOURCE_SUBSCRIBER] + counts_[RESOURCE_BRIDGE_OUT];
+    uint64_t rejected = 0;
+    for (int i = 0; i < RESOURCE_KIND_NUM; i++)
+        rejected += rejected_[i];
+    headroom["rejected"] = Json::UInt64(rejected);
+    return headroom;
+}
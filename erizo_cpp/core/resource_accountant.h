@@ -0,0 +1,100 @@
+#ifndef RESOURCE_ACCOUNTANT_H
+#define RESOURCE_ACCOUNTANT_H
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+
+#include <json/json.h>
+#include <logger.h>
+
+namespace erizo
+{
+class Worker;
+}; // namespace erizo
+
+enum ResourceKind
+{
+  RESOURCE_PUBLISHER = 0,
+  RESOURCE_SUBSCRIBER,
+  RESOURCE_BRIDGE_IN,  // virtual publisher, costs what a publisher does
+  RESOURCE_BRIDGE_OUT, // virtual subscriber, costs what a subscriber does
+  RESOURCE_KIND_NUM
+};
+
+// what one connection was charged, released as it was even after a
+// reload changed the costs in Config
+struct ResourceCost
+{
+  ResourceCost() : kind(RESOURCE_KIND_NUM),
+                   worker(nullptr),
+                   memory_kb(0),
+                   egress_kbps(0),
+                   load(0),
+                   ports(0) {}
+
+  // RESOURCE_KIND_NUM for nothing reserved
+  ResourceKind kind;
+  const erizo::Worker *worker;
+  uint64_t memory_kb;
+  uint64_t egress_kbps;
+  uint32_t load;
+  uint32_t ports;
+};
+
+// Estimated memory, egress bandwidth, worker load and ice ports of the
+// connections a node holds, against the budgets in Config. Costs are fixed per kind of
+// connection rather than measured, so a node refuses new work before it
+// degrades instead of after. A budget of 0 is unlimited.
+class ResourceAccountant
+{
+  DECLARE_LOGGER();
+
+public:
+  static ResourceAccountant *getInstance();
+  ~ResourceAccountant();
+
+  // forgets everything accounted so far
+  void init(uint32_t worker_num);
+
+  // nullptr if one more connection of kind fits every budget, otherwise the
+  // name of the budget it would exceed: "memory", "egress", "cpu" or "ports"
+  const char *admit(ResourceKind kind);
+  // worker is the one the connection runs on, nullptr for bridges; the
+  // connection keeps the cost until it hands it to release
+  ResourceCost reserve(ResourceKind kind, const erizo::Worker *worker);
+  void release(const ResourceCost &cost);
+  // counts and logs a connection refused for reason, as returned by admit
+  void reject(ResourceKind kind, const char *reason);
+
+  // connections of kind currently accounted, lock-free
+  uint32_t getCount(ResourceKind kind)
+  {
+    return counts_[kind];
+  }
+
+  // what is left of every budget and how many more publishers and
+  // subscribers fit, -1 where unlimited
+  Json::Value getHeadroom();
+
+private:
+  ResourceAccountant();
+  // under mux_
+  uint32_t getMinWorkerLoad();
+  int64_t getFit(ResourceKind kind);
+
+private:
+  std::mutex mux_;
+  uint32_t worker_num_;
+  uint64_t memory_kb_;
+  uint64_t egress_kbps_;
+  uint32_t ports_;
+  std::map<const erizo::Worker *, uint32_t> worker_loads_;
+  std::atomic<uint32_t> counts_[RESOURCE_KIND_NUM];
+  uint64_t rejected_[RESOURCE_KIND_NUM];
+
+  static ResourceAccountant *instance_;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include "startup.h"
+
+#include <future>
+
+#include <dtls/DtlsSocket.h>
+#include <BridgeIO.h>
+
+#include "common/config.h"
+#include "common/trace.h"
+#include "bridge/bridge_mux.h"
+#include "erizo.h"
+
+DEFINE_LOGGER(Startup, "Startup");
+
+int Startup::run(const std::string &agent_id,
+                 const std::string &erizo_id,
+                 const std::string &ip,
+                 uint16_t port,
+                 bool parallel,
+                 StartupTimes *times)
+{
+    // deferred steps run on get(), in order on this thread
+    std::launch policy = parallel ? std::launch::async : std::launch::deferred;
+    uint64_t begin = Tracer::now();
+
+    std::future<uint64_t> dtls = std::async(policy, []() {
+        uint64_t start = Tracer::now();
+        dtls::DtlsSocketContext::globalInit();
+        return Tracer::now() - start;
+    });
+
+    std::future<int> bridge = std::async(policy, [ip, port, times]() {
+        uint64_t start = Tracer::now();
+        if (erizo::BridgeIO::getInstance()->init(ip, port, Config::getInstance()->bridge_io_worker_num))
+        {
+            ELOG_ERROR("bridge-io initialize failed");
+            return 1;
+        }
+
+        if (Config::getInstance()->bridge_multiplex &&
+            BridgeMux::getInstance()->init(ip, port + Config::getInstance()->bridge_mux_port_offset,
+                                           Config::getInstance()->bridge_io_worker_num,
+                                           Config::getInstance()->bridge_mux_recv_threads))
+        {
+            ELOG_ERROR("bridge-mux initialize failed");
+            return 1;
+        }
+        times->bridge = Tracer::now() - start;
+        return 0;
+    });
+
+    if (!parallel)
+    {
+        times->dtls = dtls.get();
+        if (bridge.get())
+            return 1;
+    }
+
+    uint64_t start = Tracer::now();
+    if (Erizo::getInstance()->init(agent_id, erizo_id, ip, port))
+    {
+        ELOG_ERROR("erizo initialize failed");
+        return 1;
+    }
+    times->erizo = Tracer::now() - start;
+
+    if (parallel)
+    {
+        times->dtls = dtls.get();
+        if (bridge.get())
+            return 1;
+    }
+
+    times->total = Tracer::now() - begin;
+    Erizo::getInstance()->ready(times->total);
+    ELOG_INFO("ready in %lums: dtls %lums, bridge %lums, erizo %lums",
+              (unsigned long)(times->total / 1000),
+              (unsigned long)(times->dtls / 1000),
+              (unsigned long)(times->bridge / 1000),
+              (unsigned long)(times->erizo / 1000));
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <string>
+#include <stdint.h>
+
+#include <logger.h>
+
+// microseconds each step took, total is wall time to ready
+struct StartupTimes
+{
+  uint64_t dtls;
+  uint64_t bridge;
+  uint64_t erizo;
+  uint64_t total;
+};
+
+// Brings the node up once Config is loaded. DTLS certificate generation,
+// the bridge sockets and Erizo (thread pools and broker connection) do not
+// depend on each other and start concurrently; Erizo holds back commands
+// until all of them finished, then the node broadcasts "ready".
+class Startup
+{
+  DECLARE_LOGGER();
+
+public:
+  // parallel false runs the same steps one after the other, for comparison
+  static int run(const std::string &agent_id,
+                 const std::string &erizo_id,
+                 const std::string &ip,
+                 uint16_t port,
+                 bool parallel,
+                 StartupTimes *times);
+};
+
+#endif
@@ -0,0 +1,250 @@
+#include "worker_balancer.h"
+
+#include <unistd.h>
+
+#include <thread/IOThreadPool.h>
+
+#include "common/config.h"
+#include "common/trace.h"
+#include "model/bridge_conn.h"
+#include "load_reporter.h"
+
+// a worker this far below a full core is never hot, whatever the mean
+#define WORKER_REBALANCE_MIN_CPU 50
+
+DEFINE_LOGGER(WorkerBalancer, "WorkerBalancer");
+
+WorkerBalancer *WorkerBalancer::instance_ = nullptr;
+WorkerBalancer *WorkerBalancer::getInstance()
+{
+    if (instance_ == nullptr)
+        instance_ = new WorkerBalancer;
+    return instance_;
+}
+
+WorkerBalancer::WorkerBalancer() : last_time_(0),
+                                   passes_(0),
+                                   hot_passes_(0),
+                                   migrations_(0),
+                                   thread_(nullptr),
+                                   run_(false),
+                                   init_(false)
+{
+}
+
+WorkerBalancer::~WorkerBalancer() {}
+
+void WorkerBalancer::init(std::shared_ptr<erizo::IOThreadPool> io_thread_pool, uint32_t io_worker_num)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    if (init_)
+        return;
+
+    uint32_t interval_ms = Config::getInstance()->bridge_rebalance_ms;
+    if (interval_ms == 0)
+        return;
+
+    // same walk as the load reporter's, a probe task names each thread
+    for (uint32_t i = 0; i < io_worker_num; i++)
+    {
+        std::shared_ptr<erizo::IOWorker> io_worker = io_thread_pool->getLessUsedIOWorker();
+        bool known = false;
+        for (Worker &worker : workers_)
+            known = known || worker.io_worker == io_worker;
+        if (known)
+            continue;
+
+        Worker worker = {io_worker, std::make_shared<std::atomic<pid_t>>(0), 0, 0, false};
+        std::shared_ptr<std::atomic<pid_t>> tid = worker.tid;
+        io_worker->task([tid]() {
+            *tid = LoadReporter::currentTid();
+        });
+        workers_.push_back(worker);
+    }
+
+    last_time_ = Tracer::now();
+    passes_ = 0;
+    hot_passes_ = 0;
+    run_ = true;
+    thread_ = std::unique_ptr<std::thread>(new std::thread([this, interval_ms]() {
+        std::unique_lock<std::mutex> lock(mux_);
+        while (run_)
+        {
+            cond_.wait_for(lock, std::chrono::milliseconds(interval_ms));
+            if (!run_)
+                break;
+            lock.unlock();
+            rebalance();
+            lock.lock();
+        }
+    }));
+
+    init_ = true;
+}
+
+void WorkerBalancer::close()
+{
+    {
+        std::unique_lock<std::mutex> lock(mux_);
+        if (!init_)
+            return;
+        run_ = false;
+        cond_.notify_all();
+    }
+    thread_->join();
+    thread_.reset();
+    thread_ = nullptr;
+
+    std::unique_lock<std::mutex> lock(mux_);
+    workers_.clear();
+    bridges_.clear();
+    init_ = false;
+}
+
+std::shared_ptr<erizo::IOWorker> WorkerBalancer::getIOWorker(std::shared_ptr<erizo::IOThreadPool> io_thread_pool)
+{
+    {
+        std::unique_lock<std::mutex> lock(mux_);
+        // fewest users as the pool counts them, a hot worker only if all are
+        Worker *best = nullptr;
+        for (Worker &worker : workers_)
+        {
+            if (best == nullptr ||
+                (!worker.hot && best->hot) ||
+                (worker.hot == best->hot && worker.io_worker.use_count() < best->io_worker.use_count()))
+                best = &worker;
+        }
+        if (best != nullptr)
+            return best->io_worker;
+    }
+    return io_thread_pool->getLessUsedIOWorker();
+}
+
+void WorkerBalancer::addBridge(std::shared_ptr<BridgeConn> bridge_conn)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    if (!init_)
+        return;
+    bridges_[bridge_conn.get()] = {bridge_conn, bridge_conn->getPackets(), 0};
+}
+
+void WorkerBalancer::removeBridge(BridgeConn *bridge_conn)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    bridges_.erase(bridge_conn);
+}
+
+void WorkerBalancer::rebalance()
+{
+    std::shared_ptr<BridgeConn> best = nullptr;
+    std::shared_ptr<erizo::IOWorker> to = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(mux_);
+        uint64_t now = Tracer::now();
+        double seconds = (now - last_time_) / 1000000.0;
+        last_time_ = now;
+        passes_++;
+        if (workers_.empty() || seconds <= 0)
+            return;
+
+        size_t hot = 0;
+        size_t cool = 0;
+        uint64_t total = 0;
+        for (size_t i = 0; i < workers_.size(); i++)
+        {
+            Worker &worker = workers_[i];
+            pid_t tid = *worker.tid;
+            uint64_t ticks = tid != 0 ? LoadReporter::threadTicks(tid) : 0;
+            worker.cpu = worker.ticks > 0 && ticks >= worker.ticks ? (uint32_t)((ticks - worker.ticks) * 100 / sysconf(_SC_CLK_TCK) / seconds) : 0;
+            worker.ticks = ticks;
+            total += worker.cpu;
+            if (worker.cpu > workers_[hot].cpu)
+                hot = i;
+            if (worker.cpu < workers_[cool].cpu)
+                cool = i;
+        }
+        uint64_t mean = total / workers_.size();
+        uint32_t threshold = Config::getInstance()->bridge_rebalance_threshold;
+        for (Worker &worker : workers_)
+            worker.hot = worker.cpu >= WORKER_REBALANCE_MIN_CPU && worker.cpu * 100 > mean * (100 + threshold);
+
+        // packets every bridge passed since the last pass, per worker
+        std::vector<uint64_t> packets(workers_.size(), 0);
+        std::vector<Candidate> candidates;
+        for (auto it = bridges_.begin(); it != bridges_.end();)
+        {
+            std::shared_ptr<BridgeConn> bridge_conn = it->second.conn.lock();
+            if (bridge_conn == nullptr)
+            {
+                it = bridges_.erase(it);
+                continue;
+            }
+            bridge_conn->releaseRetired();
+            uint64_t bridge_packets = bridge_conn->getPackets();
+            uint64_t delta = bridge_packets >= it->second.packets ? bridge_packets - it->second.packets : 0;
+            it->second.packets = bridge_packets;
+
+            std::shared_ptr<erizo::IOWorker> io_worker = bridge_conn->getIOWorker();
+            for (size_t i = 0; i < workers_.size(); i++)
+            {
+                if (workers_[i].io_worker != io_worker)
+                    continue;
+                packets[i] += delta;
+                if (i == hot && delta > 0)
+                    candidates.push_back({bridge_conn, &it->second, delta});
+                break;
+            }
+            it++;
+        }
+
+        // hysteresis: the hottest worker must stay hot for several passes in
+        // a row before anything moves
+        if (hot == cool || !workers_[hot].hot)
+        {
+            hot_passes_ = 0;
+            return;
+        }
+        if (++hot_passes_ < Config::getInstance()->bridge_rebalance_passes)
+            return;
+        hot_passes_ = 0;
+
+        // A bridge is charged the hot worker's cpu by its share of the
+        // packets bridges passed there, as if they were all the worker ran;
+        // an overestimate, so a pick errs light. One under the gap narrows
+        // it, the one closest to half the gap evens the two workers best.
+        uint64_t gap = workers_[hot].cpu - workers_[cool].cpu;
+        uint64_t best_cost = 0;
+        Bridge *best_entry = nullptr;
+        for (Candidate &candidate : candidates)
+        {
+            if (candidate.entry->moved > 0 &&
+                passes_ - candidate.entry->moved < Config::getInstance()->bridge_rebalance_passes)
+                continue;
+            uint64_t cost = workers_[hot].cpu * candidate.packets / packets[hot];
+            if (cost >= gap)
+                continue;
+
+            uint64_t distance = cost > gap / 2 ? cost - gap / 2 : gap / 2 - cost;
+            uint64_t best_distance = best_cost > gap / 2 ? best_cost - gap / 2 : gap / 2 - best_cost;
+            if (best_entry == nullptr || distance < best_distance)
+            {
+                best = candidate.conn;
+                best_entry = candidate.entry;
+                best_cost = cost;
+            }
+        }
+        if (best_entry == nullptr)
+            return;
+
+        best_entry->moved = passes_;
+        to = workers_[cool].io_worker;
+        migrations_++;
+        ELOG_INFO("move bridge %s from io worker %u (%u%% cpu) to io worker %u (%u%% cpu), about %u%% cpu",
+                  best->getBridgeStreamId().str(), (uint32_t)hot, workers_[hot].cpu,
+                  (uint32_t)cool, workers_[cool].cpu, (uint32_t)best_cost);
+    }
+
+    // outside mux_, the bridge posts the handover to its workers
+    if (best != nullptr)
+        best->migrate(to);
+}
@@ -0,0 +1,101 @@
+#ifndef WORKER_BALANCER_H
+#define WORKER_BALANCER_H
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <logger.h>
+
+namespace erizo
+{
+class IOThreadPool;
+class IOWorker;
+}; // namespace erizo
+
+class BridgeConn;
+
+// Keeps work off io workers that run hot, by the cpu their threads used.
+// New connections go to the least used worker that is not hot. A
+// WebRtcConnection stays on the worker its ICE agent and DTLS socket were
+// created on, licode cannot move those; a BridgeMediaStream can be rebuilt
+// on another worker, so the bridges of a worker that stays hot move to the
+// coolest one. Without multiplex that is every bridge, with it BridgeMux
+// balances its own workers.
+class WorkerBalancer
+{
+  DECLARE_LOGGER();
+
+  struct Worker
+  {
+    std::shared_ptr<erizo::IOWorker> io_worker;
+    // set from the worker's own thread, 0 until its probe task ran
+    std::shared_ptr<std::atomic<pid_t>> tid;
+    uint64_t ticks;
+    // percent of one core over the last pass
+    uint32_t cpu;
+    bool hot;
+  };
+
+  struct Bridge
+  {
+    std::weak_ptr<BridgeConn> conn;
+    uint64_t packets;
+    // pass it last moved in, 0 if it never did
+    uint64_t moved;
+  };
+
+  struct Candidate
+  {
+    std::shared_ptr<BridgeConn> conn;
+    Bridge *entry;
+    // since the last pass
+    uint64_t packets;
+  };
+
+public:
+  static WorkerBalancer *getInstance();
+  ~WorkerBalancer();
+
+  void init(std::shared_ptr<erizo::IOThreadPool> io_thread_pool, uint32_t io_worker_num);
+  void close();
+
+  // io worker for a new connection or bridge, the pool's pick until init
+  std::shared_ptr<erizo::IOWorker> getIOWorker(std::shared_ptr<erizo::IOThreadPool> io_thread_pool);
+  // bridges on their own BridgeMediaStream, the ones that can move
+  void addBridge(std::shared_ptr<BridgeConn> bridge_conn);
+  void removeBridge(BridgeConn *bridge_conn);
+
+  uint64_t getMigrations()
+  {
+    return migrations_;
+  }
+
+private:
+  WorkerBalancer();
+  void rebalance();
+
+private:
+  std::mutex mux_;
+  std::vector<Worker> workers_;
+  std::map<BridgeConn *, Bridge> bridges_;
+  uint64_t last_time_;
+  uint64_t passes_;
+  uint32_t hot_passes_;
+  std::atomic<uint64_t> migrations_;
+
+  std::unique_ptr<std::thread> thread_;
+  std::condition_variable cond_;
+  bool run_;
+  bool init_;
+
+  static WorkerBalancer *instance_;
+};
+
+#endif
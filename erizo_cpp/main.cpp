@@ -1,26 +1,52 @@
 #include <unistd.h>
 #include <signal.h>
 
-#include <dtls/DtlsSocket.h>
 #include <BridgeIO.h>
 
 #include "common/utils.h"
 #include "common/config.h"
+#include "common/trace.h"
 #include "core/erizo.h"
+#include "core/startup.h"
+#include "bridge/bridge_mux.h"
 
 LOGGER_DECLARE()
 
 static bool run = true;
+static bool drain = false;
+static bool reload = false;
+static bool dump_trace = false;
 
 void signal_handler(int signo)
 {
     run = false;
 }
 
+void drain_handler(int signo)
+{
+    // a second SIGTERM does not wait for the deadline
+    if (drain)
+        run = false;
+    drain = true;
+}
+
+void reload_handler(int signo)
+{
+    reload = true;
+}
+
+void dump_trace_handler(int signo)
+{
+    dump_trace = true;
+}
+
 int main(int argc, char *argv[])
 {
     srand(time(0));
     signal(SIGINT, signal_handler);
+    signal(SIGTERM, drain_handler);
+    signal(SIGHUP, reload_handler);
+    signal(SIGUSR1, dump_trace_handler);
 
     LOGGER_INIT();
 
@@ -42,24 +68,38 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    dtls::DtlsSocketContext::globalInit();
+    Tracer::getInstance()->init(Config::getInstance()->trace_capacity);
 
-    if (erizo::BridgeIO::getInstance()->init(argv[3], atoi(argv[4]), Config::getInstance()->bridge_io_worker_num))
+    StartupTimes times{};
+    if (Startup::run(argv[1], argv[2], argv[3], atoi(argv[4]), true, &times))
     {
-        ELOG_ERROR("bridge-io initialize failed");
+        ELOG_ERROR("startup failed");
         return 1;
     }
 
-    if (Erizo::getInstance()->init(argv[1], argv[2], argv[3], atoi(argv[4])))
+    while (run)
     {
-        ELOG_ERROR("erizo initialize failed");
-        return 1;
+        sleep(1);
+        if (reload)
+        {
+            reload = false;
+            Config::reload();
+        }
+        if (drain)
+            Erizo::getInstance()->drain(Config::getInstance()->drain_timeout_ms);
+        if (Erizo::getInstance()->isDrained())
+            break;
+        if (dump_trace)
+        {
+            dump_trace = false;
+            char file[256];
+            snprintf(file, sizeof(file), "trace-%d-%ld.bin", getpid(), (long)time(0));
+            Tracer::getInstance()->dump(file);
+        }
     }
 
-    while (run)
-        sleep(10000);
-
     Erizo::getInstance()->close();
+    BridgeMux::getInstance()->close();
     erizo::BridgeIO::getInstance()->close();
     return 0;
 }
\ No newline at end of file
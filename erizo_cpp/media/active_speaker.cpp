@@ -0,0 +1,124 @@
+#include "active_speaker.h"
+
+#include <algorithm>
+
+// no level for this long and a speaker ranks as silent
+#define SPEAKER_STALE_MS 1000
+// a challenger must be this much louder, in percent, to take over
+#define SPEAKER_HYSTERESIS 120
+
+DEFINE_LOGGER(ActiveSpeakerDetector, "ActiveSpeakerDetector");
+
+ActiveSpeakerDetector::Speaker::Speaker(const std::string &stream_id, const Callback &callback) : stream_id_(stream_id),
+                                                                                                 callback_(callback),
+                                                                                                 energy_(0),
+                                                                                                 last_ms_(0),
+                                                                                                 forward_(true)
+{
+}
+
+void ActiveSpeakerDetector::Speaker::onLevel(uint8_t level, uint64_t now_ms)
+{
+    // only the publisher's delivery thread writes, 1/8 per packet settles at 128x
+    uint32_t energy = energy_;
+    energy_ = energy - energy / 8 + (127 - level) * 16;
+    last_ms_ = now_ms;
+}
+
+uint32_t ActiveSpeakerDetector::Speaker::getScore(uint64_t now_ms)
+{
+    if (now_ms - last_ms_ > SPEAKER_STALE_MS)
+        return 0;
+    return energy_;
+}
+
+ActiveSpeakerDetector::ActiveSpeakerDetector(const std::string &room_id, uint32_t last_n, uint32_t interval_ms) : room_id_(room_id),
+                                                                                                                 last_n_(last_n),
+                                                                                                                 interval_ms_(interval_ms),
+                                                                                                                 last_tick_(0)
+{
+}
+
+ActiveSpeakerDetector::~ActiveSpeakerDetector() {}
+
+std::shared_ptr<ActiveSpeakerDetector::Speaker> ActiveSpeakerDetector::addSpeaker(const std::string &stream_id, const Callback &callback)
+{
+    std::shared_ptr<Speaker> speaker = std::make_shared<Speaker>(stream_id, callback);
+    std::unique_lock<std::mutex> lock(mux_);
+    speakers_[stream_id] = speaker;
+    return speaker;
+}
+
+void ActiveSpeakerDetector::removeSpeaker(const std::string &stream_id)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    speakers_.erase(stream_id);
+    ranking_.erase(std::remove(ranking_.begin(), ranking_.end(), stream_id), ranking_.end());
+}
+
+void ActiveSpeakerDetector::tick(uint64_t now_ms)
+{
+    if (now_ms - last_tick_ < interval_ms_)
+        return;
+
+    std::unique_lock<std::mutex> lock(mux_, std::try_to_lock);
+    if (!lock.owns_lock() || now_ms - last_tick_ < interval_ms_)
+        return;
+    last_tick_ = now_ms;
+
+    std::vector<std::pair<uint32_t, std::shared_ptr<Speaker>>> scores;
+    scores.reserve(speakers_.size());
+    for (auto &it : speakers_)
+        scores.push_back({it.second->getScore(now_ms), it.second});
+    std::stable_sort(scores.begin(), scores.end(), [](const std::pair<uint32_t, std::shared_ptr<Speaker>> &a,
+                                                      const std::pair<uint32_t, std::shared_ptr<Speaker>> &b) {
+        return a.first > b.first;
+    });
+    if (scores.empty() || scores[0].first == 0)
+        return;
+
+    // the current dominant speaker keeps the floor unless clearly beaten
+    if (!ranking_.empty() && scores[0].second->stream_id_ != ranking_[0])
+    {
+        for (size_t i = 1; i < scores.size(); i++)
+        {
+            if (scores[i].second->stream_id_ == ranking_[0] &&
+                (uint64_t)scores[i].first * SPEAKER_HYSTERESIS >= (uint64_t)scores[0].first * 100)
+            {
+                std::swap(scores[0], scores[i]);
+                break;
+            }
+        }
+    }
+
+    std::vector<std::string> ranking;
+    ranking.reserve(scores.size());
+    for (size_t i = 0; i < scores.size(); i++)
+    {
+        scores[i].second->forward_ = last_n_ == 0 || i < last_n_;
+        ranking.push_back(scores[i].second->stream_id_);
+    }
+
+    // a new dominant speaker or someone entering the last-N set, not reorders within it
+    bool changed = ranking_.empty() || ranking_[0] != ranking[0];
+    if (!changed && last_n_ > 0)
+    {
+        size_t n = std::min((size_t)last_n_, ranking.size());
+        std::vector<std::string> before(ranking_.begin(), ranking_.begin() + std::min(n, ranking_.size()));
+        std::vector<std::string> after(ranking.begin(), ranking.begin() + n);
+        std::sort(before.begin(), before.end());
+        std::sort(after.begin(), after.end());
+        changed = before != after;
+    }
+    ranking_ = ranking;
+    if (!changed)
+        return;
+    if (last_n_ > 0 && ranking.size() > last_n_)
+        ranking.resize(last_n_);
+
+    ELOG_DEBUG("room-->%s active speaker %s", room_id_, ranking[0]);
+    Callback callback = scores[0].second->callback_;
+    lock.unlock();
+    if (callback)
+        callback(ranking);
+}
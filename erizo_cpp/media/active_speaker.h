@@ -0,0 +1,74 @@
+#ifndef ACTIVE_SPEAKER_H
+#define ACTIVE_SPEAKER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+
+#include <logger.h>
+
+// Ranks the publishers of one room by their smoothed audio level. Levels
+// come in from every publisher's delivery thread; whichever of them first
+// finds the interval over re-ranks, no thread of its own. With last_n set
+// only the top last_n publishers keep sending video to their subscribers.
+class ActiveSpeakerDetector
+{
+  DECLARE_LOGGER();
+
+public:
+  // called on the dominant speaker whenever it or the last-N set changes,
+  // with the ranked stream ids, dominant first, cut to last_n if set
+  typedef std::function<void(const std::vector<std::string> &ranking)> Callback;
+
+  class Speaker
+  {
+  public:
+    Speaker(const std::string &stream_id, const Callback &callback);
+
+    // rfc 6464 level, 0 loudest and 127 silence
+    void onLevel(uint8_t level, uint64_t now_ms);
+    uint32_t getScore(uint64_t now_ms);
+
+    bool isForwarding()
+    {
+      return forward_;
+    }
+
+  private:
+    friend class ActiveSpeakerDetector;
+    std::string stream_id_;
+    Callback callback_;
+    std::atomic<uint32_t> energy_;
+    std::atomic<uint64_t> last_ms_;
+    std::atomic<bool> forward_;
+  };
+
+  ActiveSpeakerDetector(const std::string &room_id, uint32_t last_n, uint32_t interval_ms);
+  ~ActiveSpeakerDetector();
+
+  std::shared_ptr<Speaker> addSpeaker(const std::string &stream_id, const Callback &callback);
+  void removeSpeaker(const std::string &stream_id);
+  void tick(uint64_t now_ms);
+
+  const std::string &getRoomId()
+  {
+    return room_id_;
+  }
+
+private:
+  std::string room_id_;
+  uint32_t last_n_;
+  uint32_t interval_ms_;
+  std::atomic<uint64_t> last_tick_;
+
+  std::mutex mux_;
+  std::map<std::string, std::shared_ptr<Speaker>> speakers_;
+  std::vector<std::string> ranking_;
+};
+
+#endif
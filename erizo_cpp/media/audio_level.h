@@ -0,0 +1,99 @@
+#ifndef AUDIO_LEVEL_H
+#define AUDIO_LEVEL_H
+
+#include <stdint.h>
+
+#define RTP_AUDIO_LEVEL_URI "urn:ietf:params:rtp-hdrext:ssrc-audio-level"
+
+// rtcp shares the rtp ports, rfc 5761 4
+inline bool rtpIsRtcp(const char *buf, int len)
+{
+  if (len < 2)
+    return true;
+  uint8_t pt = (uint8_t)buf[1];
+  return pt >= 192 && pt <= 223;
+}
+
+// caller made sure it is rtp of at least the fixed header
+inline uint32_t rtpSsrc(const char *buf)
+{
+  return ((uint32_t)(uint8_t)buf[8] << 24) | ((uint32_t)(uint8_t)buf[9] << 16) |
+         ((uint32_t)(uint8_t)buf[10] << 8) | (uint32_t)(uint8_t)buf[11];
+}
+
+// fixed header, csrcs and extension, 0 if they run past len
+inline int rtpHeaderLength(const char *buf, int len)
+{
+  if (len < 12)
+    return 0;
+  int pos = 12 + ((uint8_t)buf[0] & 0x0f) * 4;
+  if ((uint8_t)buf[0] & 0x10)
+  {
+    if (pos + 4 > len)
+      return 0;
+    pos += 4 + (((uint8_t)buf[pos + 2] << 8) | (uint8_t)buf[pos + 3]) * 4;
+  }
+  return pos <= len ? pos : 0;
+}
+
+// Audio level of one rtp packet, rfc 6464: 0 is the loudest, 127 silence.
+// Walks the one and two byte extension headers of rfc 8285 for ext_id
+// and nothing else.
+inline bool rtpAudioLevel(const char *buf, int len, uint8_t ext_id, uint8_t &level)
+{
+  if (ext_id == 0 || len < 12 || !((uint8_t)buf[0] & 0x10))
+    return false;
+
+  int pos = 12 + ((uint8_t)buf[0] & 0x0f) * 4;
+  if (pos + 4 > len)
+    return false;
+  uint16_t profile = ((uint8_t)buf[pos] << 8) | (uint8_t)buf[pos + 1];
+  int end = pos + 4 + (((uint8_t)buf[pos + 2] << 8) | (uint8_t)buf[pos + 3]) * 4;
+  if (end > len)
+    return false;
+  pos += 4;
+
+  bool one_byte = profile == 0xbede;
+  if (!one_byte && (profile & 0xfff0) != 0x1000)
+    return false;
+
+  while (pos < end)
+  {
+    // padding
+    if (buf[pos] == 0)
+    {
+      pos++;
+      continue;
+    }
+
+    uint8_t id, ext_len;
+    if (one_byte)
+    {
+      id = (uint8_t)buf[pos] >> 4;
+      ext_len = ((uint8_t)buf[pos] & 0x0f) + 1;
+      pos++;
+      if (id == 15)
+        return false;
+    }
+    else
+    {
+      if (pos + 2 > end)
+        return false;
+      id = (uint8_t)buf[pos];
+      ext_len = (uint8_t)buf[pos + 1];
+      pos += 2;
+    }
+
+    if (pos + ext_len > end)
+      return false;
+    if (id == ext_id)
+    {
+      level = (uint8_t)buf[pos] & 0x7f;
+      return true;
+    }
+    pos += ext_len;
+  }
+  return false;
+}
+
+#endif
@@ -0,0 +1,81 @@
+#include "gop_cache.h"
+
+GopCache::GopCache(uint32_t max_packets) : max_packets_(max_packets),
+                                           count_(0)
+{
+}
+
+GopCache::~GopCache() {}
+
+void GopCache::add(uint32_t ssrc, const std::shared_ptr<erizo::DataPacket> &packet)
+{
+    if (max_packets_ == 0)
+        return;
+
+    auto it = gops_.find(ssrc);
+    if (it == gops_.end())
+    {
+        // nothing decodable before the first keyframe
+        if (!packet->is_keyframe)
+            return;
+        Gop &gop = gops_[ssrc];
+        gop.slots.resize(max_packets_);
+        gop.count = 0;
+        gop.in_keyframe = false;
+        gop.overflow = false;
+        it = gops_.find(ssrc);
+    }
+
+    Gop &gop = it->second;
+    if (packet->is_keyframe)
+    {
+        if (!gop.in_keyframe)
+        {
+            clear(gop);
+            gop.in_keyframe = true;
+        }
+    }
+    else
+    {
+        gop.in_keyframe = false;
+    }
+
+    if (gop.overflow || (gop.count == 0 && !packet->is_keyframe))
+        return;
+
+    if (gop.count == gop.slots.size())
+    {
+        clear(gop);
+        gop.overflow = true;
+        return;
+    }
+    gop.slots[gop.count] = packet;
+    gop.count++;
+    count_++;
+}
+
+void GopCache::clear(Gop &gop)
+{
+    for (uint32_t i = 0; i < gop.count; i++)
+        gop.slots[i].reset();
+    count_ -= gop.count;
+    gop.count = 0;
+    gop.overflow = false;
+}
+
+void GopCache::clear()
+{
+    for (auto &it : gops_)
+        clear(it.second);
+}
+
+std::vector<uint32_t> GopCache::getSSRCs()
+{
+    std::vector<uint32_t> ssrcs;
+    for (auto &it : gops_)
+    {
+        if (it.second.count > 0)
+            ssrcs.push_back(it.first);
+    }
+    return ssrcs;
+}
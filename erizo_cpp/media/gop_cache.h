@@ -0,0 +1,80 @@
+#ifndef GOP_CACHE_H
+#define GOP_CACHE_H
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <stdint.h>
+
+#include <MediaDefinitions.h>
+
+// The video packets of one publisher since its last keyframe, replayed to
+// a subscriber that joins mid GOP so it can decode right away. Every ssrc,
+// that is every simulcast layer, keeps its own GOP, a subscriber only
+// decodes the layer it is on. Slots are allocated once per ssrc and
+// reused; the packets themselves are the ones already delivered, in the
+// subscribers' seq space, nothing downstream writes to them. A GOP longer than the cache is dropped whole
+// until the next keyframe, half a GOP is useless.
+// Only the publisher's delivery thread may call add() and forEach().
+class GopCache
+{
+  struct Gop
+  {
+    std::vector<std::shared_ptr<erizo::DataPacket>> slots;
+    uint32_t count;
+    // inside the keyframe's packets, a keyframe spans several
+    bool in_keyframe;
+    // overflowed, waiting for the next keyframe
+    bool overflow;
+  };
+
+public:
+  GopCache(uint32_t max_packets);
+  ~GopCache();
+
+  void add(uint32_t ssrc, const std::shared_ptr<erizo::DataPacket> &packet);
+  void clear();
+
+  // the GOP of ssrc, nothing if it has none
+  template <typename F>
+  void forEach(uint32_t ssrc, F f)
+  {
+    auto it = gops_.find(ssrc);
+    if (it == gops_.end())
+      return;
+    for (uint32_t i = 0; i < it->second.count; i++)
+      f(it->second.slots[i]);
+  }
+
+  bool has(uint32_t ssrc)
+  {
+    auto it = gops_.find(ssrc);
+    return it != gops_.end() && it->second.count > 0;
+  }
+
+  // the ssrcs with a GOP, in ascending order
+  std::vector<uint32_t> getSSRCs();
+
+  // from any thread, no ssrc has a GOP
+  bool empty()
+  {
+    return count_ == 0;
+  }
+
+  // packets over all ssrcs
+  uint32_t size()
+  {
+    return count_;
+  }
+
+private:
+  void clear(Gop &gop);
+
+private:
+  uint32_t max_packets_;
+  std::map<uint32_t, Gop> gops_;
+  std::atomic<uint32_t> count_;
+};
+
+#endif
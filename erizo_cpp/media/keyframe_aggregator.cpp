@@ -0,0 +1,61 @@
+#include "keyframe_aggregator.h"
+
+KeyframeAggregator::KeyframeAggregator(uint32_t window_ms) : window_ms_(window_ms),
+                                                             last_forward_(0),
+                                                             last_served_(0),
+                                                             pending_(false),
+                                                             received_(0),
+                                                             forwarded_(0),
+                                                             keyframes_(0),
+                                                             served_(0)
+{
+}
+
+KeyframeAggregator::~KeyframeAggregator() {}
+
+bool KeyframeAggregator::onRequest(uint64_t now_ms)
+{
+    received_++;
+    std::unique_lock<std::mutex> lock(mux_);
+    if (last_served_ != 0 && now_ms - last_served_ < window_ms_)
+    {
+        served_++;
+        return false;
+    }
+    if (last_forward_ == 0 || now_ms - last_forward_ >= window_ms_)
+    {
+        last_forward_ = now_ms;
+        pending_ = false;
+        forwarded_++;
+        return true;
+    }
+    pending_ = true;
+    return false;
+}
+
+bool KeyframeAggregator::poll(uint64_t now_ms)
+{
+    if (!pending_)
+        return false;
+
+    std::unique_lock<std::mutex> lock(mux_);
+    if (!pending_ || now_ms - last_forward_ < window_ms_)
+        return false;
+    last_forward_ = now_ms;
+    pending_ = false;
+    forwarded_++;
+    return true;
+}
+
+void KeyframeAggregator::onKeyframe()
+{
+    keyframes_++;
+    // whoever asked since the last request went out gets this one
+    pending_ = false;
+}
+
+void KeyframeAggregator::onServed(uint64_t now_ms)
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    last_served_ = now_ms;
+}
@@ -0,0 +1,45 @@
+#ifndef KEYFRAME_AGGREGATOR_H
+#define KEYFRAME_AGGREGATOR_H
+
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+
+// Coalesces the PLI/FIR of every subscriber of one publisher. The first
+// request goes through, later ones inside window_ms only mark a request as
+// pending; a keyframe from the publisher satisfies it, otherwise it is sent
+// once the window is over.
+class KeyframeAggregator
+{
+public:
+  KeyframeAggregator(uint32_t window_ms);
+  ~KeyframeAggregator();
+
+  // true if the request should reach the publisher now
+  bool onRequest(uint64_t now_ms);
+  // true if a pending request is due, checked on every publisher packet
+  bool poll(uint64_t now_ms);
+  void onKeyframe();
+  // a joining subscriber got the cached GOP, its own request is answered
+  void onServed(uint64_t now_ms);
+
+  uint64_t getReceived() { return received_; }
+  uint64_t getForwarded() { return forwarded_; }
+  uint64_t getKeyframes() { return keyframes_; }
+  uint64_t getServed() { return served_; }
+
+private:
+  uint32_t window_ms_;
+
+  std::mutex mux_;
+  uint64_t last_forward_;
+  uint64_t last_served_;
+  std::atomic<bool> pending_;
+
+  std::atomic<uint64_t> received_;
+  std::atomic<uint64_t> forwarded_;
+  std::atomic<uint64_t> keyframes_;
+  std::atomic<uint64_t> served_;
+};
+
+#endif
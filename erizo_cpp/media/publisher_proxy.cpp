@@ -0,0 +1,694 @@
+#include "publisher_proxy.h"
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+
+#include <OneToManyProcessor.h>
+
+#include "common/config.h"
+#include "common/load_stats.h"
+#include "bridge/bridge_packet.h"
+#include "audio_level.h"
+
+// packets still forwarded once the level drops below the threshold
+#define SILENCE_HANGOVER_PACKETS 10
+// how far behind its layer's latest seq a retransmission still matches
+#define RTX_MATCH_WINDOW 1024
+
+DEFINE_LOGGER(PublisherProxy, "PublisherProxy");
+
+PublisherProxy::PublisherProxy(const std::string &stream_id, std::shared_ptr<erizo::MediaSource> publisher) : stream_id_(stream_id),
+                                                                                                            publisher_(publisher),
+                                                                                                            publisher_fb_sink_(publisher->getFeedbackSink()),
+                                                                                                            packets_(0),
+                                                                                                            handover_(false),
+                                                                                                            otm_(nullptr),
+                                                                                                            aggregator_(Config::getInstance()->keyframe_window_ms),
+                                                                                                            gop_cache_(Config::getInstance()->gop_cache_packets),
+                                                                                                            has_attaches_(false),
+                                                                                                            attached_count_(0),
+                                                                                                            gop_replays_(0),
+                                                                                                            gop_packets_replayed_(0),
+                                                                                                            speaker_detector_(nullptr),
+                                                                                                            speaker_(nullptr),
+                                                                                                            audio_level_ext_id_(0),
+                                                                                                            video_held_back_(false),
+                                                                                                            video_held_(0),
+                                                                                                            silence_level_(Config::getInstance()->silence_level),
+                                                                                                            silence_keepalive_(Config::getInstance()->silence_keepalive),
+                                                                                                            silence_hangover_(0),
+                                                                                                            silent_packets_(0),
+                                                                                                            audio_suppressed_(0)
+{
+    source_fb_sink_ = this;
+    syncSSRC();
+}
+
+PublisherProxy::~PublisherProxy() {}
+
+void PublisherProxy::close()
+{
+    ELOG_INFO("stream-->%s keyframe requests:%lu forwarded:%lu served:%lu keyframes:%lu gop replays:%lu packets:%lu video held:%lu audio suppressed:%lu",
+              stream_id_,
+              (unsigned long)aggregator_.getReceived(),
+              (unsigned long)aggregator_.getForwarded(),
+              (unsigned long)aggregator_.getServed(),
+              (unsigned long)aggregator_.getKeyframes(),
+              (unsigned long)gop_replays_,
+              (unsigned long)gop_packets_replayed_,
+              (unsigned long)video_held_,
+              (unsigned long)audio_suppressed_);
+
+    std::unique_lock<std::mutex> lock(attach_mux_);
+    attaches_.clear();
+    has_attaches_ = false;
+    attached_.clear();
+    attached_count_ = 0;
+    audio_sink_ = nullptr;
+    video_sink_ = nullptr;
+    event_sink_ = nullptr;
+    otm_.reset();
+    otm_ = nullptr;
+    speaker_.reset();
+    speaker_ = nullptr;
+    speaker_detector_.reset();
+    speaker_detector_ = nullptr;
+    publisher_fb_sink_ = nullptr;
+    std::atomic_store(&publisher_, std::shared_ptr<erizo::MediaSource>(nullptr));
+}
+
+void PublisherProxy::setProcessor(std::shared_ptr<erizo::OneToManyProcessor> otm)
+{
+    otm_ = otm;
+    setAudioSink(otm_.get());
+    setVideoSink(otm_.get());
+    setEventSink(otm_.get());
+}
+
+void PublisherProxy::setSpeaker(std::shared_ptr<ActiveSpeakerDetector> detector, std::shared_ptr<ActiveSpeakerDetector::Speaker> speaker)
+{
+    speaker_detector_ = detector;
+    speaker_ = speaker;
+}
+
+void PublisherProxy::addSubscriber(std::shared_ptr<erizo::MediaSink> sink, const InternedId &id, bool all_layers, bool ready)
+{
+    std::unique_lock<std::mutex> lock(attach_mux_);
+    if (otm_ == nullptr)
+        return;
+
+    syncSSRC();
+    Attach attach;
+    attach.id = id;
+    attach.sink = sink;
+    attach.all_layers = all_layers;
+    attach.ready = ready;
+    if (ready && gop_cache_.empty())
+    {
+        attachNow(attach);
+        return;
+    }
+
+    // the subscriber's sdp carries the ssrcs, the OneToManyProcessor would
+    // only hand them over once it is attached
+    if (!ready)
+    {
+        sink->setAudioSinkSSRC(getAudioSourceSSRC());
+        sink->setVideoSinkSSRC(getVideoSourceSSRC());
+    }
+    attaches_.push_back(attach);
+    has_attaches_ = has_attaches_ || ready;
+}
+
+void PublisherProxy::setSubscriberReady(const InternedId &id, const std::shared_ptr<erizo::MediaSink> &sink)
+{
+    std::unique_lock<std::mutex> lock(attach_mux_);
+    if (otm_ == nullptr)
+        return;
+
+    for (auto it = attaches_.begin(); it != attaches_.end(); it++)
+    {
+        if (it->id != id || it->sink != sink || it->ready)
+            continue;
+        if (gop_cache_.empty())
+        {
+            attachNow(*it);
+            attaches_.erase(it);
+            return;
+        }
+        it->ready = true;
+        has_attaches_ = true;
+        return;
+    }
+}
+
+void PublisherProxy::attachNow(const Attach &attach)
+{
+    otm_->addSubscriber(attach.sink, subscriberKey(attach.id));
+    attached_.insert(attach.id);
+    attached_count_ = attached_.size();
+}
+
+void PublisherProxy::removeSubscriber(const InternedId &id)
+{
+    std::unique_lock<std::mutex> lock(attach_mux_);
+    for (auto it = attaches_.begin(); it != attaches_.end(); it++)
+    {
+        if (it->id == id)
+        {
+            attaches_.erase(it);
+            has_attaches_ = std::any_of(attaches_.begin(), attaches_.end(), [](const Attach &attach) { return attach.ready; });
+            return;
+        }
+    }
+    if (otm_ != nullptr)
+        otm_->removeSubscriber(subscriberKey(id));
+    attached_.erase(id);
+    attached_count_ = attached_.size();
+}
+
+void PublisherProxy::replaceSubscriber(std::shared_ptr<erizo::MediaSink> sink, const InternedId &id)
+{
+    std::unique_lock<std::mutex> lock(attach_mux_);
+    for (Attach &attach : attaches_)
+    {
+        if (attach.id == id)
+        {
+            attach.sink = sink;
+            return;
+        }
+    }
+    // the OneToManyProcessor substitutes the sink under the same key
+    if (otm_ != nullptr && attached_.find(id) != attached_.end())
+        otm_->addSubscriber(sink, subscriberKey(id));
+}
+
+void PublisherProxy::setPublisher(std::shared_ptr<erizo::MediaSource> publisher)
+{
+    std::atomic_store(&publisher_, publisher);
+    publisher_fb_sink_ = publisher->getFeedbackSink();
+    syncSSRC();
+}
+
+void PublisherProxy::processAttaches()
+{
+    std::unique_lock<std::mutex> lock(attach_mux_);
+    if (otm_ == nullptr)
+        return;
+
+    for (auto it = attaches_.begin(); it != attaches_.end();)
+    {
+        if (!it->ready)
+        {
+            it++;
+            continue;
+        }
+        Attach attach = *it;
+        it = attaches_.erase(it);
+
+        // in the OneToManyProcessor first so the sink has its ssrcs, nothing
+        // live reaches it before the GOP since this is the delivery thread
+        attachNow(attach);
+        uint32_t replayed = 0;
+        uint64_t replayed_bytes = 0;
+        if (attach.all_layers)
+        {
+            for (uint32_t ssrc : gop_cache_.getSSRCs())
+                replayed += replay(attach.sink, ssrc, replayed_bytes);
+        }
+        else
+        {
+            // simulcast layers are listed lowest first, a layer may be paused
+            for (uint32_t ssrc : getVideoSourceSSRCList())
+            {
+                if (gop_cache_.has(ssrc))
+                {
+                    replayed = replay(attach.sink, ssrc, replayed_bytes);
+                    break;
+                }
+            }
+        }
+        // the subscriber's transport is up, the keyframe it asked for or
+        // is about to ask for is in what it just got
+        if (replayed > 0)
+        {
+            LoadStats::onEgress(replayed, replayed_bytes);
+            gop_replays_++;
+            gop_packets_replayed_ += replayed;
+            aggregator_.onServed(bridgeNowMs());
+        }
+    }
+    has_attaches_ = false;
+}
+
+uint32_t PublisherProxy::replay(const std::shared_ptr<erizo::MediaSink> &sink, uint32_t ssrc, uint64_t &bytes)
+{
+    uint32_t replayed = 0;
+    gop_cache_.forEach(ssrc, [&sink, &replayed, &bytes](const std::shared_ptr<erizo::DataPacket> &packet) {
+        sink->deliverVideoData(packet);
+        replayed++;
+        bytes += packet->length;
+    });
+    return replayed;
+}
+
+void PublisherProxy::syncSSRC()
+{
+    std::shared_ptr<erizo::MediaSource> publisher = std::atomic_load(&publisher_);
+    if (publisher == nullptr)
+        return;
+    setVideoSourceSSRCList(publisher->getVideoSourceSSRCList());
+    setAudioSourceSSRC(publisher->getAudioSourceSSRC());
+}
+
+int PublisherProxy::sendPLI()
+{
+    std::shared_ptr<erizo::MediaSource> publisher = std::atomic_load(&publisher_);
+    if (!aggregator_.onRequest(bridgeNowMs()) || publisher == nullptr)
+        return 0;
+    return publisher->sendPLI();
+}
+
+int PublisherProxy::deliverAudioData_(std::shared_ptr<erizo::DataPacket> packet)
+{
+    std::unique_lock<std::mutex> handover_lock(handover_mux_, std::defer_lock);
+    if (handover_)
+        handover_lock.lock();
+    LoadStats::onIngress(packet->length);
+    packets_++;
+    if (has_attaches_)
+        processAttaches();
+
+    if (!rtpIsRtcp(packet->data, packet->length))
+    {
+        uint8_t level = 127;
+        bool has_level = rtpAudioLevel(packet->data, packet->length, audio_level_ext_id_, level);
+        if (has_level && speaker_ != nullptr)
+        {
+            uint64_t now = bridgeNowMs();
+            speaker_->onLevel(level, now);
+            speaker_detector_->tick(now);
+        }
+        if (!forwardAudio(packet, has_level, level))
+            return packet->length;
+    }
+
+    uint32_t subscribers = attached_count_;
+    if (subscribers > 0)
+        LoadStats::onEgress(subscribers, (uint64_t)subscribers * packet->length);
+    erizo::MediaSink *sink = audio_sink_;
+    if (sink != nullptr)
+        sink->deliverAudioData(packet);
+    return packet->length;
+}
+
+int PublisherProxy::deliverVideoData_(std::shared_ptr<erizo::DataPacket> packet)
+{
+    std::unique_lock<std::mutex> handover_lock(handover_mux_, std::defer_lock);
+    if (handover_)
+        handover_lock.lock();
+    LoadStats::onIngress(packet->length);
+    packets_++;
+    uint64_t now = bridgeNowMs();
+    if (packet->is_keyframe)
+        aggregator_.onKeyframe();
+    else if (aggregator_.poll(now))
+    {
+        std::shared_ptr<erizo::MediaSource> publisher = std::atomic_load(&publisher_);
+        if (publisher != nullptr)
+            publisher->sendPLI();
+    }
+
+    if (has_attaches_)
+        processAttaches();
+    // shorter than an rtp header is nothing to cache or hold back either
+    if (packet->length >= 12 && !rtpIsRtcp(packet->data, packet->length))
+    {
+        if (!forwardVideo(packet, now))
+            return packet->length;
+        gop_cache_.add(rtpSsrc(packet->data), packet);
+    }
+
+    uint32_t subscribers = attached_count_;
+    if (subscribers > 0)
+        LoadStats::onEgress(subscribers, (uint64_t)subscribers * packet->length);
+    erizo::MediaSink *sink = video_sink_;
+    if (sink != nullptr)
+        sink->deliverVideoData(packet);
+    return packet->length;
+}
+
+PublisherProxy::VideoTrack &PublisherProxy::getVideoTrack(uint32_t ssrc)
+{
+    // only this thread inserts, finding without the lock is safe here
+    auto it = video_tracks_.find(ssrc);
+    if (it != video_tracks_.end())
+        return it->second;
+    std::unique_lock<std::mutex> lock(video_mux_);
+    return video_tracks_[ssrc];
+}
+
+SeqRewriter *PublisherProxy::findRewriter(uint32_t ssrc)
+{
+    if (isAudioSourceSSRC(ssrc))
+        return &audio_seq_;
+    std::unique_lock<std::mutex> lock(video_mux_);
+    auto it = video_tracks_.find(ssrc);
+    return it != video_tracks_.end() ? &it->second.seq : nullptr;
+}
+
+bool PublisherProxy::forwardVideo(std::shared_ptr<erizo::DataPacket> &packet, uint64_t now_ms)
+{
+    VideoTrack &track = getVideoTrack(rtpSsrc(packet->data));
+    classify(track, packet);
+    if (!track.rtx)
+    {
+        track.has_last = true;
+        track.last = ((uint8_t)packet->data[2] << 8) | (uint8_t)packet->data[3];
+    }
+    if (speaker_ != nullptr && !speaker_->isForwarding())
+    {
+        // a late joiner would only get a frozen frame out of the old GOP
+        if (!video_held_back_)
+            gop_cache_.clear();
+        video_held_back_ = true;
+        video_held_++;
+        track.seq.drop();
+        return false;
+    }
+
+    if (video_held_back_)
+    {
+        // back in the last-N, subscribers can only pick up at a keyframe,
+        // each layer at its own; rtx never is one, it follows its layer
+        video_held_back_ = false;
+        for (auto &it : video_tracks_)
+            it.second.waiting_keyframe = !it.second.rtx;
+        std::shared_ptr<erizo::MediaSource> publisher = std::atomic_load(&publisher_);
+        if (aggregator_.onRequest(now_ms) && publisher != nullptr)
+            publisher->sendPLI();
+    }
+    if (track.rtx)
+        return forwardRtx(packet, track);
+    if (track.waiting_keyframe)
+    {
+        if (!packet->is_keyframe)
+        {
+            video_held_++;
+            track.seq.drop();
+            return false;
+        }
+        track.waiting_keyframe = false;
+    }
+
+    rewriteSeq(packet, track.seq);
+    return true;
+}
+
+void PublisherProxy::classify(VideoTrack &track, const std::shared_ptr<erizo::DataPacket> &packet)
+{
+    if (track.classified)
+        return;
+    uint32_t ssrc = rtpSsrc(packet->data);
+    track.pt = (uint8_t)packet->data[1] & 0x7f;
+    std::vector<uint32_t> layers = getVideoSourceSSRCList();
+    if (layers.empty() || isVideoSourceSSRC(ssrc))
+    {
+        track.classified = !layers.empty();
+        return;
+    }
+
+    // rtx has a payload type of its own, rfc 4588 8.1; an unlisted ssrc
+    // sharing a layer's is a layer the source did not announce
+    bool layer_seen = false;
+    for (auto &it : video_tracks_)
+    {
+        if (&it.second == &track || !isVideoSourceSSRC(it.first) || !it.second.has_last)
+            continue;
+        layer_seen = true;
+        if (it.second.pt == track.pt)
+        {
+            track.classified = true;
+            return;
+        }
+    }
+    // a layer packet first, whatever arrives ahead of it stays a layer
+    if (layer_seen)
+    {
+        track.classified = true;
+        track.rtx = true;
+    }
+}
+
+bool PublisherProxy::forwardRtx(std::shared_ptr<erizo::DataPacket> &packet, VideoTrack &track)
+{
+    int header = rtpHeaderLength(packet->data, packet->length);
+    if (header == 0 || header + 2 > packet->length)
+    {
+        // padding only, nothing it retransmits
+        rewriteSeq(packet, track.seq);
+        return true;
+    }
+    uint16_t osn = ((uint8_t)packet->data[header] << 8) | (uint8_t)packet->data[header + 1];
+
+    VideoTrack *primary = matchPrimary(track, osn);
+    if (primary == nullptr)
+    {
+        // unmatched, it can only go out as it came while no layer moved
+        for (auto &it : video_tracks_)
+        {
+            if (!it.second.rtx && (it.second.waiting_keyframe || !it.second.seq.isIdentity()))
+            {
+                video_held_++;
+                track.seq.drop();
+                return false;
+            }
+        }
+        rewriteSeq(packet, track.seq);
+        return true;
+    }
+    if (primary->waiting_keyframe)
+    {
+        video_held_++;
+        track.seq.drop();
+        return false;
+    }
+
+    uint16_t out = osn;
+    if (!primary->seq.lookup(osn, out))
+    {
+        video_held_++;
+        track.seq.drop();
+        return false;
+    }
+    std::shared_ptr<erizo::DataPacket> original = packet;
+    rewriteSeq(packet, track.seq);
+    if (out != osn)
+    {
+        // unless rewriteSeq copied it already, the publisher's packet is
+        // never written to
+        if (packet == original)
+            packet = std::make_shared<erizo::DataPacket>(*packet);
+        packet->data[header] = (char)(out >> 8);
+        packet->data[header + 1] = (char)out;
+    }
+    return true;
+}
+
+PublisherProxy::VideoTrack *PublisherProxy::matchPrimary(VideoTrack &rtx, uint16_t osn)
+{
+    if (rtx.primary != nullptr)
+        return rtx.primary;
+
+    // a retransmission is of something its layer sent lately; simulcast
+    // layers start at random seqs, two covering osn at once is rare and
+    // leaves it to the next retransmission
+    VideoTrack *match = nullptr;
+    for (auto &it : video_tracks_)
+    {
+        if (it.second.rtx || !it.second.has_last)
+            continue;
+        uint16_t age = it.second.last - osn;
+        if (age >= RTX_MATCH_WINDOW)
+            continue;
+        if (match != nullptr)
+            return nullptr;
+        match = &it.second;
+    }
+    rtx.primary = match;
+    return match;
+}
+
+bool PublisherProxy::forwardAudio(std::shared_ptr<erizo::DataPacket> &packet, bool has_level, uint8_t level)
+{
+    if (silence_level_ > 0 && has_level)
+    {
+        if (level < silence_level_)
+        {
+            silence_hangover_ = SILENCE_HANGOVER_PACKETS;
+            silent_packets_ = 0;
+        }
+        else if (silence_hangover_ > 0)
+        {
+            // the tail of a word is quieter than its start
+            silence_hangover_--;
+        }
+        else if (silence_keepalive_ == 0 || ++silent_packets_ % silence_keepalive_ != 0)
+        {
+            audio_suppressed_++;
+            audio_seq_.drop();
+            return false;
+        }
+    }
+
+    rewriteSeq(packet, audio_seq_);
+    return true;
+}
+
+void PublisherProxy::rewriteSeq(std::shared_ptr<erizo::DataPacket> &packet, SeqRewriter &rewriter)
+{
+    if (packet->length < 12)
+        return;
+    uint16_t seq = ((uint8_t)packet->data[2] << 8) | (uint8_t)packet->data[3];
+    uint16_t out = rewriter.forward(seq);
+    if (out != seq)
+    {
+        packet = std::make_shared<erizo::DataPacket>(*packet);
+        packet->data[2] = (char)(out >> 8);
+        packet->data[3] = (char)out;
+    }
+}
+
+int PublisherProxy::deliverEvent_(erizo::MediaEventPtr event)
+{
+    erizo::MediaSink *sink = event_sink_;
+    if (sink != nullptr)
+        sink->deliverEvent(event);
+    return 1;
+}
+
+int PublisherProxy::deliverFeedback_(std::shared_ptr<erizo::DataPacket> packet)
+{
+    erizo::FeedbackSink *sink = publisher_fb_sink_;
+    if (sink == nullptr)
+        return packet->length;
+
+    packet->length = filterFeedback(packet->data, packet->length);
+    if (packet->length > 0)
+        sink->deliverFeedback(packet);
+    return packet->length;
+}
+
+int PublisherProxy::filterFeedback(char *buf, int len)
+{
+    char out[sizeof(erizo::DataPacket::data)];
+    int out_len = 0;
+    uint64_t now = bridgeNowMs();
+
+    // walk the compound packet, keep everything but held back PLI/FIR
+    int pos = 0;
+    while (pos + 4 <= len)
+    {
+        uint8_t fmt = (uint8_t)buf[pos] & 0x1f;
+        uint8_t pt = (uint8_t)buf[pos + 1];
+        uint16_t words;
+        memcpy(&words, buf + pos + 2, 2);
+        int block_len = (ntohs(words) + 1) * 4;
+        if (pos + block_len > len)
+            break;
+
+        // PSFB PLI or FIR, rfc 4585 6.3.1 and rfc 5104 4.3.1
+        bool keyframe_request = pt == 206 && (fmt == 1 || fmt == 4);
+        if (keyframe_request && !aggregator_.onRequest(now))
+        {
+            pos += block_len;
+            continue;
+        }
+
+        // generic NACK, rfc 4585 6.2.1, in the seqs the subscribers saw
+        if (pt == 205 && fmt == 1 && block_len >= 12)
+        {
+            uint32_t media_ssrc;
+            memcpy(&media_ssrc, buf + pos + 8, 4);
+            SeqRewriter *rewriter = findRewriter(ntohl(media_ssrc));
+            if (rewriter != nullptr && !rewriter->isIdentity())
+            {
+                out_len += restoreNack(buf + pos, block_len, out + out_len, sizeof(out) - out_len, *rewriter);
+                pos += block_len;
+                continue;
+            }
+        }
+
+        memcpy(out + out_len, buf + pos, block_len);
+        out_len += block_len;
+        pos += block_len;
+    }
+
+    memcpy(buf, out, out_len);
+    return out_len;
+}
+
+int PublisherProxy::restoreNack(const char *block, int block_len, char *out, int room, SeqRewriter &rewriter)
+{
+    // every seq the PID/BLP pairs name is restored on its own, a run of
+    // drops between two of them moves them apart by more than a BLP spans
+    memcpy(out, block, 12);
+    int len = 12;
+    bool open = false;
+    uint16_t pid = 0;
+    uint16_t blp = 0;
+    auto append = [out, room, &len, &pid, &blp]() {
+        if (len + 4 > room)
+            return false;
+        uint16_t value = htons(pid);
+        memcpy(out + len, &value, 2);
+        value = htons(blp);
+        memcpy(out + len + 2, &value, 2);
+        len += 4;
+        return true;
+    };
+
+    // what does not fit room is left out, the subscriber NACKs it again
+    bool full = false;
+    for (int i = 12; i + 4 <= block_len && !full; i += 4)
+    {
+        uint16_t fci_pid;
+        uint16_t fci_blp;
+        memcpy(&fci_pid, block + i, 2);
+        memcpy(&fci_blp, block + i + 2, 2);
+        fci_pid = ntohs(fci_pid);
+        fci_blp = ntohs(fci_blp);
+        for (int bit = -1; bit < 16 && !full; bit++)
+        {
+            if (bit >= 0 && !(fci_blp & (1 << bit)))
+                continue;
+            uint16_t seq = rewriter.restore(fci_pid + bit + 1);
+            uint16_t distance = seq - pid - 1;
+            if (open && (seq == pid || distance < 16))
+            {
+                if (seq != pid)
+                    blp |= 1 << distance;
+                continue;
+            }
+            if (open && !append())
+            {
+                full = true;
+                open = false;
+                break;
+            }
+            open = true;
+            pid = seq;
+            blp = 0;
+        }
+    }
+    if (open)
+        append();
+    if (len == 12)
+        return 0;
+
+    uint16_t words = htons(len / 4 - 1);
+    memcpy(out + 2, &words, 2);
+    return len;
+}
@@ -0,0 +1,209 @@
+#ifndef PUBLISHER_PROXY_H
+#define PUBLISHER_PROXY_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#include <logger.h>
+#include <MediaDefinitions.h>
+
+#include "common/interned_id.h"
+#include "keyframe_aggregator.h"
+#include "gop_cache.h"
+#include "seq_rewriter.h"
+#include "active_speaker.h"
+
+namespace erizo
+{
+class OneToManyProcessor;
+}; // namespace erizo
+
+// Sits between a publisher (MediaStream, BridgeMediaStream or
+// BridgeMuxSource) and its OneToManyProcessor. Media passes straight
+// through; the subscribers' feedback comes back through here so their
+// PLI/FIR can be coalesced into one request per keyframe window. Keeps
+// the current GOP and hands it to subscribers that join mid GOP, feeds
+// the room's active speaker ranking and holds video back while the
+// publisher is outside the room's last-N, and its silent audio. Everything
+// past the proxy, the GOP cache, the OneToManyProcessor and whatever its
+// subscribers keep, is in the subscribers' seq space.
+class PublisherProxy : public erizo::MediaSink,
+                       public erizo::MediaSource,
+                       public erizo::FeedbackSink
+{
+  DECLARE_LOGGER();
+
+  struct Attach
+  {
+    InternedId id;
+    std::shared_ptr<erizo::MediaSink> sink;
+    bool all_layers;
+    // a subscriber's transport is up, what reaches it is no longer dropped
+    bool ready;
+  };
+
+  // one per video ssrc, every simulcast layer and rtx has its own seq space
+  struct VideoTrack
+  {
+    VideoTrack() : classified(false), rtx(false), pt(0), waiting_keyframe(false), has_last(false), last(0), primary(nullptr) {}
+    SeqRewriter seq;
+    // a simulcast layer or its rtx, told apart once the source's ssrcs and
+    // a layer's payload type are known
+    bool classified;
+    bool rtx;
+    uint8_t pt;
+    // layers only: back from a last-N hold, the layer resumes at its own
+    // keyframe, its rtx along with it
+    bool waiting_keyframe;
+    // layers only, the publisher's latest seq, what retransmissions match
+    bool has_last;
+    uint16_t last;
+    // rtx only, the layer it retransmits, nullptr until one matched
+    VideoTrack *primary;
+  };
+
+public:
+  PublisherProxy(const std::string &stream_id, std::shared_ptr<erizo::MediaSource> publisher);
+  ~PublisherProxy();
+
+  void close() override;
+  int sendPLI() override;
+  // the proxy feeds otm, which in turn must take the proxy as its publisher
+  void setProcessor(std::shared_ptr<erizo::OneToManyProcessor> otm);
+  // a sink that is not ready waits outside the fan-out until
+  // setSubscriberReady. Then, with a GOP cached, it is attached on the
+  // delivery thread right before the next packet, after the cached GOP: of
+  // the lowest simulcast layer, where a subscriber starts, or of every
+  // layer for a bridge, whose far end has subscribers on any of them
+  void addSubscriber(std::shared_ptr<erizo::MediaSink> sink, const InternedId &id, bool all_layers, bool ready);
+  // once the subscriber's ICE and DTLS are up, ignored for a sink that is
+  // no longer waiting under id
+  void setSubscriberReady(const InternedId &id, const std::shared_ptr<erizo::MediaSink> &sink);
+  void removeSubscriber(const InternedId &id);
+  // hands id's place in the fan-out to sink, nothing replayed: the far end
+  // already has the stream, only the object carrying it changed
+  void replaceSubscriber(std::shared_ptr<erizo::MediaSink> sink, const InternedId &id);
+  // a publisher rebuilt elsewhere, keyframe requests and feedback go to
+  // it from now on
+  void setPublisher(std::shared_ptr<erizo::MediaSource> publisher);
+  // while both the old and the rebuilt publisher may deliver, deliveries
+  // are serialized, the delivery path assumes a single thread
+  void setHandover(bool handover)
+  {
+    handover_ = handover;
+  }
+  // before any media flows
+  void setSpeaker(std::shared_ptr<ActiveSpeakerDetector> detector, std::shared_ptr<ActiveSpeakerDetector::Speaker> speaker);
+  // as negotiated in the publisher's sdp, 0 leaves audio levels alone
+  void setAudioLevelExtId(uint8_t ext_id)
+  {
+    audio_level_ext_id_ = ext_id;
+  }
+
+  uint64_t getKeyframeRequests() { return aggregator_.getReceived(); }
+  uint64_t getKeyframeRequestsForwarded() { return aggregator_.getForwarded(); }
+  uint64_t getKeyframeRequestsServed() { return aggregator_.getServed(); }
+  uint64_t getKeyframes() { return aggregator_.getKeyframes(); }
+  uint64_t getGopReplays() { return gop_replays_; }
+  uint64_t getGopPacketsReplayed() { return gop_packets_replayed_; }
+  uint64_t getVideoHeld() { return video_held_; }
+  uint64_t getAudioSuppressed() { return audio_suppressed_; }
+  // audio and video from the publisher
+  uint64_t getPackets() { return packets_; }
+
+private:
+  int deliverAudioData_(std::shared_ptr<erizo::DataPacket> packet) override;
+  int deliverVideoData_(std::shared_ptr<erizo::DataPacket> packet) override;
+  int deliverEvent_(erizo::MediaEventPtr event) override;
+  int deliverFeedback_(std::shared_ptr<erizo::DataPacket> packet) override;
+  // the publisher's ssrcs are only known once its sdp is processed, the
+  // OneToManyProcessor copies ours into every subscriber it adds
+  void syncSSRC();
+  // drops PLI/FIR blocks the aggregator holds back and maps NACKed seqs
+  // back to the publisher's, returns the new length
+  int filterFeedback(char *buf, int len);
+  // a NACK block mapped to the publisher's seqs into out, returns its
+  // length, 0 if it does not fit room
+  static int restoreNack(const char *block, int block_len, char *out, int room, SeqRewriter &rewriter);
+  // delivery thread, created on the ssrc's first packet
+  VideoTrack &getVideoTrack(uint32_t ssrc);
+  // feedback path, nullptr for an ssrc nothing was forwarded of
+  SeqRewriter *findRewriter(uint32_t ssrc);
+  // false if last-N holds this packet back, otherwise packet may have
+  // been replaced by a copy in the subscribers' seq space
+  bool forwardVideo(std::shared_ptr<erizo::DataPacket> &packet, uint64_t now_ms);
+  // delivery thread, on a track's first packets
+  void classify(VideoTrack &track, const std::shared_ptr<erizo::DataPacket> &packet);
+  // an rtx packet, rfc 4588, goes with the layer it retransmits and its
+  // original seq is rewritten in that layer's space; as forwardVideo
+  bool forwardRtx(std::shared_ptr<erizo::DataPacket> &packet, VideoTrack &track);
+  // delivery thread, the layer whose recent seqs cover osn if only one does
+  VideoTrack *matchPrimary(VideoTrack &rtx, uint16_t osn);
+  // false if silence suppression drops this packet, packet as above
+  bool forwardAudio(std::shared_ptr<erizo::DataPacket> &packet, bool has_level, uint8_t level);
+  // the publisher's packet is never written to, its source may still hold
+  // it (the FEC and reorder state of a bridge source), so a seq that moves
+  // is written to a copy that replaces packet
+  void rewriteSeq(std::shared_ptr<erizo::DataPacket> &packet, SeqRewriter &rewriter);
+  // delivery thread: attaches ready subscribers behind the cached GOP
+  void processAttaches();
+  // under attach_mux_, straight into the fan-out, nothing replayed
+  void attachNow(const Attach &attach);
+  // the cached GOP of ssrc to sink, returns the packets replayed
+  uint32_t replay(const std::shared_ptr<erizo::MediaSink> &sink, uint32_t ssrc, uint64_t &bytes);
+  // OneToManyProcessor key, the decimal handle: unique among the proxy's
+  // subscribers and short enough to never leave the string's inline buffer
+  static std::string subscriberKey(const InternedId &id)
+  {
+    return std::to_string(id.handle());
+  }
+
+private:
+  std::string stream_id_;
+  // atomic_load/atomic_store, setPublisher runs off the media threads
+  std::shared_ptr<erizo::MediaSource> publisher_;
+  std::atomic<erizo::FeedbackSink *> publisher_fb_sink_;
+  std::atomic<uint64_t> packets_;
+  std::atomic<bool> handover_;
+  std::mutex handover_mux_;
+  std::shared_ptr<erizo::OneToManyProcessor> otm_;
+  KeyframeAggregator aggregator_;
+  GopCache gop_cache_;
+
+  // held while attaching, so a removal never races the OneToManyProcessor add
+  std::mutex attach_mux_;
+  std::vector<Attach> attaches_;
+  // some of attaches_ are ready
+  std::atomic<bool> has_attaches_;
+  // in the OneToManyProcessor, the count weighs the egress of every packet
+  std::set<InternedId> attached_;
+  std::atomic<uint32_t> attached_count_;
+
+  std::atomic<uint64_t> gop_replays_;
+  std::atomic<uint64_t> gop_packets_replayed_;
+
+  std::shared_ptr<ActiveSpeakerDetector> speaker_detector_;
+  std::shared_ptr<ActiveSpeakerDetector::Speaker> speaker_;
+  std::atomic<uint8_t> audio_level_ext_id_;
+  // delivery thread only, but for the rewriters the feedback path looks
+  // up under video_mux_; tracks are never removed
+  std::mutex video_mux_;
+  std::map<uint32_t, VideoTrack> video_tracks_;
+  bool video_held_back_;
+  std::atomic<uint64_t> video_held_;
+
+  // audio below silence_level_ is dropped but for one packet in silence_keepalive_
+  SeqRewriter audio_seq_;
+  uint8_t silence_level_;
+  uint32_t silence_keepalive_;
+  uint32_t silence_hangover_;
+  uint32_t silent_packets_;
+  std::atomic<uint64_t> audio_suppressed_;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include "seq_rewriter.h"
+
+SeqRewriter::SeqRewriter() : offset_(0),
+                             has_last_(false),
+                             last_(0),
+                             dropping_(false),
+                             shift_count_(0)
+{
+}
+
+SeqRewriter::~SeqRewriter() {}
+
+void SeqRewriter::drop()
+{
+    // nothing forwarded yet, nothing the subscribers could see a gap after
+    if (has_last_)
+        dropping_ = true;
+}
+
+uint16_t SeqRewriter::forward(uint16_t seq)
+{
+    // a late packet from before the run leaves it pending
+    if (dropping_ && (int16_t)(seq - last_) > 0)
+    {
+        // the whole run since the last forwarded packet disappears
+        uint16_t gap = seq - last_ - 1;
+        dropping_ = false;
+        if (gap != 0)
+        {
+            offset_ += gap;
+            std::unique_lock<std::mutex> lock(shift_mux_);
+            Shift &shift = shifts_[shift_count_ % SEQ_REWRITER_SHIFTS];
+            shift.start = seq - offset_;
+            shift.offset = offset_;
+            shift_count_++;
+        }
+    }
+    if (!has_last_ || (int16_t)(seq - last_) > 0)
+        last_ = seq;
+    has_last_ = true;
+    return seq - offset_;
+}
+
+bool SeqRewriter::lookup(uint16_t seq, uint16_t &out)
+{
+    std::unique_lock<std::mutex> lock(shift_mux_);
+    uint32_t count = shift_count_;
+    uint32_t kept = count < SEQ_REWRITER_SHIFTS ? count : SEQ_REWRITER_SHIFTS;
+    for (uint32_t i = 1; i <= kept; i++)
+    {
+        const Shift &shift = shifts_[(count - i) % SEQ_REWRITER_SHIFTS];
+        uint16_t start = shift.start + shift.offset;
+        if ((int16_t)(seq - start) >= 0)
+        {
+            out = seq - shift.offset;
+            return true;
+        }
+        // the run of drops right before the shift
+        uint16_t before = i < kept ? shifts_[(count - i - 1) % SEQ_REWRITER_SHIFTS].offset : 0;
+        if (i < kept || count <= SEQ_REWRITER_SHIFTS)
+        {
+            if ((int16_t)(seq - (uint16_t)(start - (uint16_t)(shift.offset - before))) >= 0)
+                return false;
+        }
+    }
+    if (count <= SEQ_REWRITER_SHIFTS)
+    {
+        out = seq;
+        return true;
+    }
+    out = seq - shifts_[count % SEQ_REWRITER_SHIFTS].offset;
+    return true;
+}
+
+uint16_t SeqRewriter::restore(uint16_t seq)
+{
+    std::unique_lock<std::mutex> lock(shift_mux_);
+    uint32_t count = shift_count_;
+    uint32_t kept = count < SEQ_REWRITER_SHIFTS ? count : SEQ_REWRITER_SHIFTS;
+    for (uint32_t i = 1; i <= kept; i++)
+    {
+        const Shift &shift = shifts_[(count - i) % SEQ_REWRITER_SHIFTS];
+        if ((int16_t)(seq - shift.start) >= 0)
+            return seq + shift.offset;
+    }
+    // before the first shift nothing was moved
+    if (count <= SEQ_REWRITER_SHIFTS)
+        return seq;
+    return seq + shifts_[count % SEQ_REWRITER_SHIFTS].offset;
+}
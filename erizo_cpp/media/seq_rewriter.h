@@ -0,0 +1,60 @@
+#ifndef SEQ_REWRITER_H
+#define SEQ_REWRITER_H
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+
+// offset changes remembered for restore(), a NACK older than that many
+// runs of drops maps with the oldest
+#define SEQ_REWRITER_SHIFTS 16
+
+// Keeps the rtp seq of one ssrc gapless for the subscribers while the
+// proxy holds packets back, so they do not NACK what was never meant to
+// reach them. Timestamps are left alone, a pause simply shows as one.
+// drop() and forward() come from the delivery thread, restore() from
+// the feedback path.
+class SeqRewriter
+{
+  // from subscriber seq start on, publisher seq is subscriber seq + offset
+  struct Shift
+  {
+    uint16_t start;
+    uint16_t offset;
+  };
+
+public:
+  SeqRewriter();
+  ~SeqRewriter();
+
+  void drop();
+  // the seq the subscribers see for publisher seq
+  uint16_t forward(uint16_t seq);
+  // back from a subscriber seq to the publisher's, for NACKs, with the
+  // offset that seq went out with
+  uint16_t restore(uint16_t seq);
+  // the subscriber seq an already forwarded publisher seq went out as,
+  // for the original seq a retransmission carries; false if seq was in a
+  // run of drops, the subscribers never saw it
+  bool lookup(uint16_t seq, uint16_t &out);
+
+  // nothing dropped so far, every seq is the publisher's
+  bool isIdentity()
+  {
+    return shift_count_ == 0;
+  }
+
+private:
+  // delivery thread only
+  uint16_t offset_;
+  bool has_last_;
+  uint16_t last_;
+  bool dropping_;
+
+  // forward() adds, restore() reads
+  std::mutex shift_mux_;
+  Shift shifts_[SEQ_REWRITER_SHIFTS];
+  std::atomic<uint32_t> shift_count_;
+};
+
+#endif
@@ -6,90 +6,365 @@
 #include <OneToManyProcessor.h>
 #include <thread/IOThreadPool.h>
 
+#include "common/config.h"
+#include "core/worker_balancer.h"
+#include "bridge/bridge_mux.h"
+#include "bridge/bridge_mux_stream.h"
+#include "media/publisher_proxy.h"
+
 BridgeConn::BridgeConn() : bridge_media_stream_(nullptr),
                            otm_processor_(nullptr),
-                           bridge_stream_id_(""),
-                           src_stream_id_(""),
+                           publisher_proxy_(nullptr),
+                           mux_sink_(nullptr),
+                           mux_source_(nullptr),
+                           mux_link_(nullptr),
+                           io_worker_(nullptr),
+                           migrating_(false),
+                           retired_stream_(nullptr),
+                           retired_worker_(nullptr),
+                           port_(0),
+                           video_ssrc_(0),
+                           audio_ssrc_(0),
+                           resource_cost_(),
+                           bridge_stream_id_(),
+                           src_stream_id_(),
                            init_(false)
 {
 }
 
 BridgeConn::~BridgeConn() {}
 
-void BridgeConn::init(const std::string &bridge_stream_id,
-                      const std::string &src_stream_id,
-                      const std::string &ip,
-                      uint16_t port,
-                      std::shared_ptr<erizo::IOThreadPool> io_thread_pool,
-                      bool is_send,
-                      uint32_t video_ssrc,
-                      uint32_t audio_ssrc)
+int BridgeConn::init(const InternedId &bridge_stream_id,
+                     const InternedId &src_stream_id,
+                     const std::string &ip,
+                     uint16_t port,
+                     std::shared_ptr<erizo::IOThreadPool> io_thread_pool,
+                     bool is_send,
+                     uint32_t video_ssrc,
+                     uint32_t audio_ssrc,
+                     uint32_t fec_group)
 {
     if (init_)
-        return;
+        return 0;
 
     bridge_stream_id_ = bridge_stream_id;
     src_stream_id_ = src_stream_id;
     is_send_ = is_send;
+    ip_ = ip;
+    port_ = port;
+    video_ssrc_ = video_ssrc;
+    audio_ssrc_ = audio_ssrc;
+    io_worker_ = WorkerBalancer::getInstance()->getIOWorker(io_thread_pool);
+
+    if (BridgeMux::getInstance()->isInit())
+    {
+        if (initMux(ip, port, video_ssrc, audio_ssrc, fec_group))
+            return 1;
+        init_ = true;
+        return 0;
+    }
 
     bridge_media_stream_ = std::make_shared<erizo::BridgeMediaStream>();
-    std::shared_ptr<erizo::IOWorker> io_worker = io_thread_pool->getLessUsedIOWorker();
-    bridge_media_stream_->init(ip, port, bridge_stream_id_, io_worker, !is_send_, video_ssrc, audio_ssrc);
+    bridge_media_stream_->init(ip, port, bridge_stream_id_, io_worker_, !is_send_, video_ssrc, audio_ssrc);
 
     if (!is_send_)
-    {
-        otm_processor_ = std::make_shared<erizo::OneToManyProcessor>();
-        bridge_media_stream_->setAudioSink(otm_processor_.get());
-        bridge_media_stream_->setVideoSink(otm_processor_.get());
-        bridge_media_stream_->setEventSink(otm_processor_.get());
-        otm_processor_->setPublisher(bridge_media_stream_);
-    }
+        initOtm(bridge_media_stream_);
 
     erizo::BridgeIO::getInstance()->addStream(bridge_stream_id_, bridge_media_stream_);
     init_ = true;
+
+    // a sending bridge is weighed by its source, known once it is attached
+    if (!is_send_)
+    {
+        packet_source_ = publisher_proxy_;
+        WorkerBalancer::getInstance()->addBridge(shared_from_this());
+    }
+    return 0;
+}
+
+int BridgeConn::initMux(const std::string &ip, uint16_t port, uint32_t video_ssrc, uint32_t audio_ssrc, uint32_t fec_group)
+{
+    if (is_send_)
+    {
+        mux_link_ = BridgeMux::getInstance()->addLink(ip, port + Config::getInstance()->bridge_mux_port_offset);
+        mux_sink_ = std::make_shared<BridgeMuxSink>(bridge_stream_id_, mux_link_, fec_group);
+        if (BridgeMux::getInstance()->addSink(mux_sink_))
+        {
+            mux_sink_->close();
+            mux_sink_.reset();
+            mux_sink_ = nullptr;
+            BridgeMux::getInstance()->removeLink(mux_link_);
+            mux_link_.reset();
+            mux_link_ = nullptr;
+            return 1;
+        }
+    }
+    else
+    {
+        mux_source_ = std::make_shared<BridgeMuxSource>(bridge_stream_id_, video_ssrc, audio_ssrc);
+        initOtm(mux_source_);
+        if (BridgeMux::getInstance()->addSource(mux_source_))
+        {
+            mux_source_->close();
+            closeOtm();
+            mux_source_.reset();
+            mux_source_ = nullptr;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void BridgeConn::closeMux()
+{
+    if (is_send_)
+    {
+        BridgeMux::getInstance()->removeSink(mux_sink_);
+        mux_sink_->close();
+        mux_sink_.reset();
+        mux_sink_ = nullptr;
+        BridgeMux::getInstance()->removeLink(mux_link_);
+        mux_link_.reset();
+        mux_link_ = nullptr;
+    }
+    else
+    {
+        BridgeMux::getInstance()->removeSource(mux_source_);
+        mux_source_->close();
+        closeOtm();
+        mux_source_.reset();
+        mux_source_ = nullptr;
+    }
+}
+
+void BridgeConn::initOtm(std::shared_ptr<erizo::MediaSource> publisher)
+{
+    otm_processor_ = std::make_shared<erizo::OneToManyProcessor>();
+    publisher_proxy_ = std::make_shared<PublisherProxy>(bridge_stream_id_, publisher);
+    publisher->setAudioSink(publisher_proxy_.get());
+    publisher->setVideoSink(publisher_proxy_.get());
+    publisher->setEventSink(publisher_proxy_.get());
+    publisher_proxy_->setProcessor(otm_processor_);
+    otm_processor_->setPublisher(publisher_proxy_);
+}
+
+void BridgeConn::closeOtm()
+{
+    subscribers_.clear();
+    publisher_proxy_->close();
+    otm_processor_->close();
+    otm_processor_.reset();
+    otm_processor_ = nullptr;
+    publisher_proxy_.reset();
+    publisher_proxy_ = nullptr;
 }
 
 void BridgeConn::close()
 {
     if (!init_)
         return;
-    erizo::BridgeIO::getInstance()->removeStream(bridge_stream_id_);
 
-    bridge_media_stream_->setFeedbackSink(nullptr);
-    bridge_media_stream_->setAudioSink(nullptr);
-    bridge_media_stream_->setVideoSink(nullptr);
-    bridge_media_stream_->setEventSink(nullptr);
-    if (!is_send_)
+    if (mux_sink_ != nullptr || mux_source_ != nullptr)
     {
-        otm_processor_->close();
-        otm_processor_.reset();
-        otm_processor_ = nullptr;
+        closeMux();
+        std::unique_lock<std::mutex> lock(mux_);
+        io_worker_.reset();
+        io_worker_ = nullptr;
+        init_ = false;
+        return;
     }
+
+    WorkerBalancer::getInstance()->removeBridge(this);
+    std::unique_lock<std::mutex> lock(mux_);
+    erizo::BridgeIO::getInstance()->removeStream(bridge_stream_id_);
+
+    detachStream(bridge_media_stream_);
+    if (retired_stream_ != nullptr)
+        detachStream(retired_stream_);
+    if (!is_send_)
+        closeOtm();
     bridge_media_stream_->uninit();
     bridge_media_stream_.reset();
     bridge_media_stream_ = nullptr;
+    if (retired_stream_ != nullptr)
+    {
+        retired_stream_->uninit();
+        retired_stream_.reset();
+        retired_stream_ = nullptr;
+        retired_worker_.reset();
+        retired_worker_ = nullptr;
+    }
+    io_worker_.reset();
+    io_worker_ = nullptr;
     init_ = false;
 }
 
-std::shared_ptr<erizo::BridgeMediaStream> BridgeConn::getBridgeMediaStream()
+void BridgeConn::asyncClose(const std::function<void()> &callback)
 {
+    std::shared_ptr<erizo::IOWorker> io_worker = getIOWorker();
+    if (io_worker == nullptr)
+    {
+        close();
+        if (callback)
+            callback();
+        return;
+    }
+
+    std::shared_ptr<BridgeConn> self = shared_from_this();
+    io_worker->task([self, callback]() {
+        self->close();
+        if (callback)
+            callback();
+    });
+}
+
+std::shared_ptr<erizo::MediaSink> BridgeConn::getMediaSink()
+{
+    if (mux_sink_ != nullptr)
+        return mux_sink_;
     return bridge_media_stream_;
 }
 
-void BridgeConn::addSubscriber(const std::string &client_id, std::shared_ptr<erizo::MediaStream> media_stream)
+void BridgeConn::setSource(std::shared_ptr<Connection> src_conn)
 {
-    if (otm_processor_ != nullptr)
+    if (!is_send_ || bridge_media_stream_ == nullptr)
+        return;
+
+    src_conn_ = src_conn;
+    src_worker_ = src_conn->getWorker();
+    packet_source_ = src_conn->getPublisherProxy();
+    WorkerBalancer::getInstance()->addBridge(shared_from_this());
+}
+
+std::shared_ptr<erizo::IOWorker> BridgeConn::getIOWorker()
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    return io_worker_;
+}
+
+uint64_t BridgeConn::getPackets()
+{
+    std::shared_ptr<PublisherProxy> proxy = packet_source_.lock();
+    if (proxy == nullptr)
+        return 0;
+    return proxy->getPackets();
+}
+
+void BridgeConn::migrate(std::shared_ptr<erizo::IOWorker> io_worker)
+{
+    std::shared_ptr<erizo::IOWorker> from;
     {
-        std::string subscriber_id = (client_id + "_") + bridge_stream_id_;
-        otm_processor_->addSubscriber(media_stream, subscriber_id);
+        std::unique_lock<std::mutex> lock(mux_);
+        if (!init_ || bridge_media_stream_ == nullptr || io_worker_ == io_worker || migrating_)
+            return;
+        from = io_worker_;
+        migrating_ = true;
     }
+
+    // make before break, the new stream is up before anything is routed to it
+    std::shared_ptr<erizo::BridgeMediaStream> stream = std::make_shared<erizo::BridgeMediaStream>();
+    stream->init(ip_, port_, bridge_stream_id_, io_worker, !is_send_, video_ssrc_, audio_ssrc_);
+
+    std::shared_ptr<BridgeConn> self = shared_from_this();
+    std::shared_ptr<Connection> src_conn = src_conn_.lock();
+    std::shared_ptr<erizo::Worker> src_worker = src_worker_.lock();
+    if (is_send_ && src_conn != nullptr && src_worker != nullptr)
+    {
+        // into the source's fan-out first, on its worker so it cannot race
+        // the source closing; the old stream keeps taking the far end's
+        // feedback until the route moves
+        src_worker->task([self, src_conn, stream, io_worker, from]() {
+            src_conn->replaceSubscriber(self->bridge_stream_id_, stream);
+            from->task([self, stream, io_worker]() {
+                self->takeOver(stream, io_worker);
+            });
+        });
+        return;
+    }
+
+    from->task([self, stream, io_worker]() {
+        self->takeOver(stream, io_worker);
+    });
 }
 
-void BridgeConn::removeSubscriber(const std::string &client_id)
+void BridgeConn::takeOver(std::shared_ptr<erizo::BridgeMediaStream> stream, std::shared_ptr<erizo::IOWorker> io_worker)
 {
-    if (otm_processor_ != nullptr)
+    std::unique_lock<std::mutex> lock(mux_);
+    if (!init_)
     {
-        std::string subscriber_id = (client_id + "_") + bridge_stream_id_;
-        otm_processor_->removeSubscriber(subscriber_id);
+        // closed meanwhile, the close already took the bridge out of the fan-out
+        stream->uninit();
+        migrating_ = false;
+        return;
+    }
+
+    std::shared_ptr<PublisherProxy> publisher_proxy = publisher_proxy_;
+    if (!is_send_)
+    {
+        // the old stream delivers what is queued for it on this worker while
+        // the new one starts on its own
+        publisher_proxy->setHandover(true);
+        stream->setAudioSink(publisher_proxy.get());
+        stream->setVideoSink(publisher_proxy.get());
+        stream->setEventSink(publisher_proxy.get());
+        publisher_proxy->setPublisher(stream);
     }
+    // BridgeIO keeps one stream per id, the far end's packets go to the new
+    // one from here on
+    erizo::BridgeIO::getInstance()->addStream(bridge_stream_id_, stream);
+
+    // BridgeIO may have looked the old stream up just before, it stays
+    // whole until the next balancer pass
+    retired_stream_ = bridge_media_stream_;
+    retired_worker_ = io_worker_;
+    bridge_media_stream_ = stream;
+    io_worker_ = io_worker;
+}
+
+void BridgeConn::releaseRetired()
+{
+    std::unique_lock<std::mutex> lock(mux_);
+    if (retired_stream_ == nullptr)
+        return;
+
+    // behind anything still queued for it on its worker, the migration is
+    // over only once this ran
+    std::shared_ptr<BridgeConn> self = shared_from_this();
+    std::shared_ptr<erizo::BridgeMediaStream> stream = retired_stream_;
+    std::shared_ptr<PublisherProxy> publisher_proxy = publisher_proxy_;
+    retired_worker_->task([self, stream, publisher_proxy]() {
+        detachStream(stream);
+        stream->uninit();
+        if (publisher_proxy != nullptr)
+            publisher_proxy->setHandover(false);
+        self->migrating_ = false;
+    });
+    retired_stream_.reset();
+    retired_stream_ = nullptr;
+    retired_worker_.reset();
+    retired_worker_ = nullptr;
+}
+
+void BridgeConn::detachStream(std::shared_ptr<erizo::BridgeMediaStream> stream)
+{
+    stream->setFeedbackSink(nullptr);
+    stream->setAudioSink(nullptr);
+    stream->setVideoSink(nullptr);
+    stream->setEventSink(nullptr);
+}
+
+void BridgeConn::addSubscriber(const InternedId &client_id, std::shared_ptr<Connection> sub_conn)
+{
+    if (otm_processor_ == nullptr)
+        return;
+    publisher_proxy_->addSubscriber(sub_conn->getMediaStream(), client_id, false, false);
+    Connection::attach(subscribers_, client_id, sub_conn);
+    sub_conn->setSourceProxy(publisher_proxy_, client_id);
+}
+
+void BridgeConn::removeSubscriber(const InternedId &client_id)
+{
+    if (otm_processor_ != nullptr)
+        publisher_proxy_->removeSubscriber(client_id);
+    Connection::detach(subscribers_, client_id);
 }
\ No newline at end of file
@@ -2,53 +2,142 @@
 #define BRIDGE_CONNECTION_H
 
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
 
 #include <logger.h>
 
+#include "common/interned_id.h"
+#include "connection.h"
+
 namespace erizo
 {
 class BridgeMediaStream;
 class OneToManyProcessor;
 class IOThreadPool;
+class IOWorker;
+class Worker;
 class MediaStream;
+class MediaSink;
+class MediaSource;
 }; // namespace erizo
 
-class BridgeConn
+class BridgeMuxSink;
+class BridgeMuxSource;
+class BridgeLink;
+class PublisherProxy;
+
+class BridgeConn : public std::enable_shared_from_this<BridgeConn>
 {
 public:
   BridgeConn();
   ~BridgeConn();
 
-  void init(const std::string &bridge_stream_id,
-            const std::string &src_stream_id,
-            const std::string &ip,
-            uint16_t port,
-            std::shared_ptr<erizo::IOThreadPool> io_thread_pool,
-            bool is_send,
-            uint32_t video_ssrc = 0,
-            uint32_t audio_ssrc = 0);
+  // 1 if the bridge could not be set up, nothing to close then
+  int init(const InternedId &bridge_stream_id,
+           const InternedId &src_stream_id,
+           const std::string &ip,
+           uint16_t port,
+           std::shared_ptr<erizo::IOThreadPool> io_thread_pool,
+           bool is_send,
+           uint32_t video_ssrc = 0,
+           uint32_t audio_ssrc = 0,
+           uint32_t fec_group = 0);
   void close();
+  // close() on the owning io worker, callback runs there once it is done
+  void asyncClose(const std::function<void()> &callback);
 
-  void addSubscriber(const std::string &client_id, std::shared_ptr<erizo::MediaStream> media_stream);
-  void removeSubscriber(const std::string &client_id);
-  std::shared_ptr<erizo::BridgeMediaStream> getBridgeMediaStream();
+  // receiving side only, sub_conn's stream joins the fan-out
+  void addSubscriber(const InternedId &client_id, std::shared_ptr<Connection> sub_conn);
+  // synchronous, nothing reaches the subscriber once it returns
+  void removeSubscriber(const InternedId &client_id);
+  // what the publisher's OneToManyProcessor should feed on a sending bridge
+  std::shared_ptr<erizo::MediaSink> getMediaSink();
+  // sending side, once src_conn feeds getMediaSink()
+  void setSource(std::shared_ptr<Connection> src_conn);
 
-  const std::string &getSrcStreamId()
+  // Without multiplex: rebuilds the stream on io_worker and hands over to it
+  // before the old one closes. A BridgeMediaStream has no socket of its own,
+  // BridgeIO routes to it by id, so the far end sees no change.
+  void migrate(std::shared_ptr<erizo::IOWorker> io_worker);
+  // a balancer pass after a migration, closes the stream it replaced once
+  // nothing can still be queued for it
+  void releaseRetired();
+  std::shared_ptr<erizo::IOWorker> getIOWorker();
+  // what passes the bridge: its publisher's packets, or the source's it sends
+  uint64_t getPackets();
+
+  const InternedId &getSrcStreamId()
   {
     return src_stream_id_;
   }
 
-  const std::string &getBridgeStreamId()
+  const InternedId &getBridgeStreamId()
   {
     return bridge_stream_id_;
   }
 
+  // virtual subscriber, the other end is the virtual publisher
+  bool isSend()
+  {
+    return is_send_;
+  }
+
+  // what admission charged the bridge, dispatch thread only
+  void setResourceCost(const ResourceCost &cost)
+  {
+    resource_cost_ = cost;
+  }
+
+  const ResourceCost &getResourceCost()
+  {
+    return resource_cost_;
+  }
+
+private:
+  int initMux(const std::string &ip, uint16_t port, uint32_t video_ssrc, uint32_t audio_ssrc, uint32_t fec_group);
+  void closeMux();
+  // receiving side: publisher -> PublisherProxy -> OneToManyProcessor
+  void initOtm(std::shared_ptr<erizo::MediaSource> publisher);
+  void closeOtm();
+  // on the old io worker, stream takes over the bridge's traffic
+  void takeOver(std::shared_ptr<erizo::BridgeMediaStream> stream, std::shared_ptr<erizo::IOWorker> io_worker);
+  static void detachStream(std::shared_ptr<erizo::BridgeMediaStream> stream);
+
 private:
   std::shared_ptr<erizo::BridgeMediaStream> bridge_media_stream_;
   std::shared_ptr<erizo::OneToManyProcessor> otm_processor_;
+  std::shared_ptr<PublisherProxy> publisher_proxy_;
+  // multiplexed mode, in place of bridge_media_stream_
+  std::shared_ptr<BridgeMuxSink> mux_sink_;
+  std::shared_ptr<BridgeMuxSource> mux_source_;
+  std::shared_ptr<BridgeLink> mux_link_;
+  // with bridge_media_stream_ under mux_, a migration replaces both
+  std::shared_ptr<erizo::IOWorker> io_worker_;
+  std::mutex mux_;
+  std::atomic<bool> migrating_;
+  // replaced by a migration, still delivers what BridgeIO handed it before
+  std::shared_ptr<erizo::BridgeMediaStream> retired_stream_;
+  std::shared_ptr<erizo::IOWorker> retired_worker_;
+
+  // receiving side
+  SubscriberMap subscribers_;
+  // sending side, the publisher feeding the bridge and its worker
+  std::weak_ptr<Connection> src_conn_;
+  std::weak_ptr<erizo::Worker> src_worker_;
+  // receiving side the bridge's own, sending side the source's
+  std::weak_ptr<PublisherProxy> packet_source_;
+
+  // what the stream is rebuilt from
+  std::string ip_;
+  uint16_t port_;
+  uint32_t video_ssrc_;
+  uint32_t audio_ssrc_;
+  ResourceCost resource_cost_;
 
-  std::string bridge_stream_id_;
-  std::string src_stream_id_;
+  InternedId bridge_stream_id_;
+  InternedId src_stream_id_;
   bool is_send_;
   bool init_;
 };
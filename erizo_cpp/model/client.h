@@ -5,13 +5,24 @@
 #include <memory>
 #include <map>
 
+#include "common/slab_pool.h"
+#include "common/interned_id.h"
+
 class Connection;
 
+// stream_id -> connection, ordered by handle, nodes from the dispatch
+// thread's slabs
+typedef std::map<InternedId,
+                 std::shared_ptr<Connection>,
+                 std::less<InternedId>,
+                 SlabAllocator<std::pair<const InternedId, std::shared_ptr<Connection>>>>
+    ConnectionMap;
+
 struct Client
 {
-    std::string id;
-    std::map<std::string, std::shared_ptr<Connection>> subscribers;
-    std::map<std::string, std::shared_ptr<Connection>> publishers;
+    InternedId id;
+    ConnectionMap subscribers;
+    ConnectionMap publishers;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -3,7 +3,6 @@
 #include <json/json.h>
 
 #include <IceConnection.h>
-#include <BridgeMediaStream.h>
 #include <OneToManyProcessor.h>
 #include <thread/ThreadPool.h>
 #include <thread/IOThreadPool.h>
@@ -12,14 +11,30 @@
 #include "rabbitmq/amqp_helper.h"
 #include "common/utils.h"
 #include "common/config.h"
+#include "common/trace.h"
 #include "core/erizo.h"
+#include "core/interface_balancer.h"
+#include "core/worker_balancer.h"
+#include "media/publisher_proxy.h"
+#include "media/active_speaker.h"
+#include "media/audio_level.h"
 
 DEFINE_LOGGER(Connection, "Connection");
 
 Connection::Connection() : webrtc_connection_(nullptr),
                            otm_processor_(nullptr),
+                           publisher_proxy_(nullptr),
+                           speaker_detector_(nullptr),
                            media_stream_(nullptr),
+                           worker_(nullptr),
                            listener_(nullptr),
+                           config_(nullptr),
+                           network_interface_(""),
+                           resource_cost_(),
+                           attach_count_(0),
+                           ready_(false),
+                           source_proxy_(),
+                           source_id_(""),
                            agent_id_(""),
                            erizo_id_(""),
                            room_id_(""),
@@ -28,14 +43,17 @@ Connection::Connection() : webrtc_connection_(nullptr),
                            label_(""),
                            is_publisher_(false),
                            reply_to_(""),
+                           trace_id_(0),
+                           init_time_(0),
+                           sdp_time_(0),
                            init_(false) {}
 
 Connection::~Connection() {}
 
-void Connection::init(const std::string &agent_id,
-                      const std::string &erizo_id,
-                      const std::string &client_id,
-                      const std::string &stream_id,
+void Connection::init(const InternedId &agent_id,
+                      const InternedId &erizo_id,
+                      const InternedId &client_id,
+                      const InternedId &stream_id,
                       const std::string &label,
                       bool is_publisher,
                       const std::string &reply_to,
@@ -46,6 +64,7 @@ void Connection::init(const std::string &agent_id,
     if (init_)
         return;
 
+    config_ = Config::getSnapshot();
     agent_id_ = agent_id;
     erizo_id_ = erizo_id;
     client_id_ = client_id;
@@ -53,27 +72,36 @@ void Connection::init(const std::string &agent_id,
     label_ = label;
     is_publisher_ = is_publisher;
     reply_to_ = reply_to;
+    trace_id_ = Tracer::makeId(client_id_, stream_id_);
 
-    std::shared_ptr<erizo::Worker> worker = thread_pool->getLessUsedWorker();
-    std::shared_ptr<erizo::IOWorker> io_worker = io_thread_pool->getLessUsedIOWorker();
+    worker_ = thread_pool->getLessUsedWorker();
+    // the ICE agent and DTLS socket stay on this io worker for good
+    std::shared_ptr<erizo::IOWorker> io_worker = WorkerBalancer::getInstance()->getIOWorker(io_thread_pool);
 
+    // libnice binds its own ports for every connection inside licode, there is
+    // no way to hand it a shared SO_REUSEPORT socket, so a single port ICE mode
+    // waits on licode, min_port/max_port bound the connections until then
     erizo::IceConfig ice_config;
-    ice_config.stun_server = Config::getInstance()->stun_server;
-    ice_config.stun_port = Config::getInstance()->stun_port;
-    ice_config.min_port = Config::getInstance()->min_port;
-    ice_config.max_port = Config::getInstance()->max_port;
-    ice_config.should_trickle = Config::getInstance()->should_trickle;
-    ice_config.turn_server = Config::getInstance()->turn_server;
-    ice_config.turn_port = Config::getInstance()->turn_port;
-    ice_config.turn_username = Config::getInstance()->turn_username;
-    ice_config.turn_pass = Config::getInstance()->turn_passwd;
+    ice_config.stun_server = config_->stun_server;
+    ice_config.stun_port = config_->stun_port;
+    ice_config.min_port = config_->min_port;
+    ice_config.max_port = config_->max_port;
+    ice_config.ice_components = config_->ice_components;
+    ice_config.should_trickle = config_->should_trickle;
+    ice_config.turn_server = config_->turn_server;
+    ice_config.turn_port = config_->turn_port;
+    ice_config.turn_username = config_->turn_username;
+    ice_config.turn_pass = config_->turn_passwd;
     ice_config.network_interface = "";
     printf("isp:%s\n", isp.c_str());
-    auto it = Config::getInstance()->network_interfaces_.find(isp);
-    if (it != Config::getInstance()->network_interfaces_.end())
-        ice_config.network_interface = it->second;
+    auto it = config_->network_interfaces_.find(isp);
+    if (it != config_->network_interfaces_.end())
+    {
+        network_interface_ = InterfaceBalancer::getInstance()->acquire(it->second, is_publisher_);
+        ice_config.network_interface = network_interface_;
+    }
 
-    webrtc_connection_ = std::make_shared<erizo::WebRtcConnection>(worker, io_worker, Utils::getUUID(), ice_config, Config::getInstance()->rtp_maps, Config::getInstance()->ext_maps, this);
+    webrtc_connection_ = std::make_shared<erizo::WebRtcConnection>(worker_, io_worker, Utils::getUUID(), ice_config, config_->rtp_maps, config_->ext_maps, this);
 
     std::shared_ptr<erizo::Worker> ms_worker = thread_pool->getLessUsedWorker();
     media_stream_ = std::make_shared<erizo::MediaStream>(ms_worker, webrtc_connection_, stream_id, label_, is_publisher_);
@@ -81,13 +109,23 @@ void Connection::init(const std::string &agent_id,
     if (is_publisher_)
     {
         otm_processor_ = std::make_shared<erizo::OneToManyProcessor>();
-        media_stream_->setAudioSink(otm_processor_.get());
-        media_stream_->setVideoSink(otm_processor_.get());
-        media_stream_->setEventSink(otm_processor_.get());
-        otm_processor_->setPublisher(media_stream_);
+        publisher_proxy_ = std::make_shared<PublisherProxy>(stream_id_, media_stream_);
+        media_stream_->setAudioSink(publisher_proxy_.get());
+        media_stream_->setVideoSink(publisher_proxy_.get());
+        media_stream_->setEventSink(publisher_proxy_.get());
+        publisher_proxy_->setProcessor(otm_processor_);
+        otm_processor_->setPublisher(publisher_proxy_);
+    }
+
+    else
+    {
+        auto itc = config_->isp_video_constraints_.find(isp);
+        if (itc != config_->isp_video_constraints_.end())
+            media_stream_->setVideoConstraints(itc->second.max_width, itc->second.max_height, itc->second.max_fps);
     }
 
     webrtc_connection_->addMediaStream(media_stream_);
+    init_time_ = Tracer::now();
     webrtc_connection_->init();
     init_ = true;
 }
@@ -106,17 +144,36 @@ void Connection::close()
     media_stream_->setAudioSink(nullptr);
     media_stream_->setVideoSink(nullptr);
     media_stream_->setEventSink(nullptr);
+    if (speaker_detector_ != nullptr)
+    {
+        speaker_detector_->removeSpeaker(stream_id_);
+        speaker_detector_.reset();
+        speaker_detector_ = nullptr;
+    }
     if (is_publisher_)
     {
+        // whoever is left here was never detached, their count says so
+        subscribers_.clear();
+        publisher_proxy_->close();
         otm_processor_->close();
         otm_processor_.reset();
         otm_processor_ = nullptr;
+        publisher_proxy_.reset();
+        publisher_proxy_ = nullptr;
     }
     media_stream_->close();
     media_stream_.reset();
     media_stream_ = nullptr;
 
     listener_ = nullptr;
+    worker_.reset();
+    worker_ = nullptr;
+
+    if (!network_interface_.empty())
+    {
+        InterfaceBalancer::getInstance()->release(network_interface_);
+        network_interface_ = "";
+    }
 
     agent_id_ = "";
     erizo_id_ = "";
@@ -130,6 +187,25 @@ void Connection::close()
     init_ = false;
 }
 
+void Connection::asyncClose(const std::function<void()> &callback)
+{
+    std::shared_ptr<erizo::Worker> worker = worker_;
+    if (worker == nullptr)
+    {
+        close();
+        if (callback)
+            callback();
+        return;
+    }
+
+    std::shared_ptr<Connection> self = shared_from_this();
+    worker->task([self, callback]() {
+        self->close();
+        if (callback)
+            callback();
+    });
+}
+
 void Connection::notifyEvent(erizo::WebRTCEvent newEvent, const std::string &message, const std::string &stream_id)
 {
     Json::Value data = Json::nullValue;
@@ -137,12 +213,20 @@ void Connection::notifyEvent(erizo::WebRTCEvent newEvent, const std::string &mes
     {
     case erizo::CONN_INITIAL:
         data["type"] = "started";
-        data["agentId"] = agent_id_;
-        data["erizoId"] = erizo_id_;
-        data["streamId"] = stream_id_;
-        data["clientId"] = client_id_;
+        data["agentId"] = agent_id_.str();
+        data["erizoId"] = erizo_id_.str();
+        data["streamId"] = stream_id_.str();
+        data["clientId"] = client_id_.str();
+        break;
+    case erizo::CONN_GATHERED:
+        Tracer::getInstance()->record(trace_id_, TRACE_ICE_GATHER, init_time_, Tracer::now());
         break;
     case erizo::CONN_SDP_PROCESSED:
+    {
+        // also fires with no setRemoteSdp before it, nothing to time then
+        uint64_t sdp_time = sdp_time_.exchange(0);
+        if (sdp_time != 0)
+            Tracer::getInstance()->record(trace_id_, TRACE_SDP_PROCESS, sdp_time, Tracer::now());
         if (is_publisher_)
         {
             uint32_t video_ssrc;
@@ -151,45 +235,124 @@ void Connection::notifyEvent(erizo::WebRTCEvent newEvent, const std::string &mes
             data["type"] = "publisher_answer";
             data["videoSSRC"] = video_ssrc;
             data["audioSSRC"] = audio_ssrc;
-            data["roomId"] = room_id_;
+            data["roomId"] = room_id_.str();
+            publisher_proxy_->setAudioLevelExtId(getAudioLevelExtId());
         }
         else
         {
             data["type"] = "subscriber_answer";
-            data["erizoId"] = erizo_id_;
+            data["erizoId"] = erizo_id_.str();
         }
 
-        data["streamId"] = stream_id_;
-        data["clientId"] = client_id_;
+        data["streamId"] = stream_id_.str();
+        data["clientId"] = client_id_.str();
         data["sdp"] = message;
         break;
+    }
     case erizo::CONN_READY:
+        if (!is_publisher_)
+        {
+            std::shared_ptr<PublisherProxy> proxy;
+            InternedId source_id;
+            {
+                std::unique_lock<std::mutex> lock(ready_mux_);
+                ready_ = true;
+                proxy = source_proxy_.lock();
+                source_id = source_id_;
+            }
+            if (proxy != nullptr)
+                proxy->setSubscriberReady(source_id, media_stream_);
+        }
         data["type"] = "ready";
-        data["streamId"] = stream_id_;
-        data["clientId"] = client_id_;
+        data["streamId"] = stream_id_.str();
+        data["clientId"] = client_id_.str();
         if (is_publisher_)
-            data["roomId"] = room_id_;
+            data["roomId"] = room_id_.str();
         break;
     case erizo::CONN_FAILED:
-        ELOG_ERROR("stream-->%s ice failed", stream_id_);
+        ELOG_ERROR("stream-->%s ice failed", stream_id_.str());
         break;
     default:
         break;
     }
 
-    if (data.type() != Json::nullValue && listener_ != nullptr)
+    if (data.type() != Json::nullValue)
+        sendEvent(data);
+}
+
+void Connection::sendEvent(const Json::Value &data)
+{
+    if (listener_ != nullptr)
     {
         Json::FastWriter writer;
         Json::Value reply;
         reply["data"] = data;
         std::string msg = writer.write(reply);
         if (listener_ != nullptr)
-            listener_->onEvent(reply_to_, msg);
+            listener_->onEvent(reply_to_, msg, trace_id_);
+    }
+}
+
+void Connection::setSpeakerDetector(std::shared_ptr<ActiveSpeakerDetector> detector)
+{
+    if (!is_publisher_ || speaker_detector_ != nullptr)
+        return;
+
+    speaker_detector_ = detector;
+    std::weak_ptr<Connection> weak_self = shared_from_this();
+    std::shared_ptr<ActiveSpeakerDetector::Speaker> speaker = speaker_detector_->addSpeaker(stream_id_, [weak_self](const std::vector<std::string> &ranking) {
+        std::shared_ptr<Connection> self = weak_self.lock();
+        if (self != nullptr)
+            self->notifyActiveSpeaker(ranking);
+    });
+    publisher_proxy_->setSpeaker(speaker_detector_, speaker);
+}
+
+void Connection::setSourceProxy(std::shared_ptr<PublisherProxy> proxy, const InternedId &id)
+{
+    {
+        std::unique_lock<std::mutex> lock(ready_mux_);
+        source_proxy_ = proxy;
+        source_id_ = id;
+        if (!ready_)
+            return;
+    }
+    proxy->setSubscriberReady(id, media_stream_);
+}
+
+void Connection::notifyActiveSpeaker(const std::vector<std::string> &ranking)
+{
+    // runs on whichever publisher's delivery thread re-ranked the room
+    Json::Value data;
+    data["type"] = "activeSpeaker";
+    data["roomId"] = room_id_.str();
+    data["streamId"] = stream_id_.str();
+    data["clientId"] = client_id_.str();
+    data["lastN"] = Json::arrayValue;
+    for (const std::string &stream_id : ranking)
+        data["lastN"].append(stream_id);
+    sendEvent(data);
+}
+
+uint8_t Connection::getAudioLevelExtId()
+{
+    // the publisher's offer picks the id, the configured one is the fallback
+    for (const erizo::ExtMap &ext_map : media_stream_->getRemoteSdpInfo()->extMapVector)
+    {
+        if (ext_map.uri == RTP_AUDIO_LEVEL_URI)
+            return ext_map.value;
     }
+    for (const erizo::ExtMap &ext_map : config_->ext_maps)
+    {
+        if (ext_map.uri == RTP_AUDIO_LEVEL_URI)
+            return ext_map.value;
+    }
+    return 0;
 }
 
 int Connection::setRemoteSdp(const std::string &sdp)
 {
+    sdp_time_ = Tracer::now();
     if (webrtc_connection_ == nullptr || !webrtc_connection_->setRemoteSdp(sdp, stream_id_))
         return 1;
     return 0;
@@ -202,30 +365,41 @@ int Connection::addRemoteCandidate(const std::string &mid, int sdp_mine_index, c
     return 0;
 }
 
-void Connection::addSubscriber(const std::string &client_id, std::shared_ptr<erizo::MediaStream> media_stream)
+void Connection::addSubscriber(const InternedId &client_id, std::shared_ptr<Connection> sub_conn)
+{
+    if (otm_processor_ == nullptr)
+        return;
+
+    publisher_proxy_->addSubscriber(sub_conn->getMediaStream(), client_id, false, false);
+    attach(subscribers_, client_id, sub_conn);
+    sub_conn->setSourceProxy(publisher_proxy_, client_id);
+}
+
+void Connection::addSubscriber(const InternedId &bridge_stream_id, std::shared_ptr<erizo::MediaSink> bridge_sink)
 {
     if (otm_processor_ != nullptr)
-    {
-        std::string subscriber_id = (client_id + "_") + stream_id_;
-        otm_processor_->addSubscriber(media_stream, subscriber_id);
-    }
+        publisher_proxy_->addSubscriber(bridge_sink, bridge_stream_id, true, true);
 }
 
-void Connection::addSubscriber(const std::string &bridge_stream_id, std::shared_ptr<erizo::BridgeMediaStream> bridge_media_stream)
+void Connection::replaceSubscriber(const InternedId &bridge_stream_id, std::shared_ptr<erizo::MediaSink> bridge_sink)
 {
     if (otm_processor_ != nullptr)
-    {
-        otm_processor_->addSubscriber(bridge_media_stream, bridge_stream_id);
-    }
+        publisher_proxy_->replaceSubscriber(bridge_sink, bridge_stream_id);
 }
 
-void Connection::removeSubscriber(const std::string &client_id)
+void Connection::removeSubscriber(const InternedId &id)
 {
     if (otm_processor_ != nullptr)
-    {
-        std::string subscriber_id = (client_id + "_") + stream_id_;
-        otm_processor_->removeSubscriber(subscriber_id);
-    }
+        publisher_proxy_->removeSubscriber(id);
+    detach(subscribers_, id);
+}
+
+int Connection::setQualityLayer(int spatial_layer, int temporal_layer)
+{
+    if (is_publisher_ || media_stream_ == nullptr)
+        return 1;
+    media_stream_->setQualityLayer(spatial_layer, temporal_layer);
+    return 0;
 }
 
 std::shared_ptr<erizo::MediaStream> Connection::getMediaStream()
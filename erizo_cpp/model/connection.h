@@ -4,23 +4,39 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <functional>
 
+#include <json/json.h>
 #include <logger.h>
 #include <WebRtcConnection.h>
 
+#include "common/interned_id.h"
+#include "core/resource_accountant.h"
+
 namespace erizo
 {
 class MediaStream;
-class BridgeMediaStream;
+class MediaSink;
 class OneToManyProcessor;
 class ThreadPool;
 class IOThreadPool;
+class Worker;
 }; // namespace erizo
 
 class ConnectionListener;
+class Config;
+class PublisherProxy;
+class ActiveSpeakerDetector;
 class AMQPHelper;
 
-class Connection : public erizo::WebRtcConnectionEventListener
+class Connection;
+typedef std::map<InternedId, std::weak_ptr<Connection>> SubscriberMap;
+
+class Connection : public erizo::WebRtcConnectionEventListener,
+                   public std::enable_shared_from_this<Connection>
 {
   DECLARE_LOGGER();
 
@@ -30,10 +46,10 @@ public:
 
   void setConnectionListener(ConnectionListener *listener) { listener_ = listener; }
 
-  void init(const std::string &agent_id,
-            const std::string &erizo_id,
-            const std::string &client_id,
-            const std::string &stream_id,
+  void init(const InternedId &agent_id,
+            const InternedId &erizo_id,
+            const InternedId &client_id,
+            const InternedId &stream_id,
             const std::string &label,
             bool is_publisher,
             const std::string &reply_to,
@@ -41,40 +57,138 @@ public:
             std::shared_ptr<erizo::ThreadPool> thread_pool,
             std::shared_ptr<erizo::IOThreadPool> io_thread_pool);
   void close();
+  // close() on the owning worker, callback runs there once it is done
+  void asyncClose(const std::function<void()> &callback);
 
   int setRemoteSdp(const std::string &sdp);
   int addRemoteCandidate(const std::string &mid, int sdp_mine_index, const std::string &sdp);
-  void addSubscriber(const std::string &client_id, std::shared_ptr<erizo::MediaStream> media_stream);
-  void addSubscriber(const std::string &bridge_stream_id, std::shared_ptr<erizo::BridgeMediaStream> bridge_media_stream);
-  void removeSubscriber(const std::string &client);
+  // publisher only, sub_conn's stream joins the fan-out
+  void addSubscriber(const InternedId &client_id, std::shared_ptr<Connection> sub_conn);
+  void addSubscriber(const InternedId &bridge_stream_id, std::shared_ptr<erizo::MediaSink> bridge_sink);
+  // on the connection's worker, a bridge rebuilt on another io worker takes
+  // the place of its old stream
+  void replaceSubscriber(const InternedId &bridge_stream_id, std::shared_ptr<erizo::MediaSink> bridge_sink);
+  // synchronous, nothing reaches the subscriber once it returns
+  void removeSubscriber(const InternedId &id);
   std::shared_ptr<erizo::MediaStream> getMediaStream();
+  // subscriber only, forces a simulcast layer, -1 hands the choice back to the bandwidth estimate
+  int setQualityLayer(int spatial_layer, int temporal_layer);
+  // subscriber only, the fan-out that holds it back until its transport is
+  // ready, under id; lets it in right away if that already happened
+  void setSourceProxy(std::shared_ptr<PublisherProxy> proxy, const InternedId &id);
+  // publisher only, ranks it among the room's speakers
+  void setSpeakerDetector(std::shared_ptr<ActiveSpeakerDetector> detector);
 
   const std::string &getStreamId()
   {
     return stream_id_;
   }
 
-  void setRoomId(const std::string &room_id)
+  const InternedId &getClientId()
+  {
+    return client_id_;
+  }
+
+  std::shared_ptr<erizo::Worker> getWorker()
+  {
+    return worker_;
+  }
+
+  bool isPublisher()
+  {
+    return is_publisher_;
+  }
+
+  // what admission charged the connection, dispatch thread only
+  void setResourceCost(const ResourceCost &cost)
+  {
+    resource_cost_ = cost;
+  }
+
+  const ResourceCost &getResourceCost()
+  {
+    return resource_cost_;
+  }
+
+  // publisher only, nullptr once closed
+  std::shared_ptr<PublisherProxy> getPublisherProxy()
+  {
+    return publisher_proxy_;
+  }
+
+  // subscriber only, the publisher fan-outs its stream is in; it must be
+  // detached from every one of them before it is closed
+  uint32_t getAttachCount()
+  {
+    return attach_count_;
+  }
+
+  // the subscribers a publisher, Connection or BridgeConn, added to its
+  // fan-out, dispatch thread only; attach() replaces one of the same id
+  static void attach(SubscriberMap &subscribers, const InternedId &id, std::shared_ptr<Connection> sub_conn)
+  {
+    detach(subscribers, id);
+    sub_conn->attach_count_++;
+    subscribers[id] = sub_conn;
+  }
+
+  static void detach(SubscriberMap &subscribers, const InternedId &id)
+  {
+    auto it = subscribers.find(id);
+    if (it == subscribers.end())
+      return;
+    std::shared_ptr<Connection> sub_conn = it->second.lock();
+    if (sub_conn != nullptr)
+      sub_conn->attach_count_--;
+    subscribers.erase(it);
+  }
+
+  void setRoomId(const InternedId &room_id)
   {
     room_id_ = room_id;
   }
 
   void notifyEvent(erizo::WebRTCEvent newEvent, const std::string &message, const std::string &stream_id = "") override;
 
+private:
+  void notifyActiveSpeaker(const std::vector<std::string> &ranking);
+  void sendEvent(const Json::Value &data);
+  uint8_t getAudioLevelExtId();
+
 private:
   std::shared_ptr<erizo::WebRtcConnection> webrtc_connection_;
   std::shared_ptr<erizo::OneToManyProcessor> otm_processor_;
+  std::shared_ptr<PublisherProxy> publisher_proxy_;
+  std::shared_ptr<ActiveSpeakerDetector> speaker_detector_;
   std::shared_ptr<erizo::MediaStream> media_stream_;
+  std::shared_ptr<erizo::Worker> worker_;
   ConnectionListener *listener_;
-
-  std::string agent_id_;
-  std::string erizo_id_;
-  std::string room_id_;
-  std::string client_id_;
-  std::string stream_id_;
-  std::string label_;
+  // the config the connection was created with, reloads don't change it
+  std::shared_ptr<Config> config_;
+  // picked among the isp's interfaces, given back on close
+  std::string network_interface_;
+  ResourceCost resource_cost_;
+  // publisher only
+  SubscriberMap subscribers_;
+  std::atomic<uint32_t> attach_count_;
+  // subscriber only, CONN_READY and setSourceProxy race from two threads
+  std::mutex ready_mux_;
+  bool ready_;
+  std::weak_ptr<PublisherProxy> source_proxy_;
+  InternedId source_id_;
+
+  InternedId agent_id_;
+  InternedId erizo_id_;
+  InternedId room_id_;
+  InternedId client_id_;
+  InternedId stream_id_;
+  InternedId label_;
   bool is_publisher_;
-  std::string reply_to_;
+  InternedId reply_to_;
+
+  uint64_t trace_id_;
+  std::atomic<uint64_t> init_time_;
+  std::atomic<uint64_t> sdp_time_;
 
   bool init_;
 };
@@ -0,0 +1,25 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+#include <string>
+#include <map>
+#include <set>
+#include <memory>
+
+#include "common/interned_id.h"
+#include "media/active_speaker.h"
+
+struct Room
+{
+    InternedId id;
+    // stream_id -> publisher client_id
+    std::map<InternedId, InternedId> publishers;
+    // (client_id, stream_id)
+    std::set<std::pair<InternedId, InternedId>> subscribers;
+    // keys of Erizo::bridge_conns_
+    std::set<InternedId> bridges;
+    // ranks the local publishers, last-N among them
+    std::shared_ptr<ActiveSpeakerDetector> speakers;
+};
+
+#endif
@@ -3,12 +3,14 @@
 #include <unistd.h>
 
 #include "common/config.h"
+#include "common/trace.h"
 
 DEFINE_LOGGER(AMQPHelper, "AMQPHelper");
 
 AMQPHelper::AMQPHelper() : conn_(nullptr),
                            recv_thread_(nullptr),
                            send_thread_(nullptr),
+                           dispatch_thread_(nullptr),
                            run_(false),
                            init_(false) {}
 
@@ -59,7 +61,7 @@ int AMQPHelper::checkError(amqp_rpc_reply_t x)
     return 1;
 }
 
-int AMQPHelper::init(const std::string &binding_key, const std::function<void(const std::string &msg)> &func)
+int AMQPHelper::init(const std::string &binding_key, const std::function<void(const std::string &msg, uint64_t recv_time)> &func)
 {
     if (init_)
         return 0;
@@ -131,7 +133,7 @@ int AMQPHelper::init(const std::string &binding_key, const std::function<void(co
     }
 
     run_ = true;
-    recv_thread_ = std::unique_ptr<std::thread>(new std::thread([this, func]() {
+    recv_thread_ = std::unique_ptr<std::thread>(new std::thread([this]() {
         while (run_)
         {
             amqp_rpc_reply_t res;
@@ -150,8 +152,28 @@ int AMQPHelper::init(const std::string &binding_key, const std::function<void(co
                 return;
             }
             std::string msg((const char *)envelope.message.body.bytes, envelope.message.body.len);
-            func(msg);
             amqp_destroy_envelope(&envelope);
+
+            std::unique_lock<std::mutex> lock(recv_queue_mux_);
+            recv_queue_.push({msg, Tracer::now()});
+            recv_cond_.notify_one();
+        }
+    }));
+
+    dispatch_thread_ = std::unique_ptr<std::thread>(new std::thread([this, func]() {
+        while (run_)
+        {
+            std::unique_lock<std::mutex> lock(recv_queue_mux_);
+            while (!recv_queue_.empty())
+            {
+                AMQPRecvData data = recv_queue_.front();
+                recv_queue_.pop();
+                lock.unlock();
+                func(data.msg, data.recv_time);
+                lock.lock();
+            }
+            if (run_)
+                recv_cond_.wait(lock);
         }
     }));
 
@@ -163,7 +185,10 @@ int AMQPHelper::init(const std::string &binding_key, const std::function<void(co
             {
                 AMQPData data = send_queue_.front();
                 send_queue_.pop();
+                uint64_t begin = Tracer::now();
+                Tracer::getInstance()->record(data.trace_id, TRACE_PUBLISH_QUEUE, data.queued_time, begin);
                 send(data.exchange, data.queuename, data.binding_key, data.msg);
+                Tracer::getInstance()->record(data.trace_id, TRACE_BROKER_WRITE, begin, Tracer::now());
             }
             send_cond_.wait(lock);
         }
@@ -183,6 +208,14 @@ void AMQPHelper::close()
     recv_thread_.reset();
     recv_thread_ = nullptr;
 
+    {
+        std::unique_lock<std::mutex> lock(recv_queue_mux_);
+        recv_cond_.notify_all();
+    }
+    dispatch_thread_->join();
+    dispatch_thread_.reset();
+    dispatch_thread_ = nullptr;
+
     send_cond_.notify_all();
     send_thread_->join();
     send_thread_.reset();
@@ -195,14 +228,23 @@ void AMQPHelper::close()
 
     while (!send_queue_.empty())
         send_queue_.pop();
+    while (!recv_queue_.empty())
+        recv_queue_.pop();
 
     init_ = false;
 }
 
-void AMQPHelper::sendMessage(const std::string &queuename, const std::string &binding_key, const std::string &send_msg)
+void AMQPHelper::sendMessage(const std::string &queuename, const std::string &binding_key, const std::string &send_msg, uint64_t trace_id)
+{
+    std::unique_lock<std::mutex> lock(send_queue_mux_);
+    send_queue_.push({Config::getInstance()->uniquecast_exchange, queuename, binding_key, send_msg, trace_id, Tracer::now()});
+    send_cond_.notify_one();
+}
+
+void AMQPHelper::broadcastMessage(const std::string &binding_key, const std::string &send_msg)
 {
     std::unique_lock<std::mutex> lock(send_queue_mux_);
-    send_queue_.push({Config::getInstance()->uniquecast_exchange, queuename, binding_key, send_msg});
+    send_queue_.push({Config::getInstance()->boardcast_exchange, "", binding_key, send_msg, 0, Tracer::now()});
     send_cond_.notify_one();
 }
 
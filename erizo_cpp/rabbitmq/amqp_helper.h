@@ -24,18 +24,30 @@ class AMQPHelper
     std::string queuename;
     std::string binding_key;
     std::string msg;
+    uint64_t trace_id;
+    uint64_t queued_time;
+  };
+
+  struct AMQPRecvData
+  {
+    std::string msg;
+    uint64_t recv_time;
   };
 
 public:
   AMQPHelper();
   ~AMQPHelper();
 
-  int init(const std::string &binding_key, const std::function<void(const std::string &)> &func);
+  // func runs on the dispatch thread, recv_time is Tracer::now() at receipt
+  int init(const std::string &binding_key, const std::function<void(const std::string &msg, uint64_t recv_time)> &func);
   void close();
 
   void sendMessage(const std::string &queuename,
                    const std::string &binding_key,
-                   const std::string &send_msg);
+                   const std::string &send_msg,
+                   uint64_t trace_id = 0);
+  // on the broadcast exchange, to whoever binds binding_key
+  void broadcastMessage(const std::string &binding_key, const std::string &send_msg);
 
 private:
   int checkError(amqp_rpc_reply_t x);
@@ -48,9 +60,13 @@ private:
   std::mutex send_queue_mux_;
   std::condition_variable send_cond_;
   std::queue<AMQPData> send_queue_;
+  std::mutex recv_queue_mux_;
+  std::condition_variable recv_cond_;
+  std::queue<AMQPRecvData> recv_queue_;
   amqp_connection_state_t conn_;
   std::unique_ptr<std::thread> recv_thread_;
   std::unique_ptr<std::thread> send_thread_;
+  std::unique_ptr<std::thread> dispatch_thread_;
   std::atomic<bool> run_;
   bool init_;
 };